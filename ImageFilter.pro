@@ -1,4 +1,4 @@
-QT += core gui widgets
+QT += core gui widgets concurrent
 
 TARGET = ImageFilter
 TEMPLATE = app
@@ -7,13 +7,56 @@ CONFIG += c++11
 
 SOURCES += \
     main.cpp \
+    batchprocessor.cpp \
+    benchmark.cpp \
+    edgedetect.cpp \
+    fftconvolve.cpp \
     filter2d.cpp \
+    filterchain.cpp \
+    framestream.cpp \
+    imageio.cpp \
+    imagestats.cpp \
+    jobscheduler.cpp \
+    kernel.cpp \
+    parallel.cpp \
+    pixellayout.cpp \
+    rankfilter.cpp \
+    recursivegaussian.cpp \
+    resultcache.cpp \
+    separable.cpp \
+    spankernels.cpp \
+    stripstream.cpp \
+    trace.cpp \
+    histogramwidget.cpp \
     imageinfowidget.cpp \
+    imageview.cpp \
     mainwindow.cpp
 
 HEADERS += \
+    batchprocessor.h \
+    benchmark.h \
+    border.h \
+    edgedetect.h \
+    fftconvolve.h \
     filter2d.h \
+    filterchain.h \
+    framestream.h \
+    imageio.h \
+    imagestats.h \
+    jobscheduler.h \
+    kernel.h \
+    parallel.h \
+    pixellayout.h \
+    rankfilter.h \
+    recursivegaussian.h \
+    resultcache.h \
+    separable.h \
+    spankernels.h \
+    stripstream.h \
+    trace.h \
+    histogramwidget.h \
     imageinfowidget.h \
+    imageview.h \
     mainwindow.h
 
 QMAKE_CXXFLAGS += -Wall -Wextra
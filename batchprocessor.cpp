@@ -0,0 +1,417 @@
+#include "batchprocessor.h"
+#include "imageio.h"
+#include "parallel.h"
+#include "stripstream.h"
+#include "trace.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace {
+
+struct BatchItem {
+    int index;
+    QImage image;
+};
+
+// Очередь между стадиями. push ждет, пока освободится место, pop — пока
+// появится элемент или не завершатся все производители.
+class BoundedQueue {
+public:
+    BoundedQueue(int capacity, int producers) : capacity(capacity), producers(producers) {}
+
+    void push(const BatchItem &item) {
+        QMutexLocker locker(&mutex);
+        while (static_cast<int>(items.size()) >= capacity) {
+            notFull.wait(&mutex);
+        }
+        items.push_back(item);
+        notEmpty.wakeOne();
+    }
+
+    bool pop(BatchItem &item) {
+        QMutexLocker locker(&mutex);
+        while (items.empty() && producers > 0) {
+            notEmpty.wait(&mutex);
+        }
+        if (items.empty()) {
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        notFull.wakeOne();
+        return true;
+    }
+
+    void producerDone() {
+        QMutexLocker locker(&mutex);
+        if (--producers == 0) {
+            notEmpty.wakeAll();
+        }
+    }
+
+private:
+    int capacity;
+    int producers;
+    std::deque<BatchItem> items;
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+};
+
+const char *const IMAGE_PATTERNS[] = {"*.png", "*.jpg", "*.jpeg", "*.bmp", "*.ppm", "*.pgm", "*.pnm"};
+
+// Сообщения из разных потоков не должны перемешиваться.
+void printLine(FILE *file, const QString &line) {
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    QTextStream stream(file);
+    stream << line << '\n';
+}
+
+// Пути выходных файлов: для каталога сохраняется структура подкаталогов,
+// отдельный файл кладется прямо в outputDir.
+void collectJobs(const QString &input, const QString &outputDir, const QString &format,
+                 QVector<BatchJob> &jobs) {
+    QFileInfo info(input);
+    QStringList sources;
+    QString root = input;
+    if (info.isDir()) {
+        QStringList patterns;
+        for (const char *pattern : IMAGE_PATTERNS) {
+            patterns << pattern;
+        }
+        QDirIterator it(input, patterns, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            sources << it.next();
+        }
+        // Порядок обхода каталога не определен, а запуски удобнее сравнивать
+        // при одинаковом порядке.
+        sources.sort();
+    } else {
+        sources << input;
+        root = info.path();
+    }
+
+    QDir rootDir(root);
+    QDir output(outputDir);
+    for (const QString &source : sources) {
+        BatchJob job;
+        job.source = source;
+        job.target = output.filePath(rootDir.relativeFilePath(source));
+        if (!format.isEmpty()) {
+            QFileInfo target(job.target);
+            job.target = target.path() + "/" + target.completeBaseName() + "." + format;
+        }
+        jobs.append(job);
+    }
+}
+
+// Два входа с одинаковым путем относительно своего корня (a/img.png и
+// b/img.png из списка) дали бы один выходной файл, и второй молча
+// перезаписал бы первый. Возвращает false и описание первого совпадения.
+bool checkDistinctTargets(const QVector<BatchJob> &jobs, QString &error) {
+    QHash<QString, QString> sources;
+    sources.reserve(jobs.size());
+    for (const BatchJob &job : jobs) {
+        const QString target = QFileInfo(job.target).absoluteFilePath();
+        auto it = sources.constFind(target);
+        if (it != sources.constEnd()) {
+            error = "Файлы " + it.value() + " и " + job.source + " записались бы в один и тот же " + job.target
+                  + ". Передайте их каталог или запустите обработку отдельно.";
+            return false;
+        }
+        sources.insert(target, job.source);
+    }
+    return true;
+}
+
+}
+
+BatchReport runBatch(const BatchOptions &options) {
+    BatchReport report;
+    const int jobCount = options.jobs.size();
+    if (jobCount == 0) {
+        return report;
+    }
+
+    // Кодеки однопоточные, поэтому чтению и записи достается по половине
+    // ядер. Свертка сама распараллелена по полосам, двух обработчиков
+    // хватает, чтобы ядра не простаивали между изображениями.
+    const int cores = std::max(1, QThread::idealThreadCount());
+    const int decoders = options.decodeThreads > 0 ? options.decodeThreads : std::max(1, cores / 2);
+    const int filters = options.filterThreads > 0 ? options.filterThreads : 2;
+    const int encoders = options.encodeThreads > 0 ? options.encodeThreads : std::max(1, cores / 2);
+    const int depth = options.queueDepth > 0 ? options.queueDepth : 2 * cores;
+
+    StripFilter stripFilter = chainStripFilter(options.chain, options.filterOptions);
+    // Полоса короче двойного ореола почти целиком уходит на перекрытие.
+    const int stripRows = std::max(options.stripRows, 2 * stripFilter.halo);
+
+    BoundedQueue decoded(depth, decoders);
+    BoundedQueue filtered(depth, filters);
+    std::atomic<int> nextJob(0);
+    std::atomic<int> processed(0);
+    std::atomic<int> failed(0);
+    std::atomic<qint64> pixels(0);
+    QThreadPool pool;
+    pool.setMaxThreadCount(decoders + filters + encoders);
+    QList<QFuture<void> > stages;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < decoders; ++i) {
+        stages << QtConcurrent::run(&pool, [&]() {
+            for (int index = nextJob++; index < jobCount; index = nextJob++) {
+                const BatchJob &job = options.jobs[index];
+                if (stripFilter.streamable && isStreamablePair(job.source, job.target)) {
+                    // Большие PPM не проходят через очереди: чтение, фильтр
+                    // и запись идут полосами прямо в этом потоке.
+                    QDir().mkpath(QFileInfo(job.target).path());
+                    TraceScope scope("streamFilterPpm");
+                    QString error;
+                    QSize size;
+                    if (streamFilterPpm(job.source, job.target, stripFilter, stripRows, &error, &size)) {
+                        processed++;
+                        pixels += static_cast<qint64>(size.width()) * size.height();
+                        scope.setWork(static_cast<qint64>(size.width()) * size.height(),
+                                      static_cast<qint64>(size.width()) * size.height() * 3);
+                    } else {
+                        failed++;
+                        printLine(stderr, error);
+                    }
+                    continue;
+                }
+
+                BatchItem item;
+                item.index = index;
+                QString error;
+                item.image = readImageFile(options.jobs[index].source, &error);
+                if (item.image.isNull()) {
+                    failed++;
+                    printLine(stderr, error);
+                    continue;
+                }
+                decoded.push(item);
+            }
+            decoded.producerDone();
+        });
+    }
+
+    for (int i = 0; i < filters; ++i) {
+        stages << QtConcurrent::run(&pool, [&]() {
+            BatchItem item;
+            while (decoded.pop(item)) {
+                options.chain.apply(item.image, options.filterOptions);
+                filtered.push(item);
+            }
+            filtered.producerDone();
+        });
+    }
+
+    for (int i = 0; i < encoders; ++i) {
+        stages << QtConcurrent::run(&pool, [&]() {
+            BatchItem item;
+            while (filtered.pop(item)) {
+                const QString &target = options.jobs[item.index].target;
+                QDir().mkpath(QFileInfo(target).path());
+                QString error;
+                if (!writeImageFile(item.image, target, &error)) {
+                    failed++;
+                    printLine(stderr, error);
+                    continue;
+                }
+                processed++;
+                pixels += static_cast<qint64>(item.image.width()) * item.image.height();
+            }
+        });
+    }
+
+    for (QFuture<void> &stage : stages) {
+        stage.waitForFinished();
+    }
+
+    report.processed = processed;
+    report.failed = failed;
+    report.pixels = pixels;
+    report.seconds = timer.nsecsElapsed() / 1e9;
+    return report;
+}
+
+QStringList splitCommaList(const QString &text) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    return text.split(',', Qt::SkipEmptyParts);
+#else
+    return text.split(',', QString::SkipEmptyParts);
+#endif
+}
+
+void addFilterOptions(QCommandLineParser &parser) {
+    parser.addOption(QCommandLineOption(QStringList() << "f" << "filter",
+                                        "Фильтры через запятую по порядку применения: gauss, sharpen, sobel.",
+                                        "names", "gauss"));
+    parser.addOption(QCommandLineOption("size", "Размер ядра Гаусса.", "n", "5"));
+    parser.addOption(QCommandLineOption("sigma", "Сигма ядра Гаусса.", "s", "1.0"));
+    parser.addOption(QCommandLineOption("fast", "Быстрый режим (целочисленная арифметика)."));
+    parser.addOption(QCommandLineOption("border", "Продолжение за краем: clamp, reflect, wrap, constant (черный).",
+                                        "mode", "clamp"));
+    parser.addOption(QCommandLineOption("threads", "Потоков свертки (0 — по числу ядер).", "n", "0"));
+}
+
+bool parseFilterOptions(const QCommandLineParser &parser, FilterChain &chain, FilterOptions &options,
+                        QString &error) {
+    const size_t gaussSize = static_cast<size_t>(std::max(1, parser.value("size").toInt()));
+    const double gaussSigma = std::max(0.1, parser.value("sigma").toDouble());
+    for (const QString &name : splitCommaList(parser.value("filter"))) {
+        QString filter = name.trimmed();
+        if (filter == "gauss") {
+            chain.addGaussian(gaussSize, gaussSigma);
+        } else if (filter == "sharpen" || filter == "sobel") {
+            chain.addKernel(filter == "sharpen" ? Kernel::sharpen() : Kernel::sobelX());
+        } else {
+            error = "Неизвестный фильтр: " + filter;
+            return false;
+        }
+    }
+    if (chain.isEmpty()) {
+        error = "Не задан ни один фильтр (--filter).";
+        return false;
+    }
+    options.precision = parser.isSet("fast") ? PrecisionFast : PrecisionExact;
+    const QString border = parser.value("border");
+    if (border == "reflect") {
+        options.border = Border(BorderReflect);
+    } else if (border == "wrap") {
+        options.border = Border(BorderWrap);
+    } else if (border == "constant") {
+        options.border = Border(BorderConstant);
+    } else if (border != "clamp") {
+        error = "Неизвестный режим края: " + border;
+        return false;
+    }
+    setFilterThreadCount(parser.value("threads").toInt());
+    return true;
+}
+
+bool isBatchInvocation(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--batch") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int runBatchCommand(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Пакетная обработка изображений без графического интерфейса.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("inputs", "Файлы изображений или каталоги с ними.", "[inputs...]");
+
+    QCommandLineOption batchOption("batch", "Пакетный режим.");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Каталог для результатов.", "dir");
+    QCommandLineOption listOption("list", "Файл со списком входных путей, по одному в строке.", "file");
+    QCommandLineOption formatOption("format", "Формат результатов (png, jpg, bmp); по умолчанию как у исходных.", "ext");
+    QCommandLineOption decodersOption("decoders", "Потоков чтения.", "n", "0");
+    QCommandLineOption workersOption("workers", "Изображений, которые фильтруются одновременно.", "n", "0");
+    QCommandLineOption encodersOption("encoders", "Потоков записи.", "n", "0");
+    QCommandLineOption queueOption("queue", "Длина очередей между стадиями.", "n", "0");
+    QCommandLineOption stripOption("strip", "Высота полосы при потоковой обработке PPM.", "rows", "256");
+    QCommandLineOption traceOption("trace", "Записать трассировку стадий в файл для about:tracing.", "file");
+    parser.addOptions(QList<QCommandLineOption>() << batchOption << outputOption << listOption << formatOption
+                                                  << decodersOption << workersOption << encodersOption
+                                                  << queueOption << stripOption << traceOption);
+    addFilterOptions(parser);
+
+    if (!parser.parse(arguments)) {
+        printLine(stderr, parser.errorText());
+        return 2;
+    }
+    if (parser.isSet("help")) {
+        printLine(stdout, parser.helpText());
+        return 0;
+    }
+    if (!parser.isSet(outputOption)) {
+        printLine(stderr, "Не указан каталог для результатов (--output).");
+        return 2;
+    }
+
+    BatchOptions options;
+    QString error;
+    if (!parseFilterOptions(parser, options.chain, options.filterOptions, error)) {
+        printLine(stderr, error);
+        return 2;
+    }
+    options.decodeThreads = parser.value(decodersOption).toInt();
+    options.filterThreads = parser.value(workersOption).toInt();
+    options.encodeThreads = parser.value(encodersOption).toInt();
+    options.queueDepth = parser.value(queueOption).toInt();
+    options.stripRows = std::max(1, parser.value(stripOption).toInt());
+
+    QStringList inputs = parser.positionalArguments();
+    if (parser.isSet(listOption)) {
+        QFile list(parser.value(listOption));
+        if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            printLine(stderr, "Не удалось открыть список " + list.fileName());
+            return 1;
+        }
+        QTextStream in(&list);
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (!line.isEmpty()) {
+                inputs << line;
+            }
+        }
+    }
+
+    for (const QString &input : inputs) {
+        collectJobs(input, parser.value(outputOption), parser.value(formatOption), options.jobs);
+    }
+    if (options.jobs.isEmpty()) {
+        printLine(stderr, "Нет входных изображений.");
+        return 2;
+    }
+    if (!checkDistinctTargets(options.jobs, error)) {
+        printLine(stderr, error);
+        return 2;
+    }
+
+    setTracingEnabled(parser.isSet(traceOption));
+    BatchReport report = runBatch(options);
+    double seconds = std::max(report.seconds, 1e-9);
+    printLine(stdout, QString("Обработано %1 из %2 изображений за %3 с: %4 изобр./с, %5 Мпикс/с")
+                          .arg(report.processed)
+                          .arg(options.jobs.size())
+                          .arg(report.seconds, 0, 'f', 2)
+                          .arg(report.processed / seconds, 0, 'f', 1)
+                          .arg(report.pixels / 1e6 / seconds, 0, 'f', 1));
+    if (parser.isSet(traceOption)) {
+        if (!writeChromeTrace(parser.value(traceOption), &error)) {
+            printLine(stderr, error);
+            return 1;
+        }
+    }
+    if (report.failed > 0) {
+        printLine(stderr, QString("Ошибок: %1").arg(report.failed));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include "filterchain.h"
+#include <QCommandLineParser>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Один файл пакета: откуда читать и куда записать результат.
+struct BatchJob {
+    QString source;
+    QString target;
+};
+
+struct BatchOptions {
+    BatchOptions()
+        : decodeThreads(0), filterThreads(0), encodeThreads(0), queueDepth(0), stripRows(256) {}
+
+    QVector<BatchJob> jobs;
+    FilterChain chain;
+    FilterOptions filterOptions;
+
+    // 0 — выбрать по числу ядер.
+    int decodeThreads;
+    int filterThreads;
+    int encodeThreads;
+    int queueDepth;
+
+    // Пары PPM -> PPM обрабатываются полосами такой высоты, не загружая
+    // изображение целиком (см. streamFilterPpm).
+    int stripRows;
+};
+
+struct BatchReport {
+    BatchReport() : processed(0), failed(0), pixels(0), seconds(0.0) {}
+
+    int processed;
+    int failed;
+    qint64 pixels;
+    double seconds;
+};
+
+// Обрабатывает пакет конвейером чтение -> фильтр -> запись. Стадии
+// работают на своих потоках и связаны очередями ограниченной длины,
+// так что диск, кодеки и свертка загружены одновременно, а в памяти
+// держится не больше queueDepth изображений на очередь.
+BatchReport runBatch(const BatchOptions &options);
+
+// Список через запятую без пустых элементов, как в --filter и ключах
+// замеров.
+QStringList splitCommaList(const QString &text);
+
+// Ключи фильтров, общие у пакетного и потокового режимов: --filter,
+// --size, --sigma, --fast, --border и --threads.
+void addFilterOptions(QCommandLineParser &parser);
+// Цепочка и параметры фильтров по этим ключам; --threads применяется сразу.
+// При ошибке возвращает false и пишет сообщение в error.
+bool parseFilterOptions(const QCommandLineParser &parser, FilterChain &chain, FilterOptions &options,
+                        QString &error);
+
+// Запущена ли программа в пакетном режиме (ключ --batch).
+bool isBatchInvocation(int argc, char *argv[]);
+
+// Разбирает командную строку пакетного режима, обрабатывает файлы и
+// печатает отчет. Возвращает код завершения процесса.
+int runBatchCommand(const QStringList &arguments);
+
+#endif
@@ -0,0 +1,784 @@
+#include "benchmark.h"
+#include "batchprocessor.h"
+#include "edgedetect.h"
+#include "filter2d.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "rankfilter.h"
+#include "spankernels.h"
+#include "trace.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QMap>
+#include <QPair>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const char *const FILTER_NAMES[] = {"gauss", "sharpen", "sobel", "box", "disk", "median", "erode", "dilate",
+                                     "sobel-edges", "stats"};
+
+// Размер изображения для проверки: достаточно мал, чтобы скалярная
+// свертка ядром 99x99 шла секунды, и больше самого большого ядра.
+const int CHECK_WIDTH = 320;
+const int CHECK_HEIGHT = 240;
+
+void printLine(FILE *file, const QString &line) {
+    QTextStream stream(file);
+    stream << line << '\n';
+}
+
+bool isRankFilter(const QString &filter) {
+    return filter == "median" || filter == "erode" || filter == "dilate";
+}
+
+RankOperation rankOperation(const QString &filter) {
+    return filter == "median" ? RankMedian : filter == "erode" ? RankErode : RankDilate;
+}
+
+// Для 3x3 фильтров и статистики размер ядра не задается. У фильтров по
+// окну размер ядра — ширина окна 2 * radius + 1.
+bool hasKernelSize(const QString &filter) {
+    return filter == "gauss" || filter == "box" || filter == "disk" || isRankFilter(filter);
+}
+
+double gaussSigma(int size) {
+    return std::max(0.5, size / 6.0);
+}
+
+// Ядро filter2D для фильтра. Диск — неразделимое ядро высокого ранга,
+// на нем проверяется путь через БПФ. Ядра хранятся между замерами, как
+// в приложении, чтобы веса и спектры не пересчитывались на каждом запуске.
+Kernel filterKernel(const QString &filter, int size) {
+    if (filter == "sharpen") {
+        return Kernel::sharpen();
+    }
+    if (filter == "sobel") {
+        return Kernel::sobelX();
+    }
+
+    static QMap<QPair<QString, int>, Kernel> kernels;
+    const QPair<QString, int> key(filter, size);
+    if (kernels.contains(key)) {
+        return kernels.value(key);
+    }
+    std::vector<double> kernel(static_cast<size_t>(size) * size);
+    const double radius = size / 2.0;
+    double sum = 0.0;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            double dx = x + 0.5 - radius;
+            double dy = y + 0.5 - radius;
+            double value = filter == "disk" ? (dx * dx + dy * dy <= radius * radius ? 1.0 : 0.0) : 1.0;
+            kernel[static_cast<size_t>(y) * size + x] = value;
+            sum += value;
+        }
+    }
+    for (double &value : kernel) {
+        value /= sum;
+    }
+    kernels.insert(key, Kernel(kernel.data(), size, size));
+    return kernels.value(key);
+}
+
+void applyFilter(const QString &filter, int size, QImage &image, const FilterOptions &options) {
+    if (filter == "gauss") {
+        gaussianBlur(image, static_cast<size_t>(size), gaussSigma(size), options);
+        return;
+    }
+    if (isRankFilter(filter)) {
+        rankFilter(image, rankOperation(filter), size / 2, options);
+        return;
+    }
+    if (filter == "sobel-edges") {
+        sobelEdges(image, EdgeMagnitude, options);
+        return;
+    }
+    filter2D(image, filterKernel(filter, size), options);
+}
+
+const char *convolutionEngineName(ConvolutionEngine engine) {
+    switch (engine) {
+    case ConvolutionSeparable:
+        return "separable";
+    case ConvolutionFft:
+        return "fft";
+    default:
+        return "direct";
+    }
+}
+
+// Способ, который фильтр выберет для изображения width x height.
+QString engineName(const QString &filter, int size, int width, int height, const FilterOptions &options) {
+    if (filter == "stats" || filter == "sobel-edges" || isRankFilter(filter)) {
+        return "-";
+    }
+    if (filter == "gauss") {
+        // Рекурсивное размытие умеет только BorderClamp, как в gaussianBlur.
+        bool recursive = options.border.mode == BorderClamp &&
+                         selectBlurEngine(static_cast<size_t>(size), gaussSigma(size), options.blurEngine) == BlurRecursive;
+        return recursive ? "recursive" : "direct";
+    }
+    return convolutionEngineName(selectConvolutionEngine(filterKernel(filter, size), width, height,
+                                                         options.convolutionEngine));
+}
+
+// Плавные градиенты с шумом и резкими краями блоков: на таком изображении
+// различаются и размытие, и выделение краев. Генератор детерминирован,
+// чтобы эталоны не зависели от запуска.
+QImage createTestImage(int width, int height) {
+    QImage image(width, height, QImage::Format_RGB32);
+    quint32 state = 0x9e3779b9u;
+    for (int y = 0; y < height; ++y) {
+        QRgb *row = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int noise = static_cast<int>(state & 31) - 16;
+            int block = ((x / 37) ^ (y / 29)) & 1 ? 64 : 0;
+            int r = (x * 255) / std::max(1, width - 1) + noise;
+            int g = (y * 255) / std::max(1, height - 1) - noise;
+            int b = block + ((x + y) & 127) + noise / 2;
+            row[x] = qRgb(std::max(0, std::min(255, r)), std::max(0, std::min(255, g)),
+                          std::max(0, std::min(255, b)));
+        }
+    }
+    return image;
+}
+
+// Независимые случайные каналы: в окне фильтра по рангу почти нет
+// повторов, и любая ошибка в гистограммах или блоках видна в результате.
+QImage createRandomImage(int width, int height, quint32 state) {
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y = 0; y < height; ++y) {
+        QRgb *row = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            row[x] = 0xff000000u | (state & 0xffffffu);
+        }
+    }
+    return image;
+}
+
+// Лучшее из repeat запусков, в наносекундах. Фильтр получает отдельную
+// копию, чтобы работать на месте; копирование в замер не входит.
+double timeFilter(const QString &filter, int size, const QImage &source, const FilterOptions &options,
+                  int repeat) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeat; ++i) {
+        QImage image = filter == "stats" ? source : source.copy();
+        QElapsedTimer timer;
+        timer.start();
+        if (filter == "stats") {
+            ImageStats stats;
+            computeImageStats(image, stats);
+        } else {
+            applyFilter(filter, size, image, options);
+        }
+        best = std::min(best, static_cast<double>(timer.nsecsElapsed()));
+    }
+    return best;
+}
+
+// Эталон: прямая свертка скалярным кодом в double, как в исходном фильтре.
+QImage referenceImage(const QString &filter, int size, const QImage &source, const Border &border) {
+    SimdLevel level = simdLevel();
+    setSimdLevel(SimdNone);
+    FilterOptions options;
+    options.precision = PrecisionExact;
+    options.blurEngine = BlurDirect;
+    options.convolutionEngine = ConvolutionDirect;
+    options.border = border;
+    QImage image = source.copy();
+    applyFilter(filter, size, image, options);
+    setSimdLevel(level);
+    return image;
+}
+
+// Эталон статистики: прямой подсчет без полос и кодов Мортона.
+ImageStats referenceStats(const QImage &image) {
+    ImageStats stats;
+    std::vector<bool> seen(1 << 24);
+    for (int y = 0; y < image.height(); ++y) {
+        const QRgb *row = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            int r = qRed(row[x]);
+            int g = qGreen(row[x]);
+            int b = qBlue(row[x]);
+            ++stats.histograms[StatsRed][r];
+            ++stats.histograms[StatsGreen][g];
+            ++stats.histograms[StatsBlue][b];
+            ++stats.histograms[StatsBrightness][(r + g + b) / 3];
+            int color = (r << 16) | (g << 8) | b;
+            if (!seen[color]) {
+                seen[color] = true;
+                ++stats.uniqueColors;
+            }
+            ++stats.pixelCount;
+        }
+    }
+    return stats;
+}
+
+// Эталон фильтра по рангу: окно каждого пикселя собирается целиком через
+// borderIndex и сортируется, минимум и максимум — перебором.
+QImage referenceRank(const QImage &source, RankOperation operation, int radius, const Border &border) {
+    const int width = source.width();
+    const int height = source.height();
+    const int window = 2 * radius + 1;
+    QImage image(source.size(), QImage::Format_RGB32);
+    std::vector<int> values(static_cast<size_t>(window) * window);
+    for (int y = 0; y < height; ++y) {
+        QRgb *dst = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            int channels[3];
+            for (int c = 0; c < 3; ++c) {
+                const int shift = 16 - 8 * c;
+                size_t count = 0;
+                for (int dy = -radius; dy <= radius; ++dy) {
+                    const int sy = borderIndex(y + dy, height, border.mode);
+                    for (int dx = -radius; dx <= radius; ++dx) {
+                        const int sx = borderIndex(x + dx, width, border.mode);
+                        QRgb pixel = sx < 0 || sy < 0 ? border.color : source.pixel(sx, sy);
+                        values[count++] = static_cast<int>((pixel >> shift) & 0xff);
+                    }
+                }
+                if (operation == RankMedian) {
+                    std::sort(values.begin(), values.end());
+                    channels[c] = values[values.size() / 2];
+                } else if (operation == RankErode) {
+                    channels[c] = *std::min_element(values.begin(), values.end());
+                } else {
+                    channels[c] = *std::max_element(values.begin(), values.end());
+                }
+            }
+            dst[x] = qRgb(channels[0], channels[1], channels[2]);
+        }
+    }
+    return image;
+}
+
+// Эталон детектора краев: Gx и Gy — суммы окрестности 3x3 яркости с
+// весами ядер Собеля, модуль — округленный корень (|Gx| + |Gy| в быстром
+// режиме), деленный на 4. Для EdgeThin пиксель остается, если его модуль
+// не меньше соседа перед ним вдоль градиента и больше соседа после;
+// направление округляется до одного из четырех секторов по 45°.
+QImage referenceSobel(const QImage &source, EdgeOutput output, bool fast, const Border &border) {
+    static const int kernelX[9] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};
+    static const int kernelY[9] = {-1, -2, -1, 0, 0, 0, 1, 2, 1};
+    const int width = source.width();
+    const int height = source.height();
+    auto lumaOf = [](QRgb pixel) { return (qRed(pixel) * 77 + qGreen(pixel) * 150 + qBlue(pixel) * 29 + 128) >> 8; };
+    auto luma = [&](int x, int y) {
+        const int sx = borderIndex(x, width, border.mode);
+        const int sy = borderIndex(y, height, border.mode);
+        return lumaOf(sx < 0 || sy < 0 ? border.color : source.pixel(sx, sy));
+    };
+
+    const size_t pixels = static_cast<size_t>(width) * height;
+    std::vector<int> gx(pixels), gy(pixels), magnitude(pixels);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const size_t i = static_cast<size_t>(y) * width + x;
+            for (int k = 0; k < 9; ++k) {
+                const int value = luma(x + k % 3 - 1, y + k / 3 - 1);
+                gx[i] += kernelX[k] * value;
+                gy[i] += kernelY[k] * value;
+            }
+            magnitude[i] = fast ? std::abs(gx[i]) + std::abs(gy[i])
+                                : static_cast<int>(std::lround(std::sqrt(static_cast<double>(gx[i]) * gx[i] +
+                                                                         static_cast<double>(gy[i]) * gy[i])));
+        }
+    }
+    auto magnitudeAt = [&](int x, int y) {
+        return x < 0 || x >= width || y < 0 || y >= height ? 0 : magnitude[static_cast<size_t>(y) * width + x];
+    };
+
+    QImage image(source.size(), QImage::Format_RGB32);
+    for (int y = 0; y < height; ++y) {
+        QRgb *dst = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            const size_t i = static_cast<size_t>(y) * width + x;
+            const int m = magnitude[i];
+            bool keep = true;
+            if (output == EdgeThin) {
+                // Сектор по углу градиента: границы tan(22.5°) и tan(67.5°).
+                const double ax = std::abs(gx[i]), ay = std::abs(gy[i]);
+                int dx, dy;
+                if (ay * 1000.0 <= ax * 414.0) {
+                    dx = 1, dy = 0;
+                } else if (ay * 1000.0 >= ax * 2414.0) {
+                    dx = 0, dy = 1;
+                } else if ((gx[i] > 0) == (gy[i] > 0)) {
+                    dx = 1, dy = 1;
+                } else {
+                    dx = -1, dy = 1;
+                }
+                keep = m >= magnitudeAt(x - dx, y - dy) && m > magnitudeAt(x + dx, y + dy);
+            }
+            const int value = keep ? std::min(255, (m + 2) / 4) : 0;
+            dst[x] = qRgb(value, value, value);
+        }
+    }
+    return image;
+}
+
+bool sameStats(const ImageStats &a, const ImageStats &b) {
+    return a.pixelCount == b.pixelCount && a.uniqueColors == b.uniqueColors &&
+           std::memcmp(a.histograms, b.histograms, sizeof(a.histograms)) == 0;
+}
+
+// Наибольшее отклонение канала RGB; в differing — число пикселей, которые
+// отличаются хотя бы одним каналом.
+int maxDifference(const QImage &a, const QImage &b, qint64 &differing) {
+    differing = 0;
+    if (a.size() != b.size()) {
+        differing = static_cast<qint64>(a.width()) * a.height();
+        return 255;
+    }
+    int worst = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        const QRgb *rowA = reinterpret_cast<const QRgb *>(a.constScanLine(y));
+        const QRgb *rowB = reinterpret_cast<const QRgb *>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); ++x) {
+            int diff = std::max(std::abs(qRed(rowA[x]) - qRed(rowB[x])),
+                                std::max(std::abs(qGreen(rowA[x]) - qGreen(rowB[x])),
+                                         std::abs(qBlue(rowA[x]) - qBlue(rowB[x]))));
+            if (diff > 0) {
+                ++differing;
+                worst = std::max(worst, diff);
+            }
+        }
+    }
+    return worst;
+}
+
+// Сравнивает результат способа name с эталоном и печатает строку проверки.
+// Возвращает 1, если проверка не пройдена.
+int reportCheck(const QString &label, const QString &name, const QImage &image, const QImage &reference,
+                int tolerance, bool statsOk) {
+    qint64 differing = 0;
+    int worst = maxDifference(image, reference, differing);
+    bool ok = worst <= tolerance && statsOk;
+
+    QString result = worst == 0 ? QString("побитно совпадает")
+                                : QString("отклонение до %1 у %2 пикс. (допуск %3)")
+                                      .arg(worst).arg(differing).arg(tolerance);
+    if (!statsOk) {
+        result += ", статистика не совпадает";
+    }
+    printLine(stdout, QString("проверка %1 %2: %3 %4").arg(label, name, result, ok ? "OK" : "ОШИБКА"));
+    return ok ? 0 : 1;
+}
+
+// Проверяемый способ обработки и допустимое отклонение от эталона.
+struct CheckVariant {
+    QString name;
+    FilterOptions options;
+    int tolerance;
+};
+
+// Все способы, которые фильтр действительно может применить к ядру.
+// Прямая свертка в плавающей точке отличается от double не больше чем
+// на 1, целочисленная — еще на 1; рекурсивное размытие — на ошибку
+// приближения ядра за два прохода (только для края clamp).
+QVector<CheckVariant> checkVariants(const QString &filter, int size, int width, int height,
+                                    const Border &border) {
+    QVector<CheckVariant> variants;
+    CheckVariant variant;
+    variant.options.border = border;
+    if (filter == "gauss") {
+        variant.options.blurEngine = BlurDirect;
+        variant.name = "direct";
+        variant.tolerance = 1;
+        variants << variant;
+        variant.name = "direct/fast";
+        variant.options.precision = PrecisionFast;
+        variant.tolerance = 2;
+        variants << variant;
+        if (border.mode != BorderClamp) {
+            return variants;
+        }
+
+        double error = 0.0;
+        selectBlurEngine(static_cast<size_t>(size), gaussSigma(size), BlurRecursive, &error);
+        variant.name = "recursive";
+        variant.options = FilterOptions();
+        variant.options.border = border;
+        variant.options.blurEngine = BlurRecursive;
+        variant.tolerance = 1 + static_cast<int>(std::ceil(2.0 * 255.0 * error));
+        variants << variant;
+        return variants;
+    }
+
+    const Kernel kernel = filterKernel(filter, size);
+    const ConvolutionEngine engines[] = {ConvolutionDirect, ConvolutionSeparable, ConvolutionFft};
+    for (ConvolutionEngine engine : engines) {
+        if (selectConvolutionEngine(kernel, width, height, engine) != engine) {
+            continue;
+        }
+        variant.options = FilterOptions();
+        variant.options.border = border;
+        variant.options.convolutionEngine = engine;
+        variant.name = convolutionEngineName(engine);
+        variant.tolerance = 1;
+        variants << variant;
+        if (engine == ConvolutionDirect) {
+            variant.name += "/fast";
+            variant.options.precision = PrecisionFast;
+            variant.tolerance = 2;
+            variants << variant;
+        }
+    }
+    return variants;
+}
+
+// Проверяет фильтр с ядром size и печатает по строке на способ.
+// Возвращает число непройденных проверок.
+int runChecks(const QString &filter, int size, const QImage &source, const Border &border,
+              const QString &goldenDir, bool updateGolden) {
+    const QString label = hasKernelSize(filter) ? QString("%1 %2").arg(filter).arg(size) : filter;
+
+    if (filter == "stats") {
+        ImageStats stats;
+        computeImageStats(source, stats);
+        bool ok = sameStats(stats, referenceStats(source));
+        printLine(stdout, QString("проверка %1: %2").arg(label, ok ? "OK" : "ОШИБКА"));
+        return ok ? 0 : 1;
+    }
+
+    QImage reference;
+    if (!goldenDir.isEmpty()) {
+        // Эталоны для края clamp сохраняют прежние имена.
+        const char *const borderNames[] = {"", "-reflect", "-wrap", "-constant"};
+        QString fileName = QDir(goldenDir).filePath(
+            QString("%1-%2%3.png").arg(filter).arg(size).arg(borderNames[border.mode]));
+        if (updateGolden) {
+            reference = referenceImage(filter, size, source, border);
+            QDir().mkpath(goldenDir);
+            if (!reference.save(fileName)) {
+                printLine(stderr, "Не удалось записать эталон " + fileName);
+                return 1;
+            }
+        } else if (!reference.load(fileName)) {
+            printLine(stderr, "Нет эталона " + fileName + " (запишите его с --update-golden)");
+            return 1;
+        } else {
+            reference = reference.convertToFormat(QImage::Format_RGB32);
+        }
+    } else {
+        reference = referenceImage(filter, size, source, border);
+    }
+
+    int failures = 0;
+    for (const CheckVariant &variant : checkVariants(filter, size, source.width(), source.height(), border)) {
+        QImage image = source.copy();
+        ImageStats stats;
+        FilterOptions options = variant.options;
+        options.stats = &stats;
+        applyFilter(filter, size, image, options);
+
+        ImageStats expectedStats;
+        computeImageStats(image, expectedStats);
+        failures += reportCheck(label, variant.name, image, reference, variant.tolerance,
+                                sameStats(stats, expectedStats));
+    }
+    return failures;
+}
+
+// Детектор краев сравнивается с прямым подсчетом Gx и Gy по окрестности
+// для модуля и для подавления немаксимумов, в точном и быстром режиме.
+// Отдельно на ступеньке яркости проверяется, что после подавления от края
+// остается линия толщиной в пиксель.
+int runSobelChecks(const QImage &source, const Border &border) {
+    struct {
+        const char *name;
+        EdgeOutput output;
+        FilterPrecision precision;
+    } const variants[] = {{"magnitude", EdgeMagnitude, PrecisionExact},
+                          {"magnitude/fast", EdgeMagnitude, PrecisionFast},
+                          {"thin", EdgeThin, PrecisionExact},
+                          {"thin/fast", EdgeThin, PrecisionFast}};
+    int failures = 0;
+    for (const auto &variant : variants) {
+        QImage image = source.copy();
+        ImageStats stats;
+        FilterOptions options;
+        options.border = border;
+        options.precision = variant.precision;
+        options.stats = &stats;
+        sobelEdges(image, variant.output, options);
+
+        ImageStats expectedStats;
+        computeImageStats(image, expectedStats);
+        failures += reportCheck("sobel-edges", variant.name, image,
+                                referenceSobel(source, variant.output, variant.precision == PrecisionFast, border), 0,
+                                sameStats(stats, expectedStats));
+    }
+
+    // Ступенька от 0 до 255 дает одинаковый модуль 1020 в двух пикселях по
+    // обе стороны края; остаться должен только второй, со значением 255.
+    const int size = 32;
+    for (int vertical = 0; vertical < 2; ++vertical) {
+        QImage image(size, size, QImage::Format_RGB32);
+        QImage expected(size, size, QImage::Format_RGB32);
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                const int across = vertical ? y : x;
+                image.setPixel(x, y, across >= size / 2 ? qRgb(255, 255, 255) : qRgb(0, 0, 0));
+                expected.setPixel(x, y, across == size / 2 ? qRgb(255, 255, 255) : qRgb(0, 0, 0));
+            }
+        }
+        sobelEdges(image, EdgeThin);
+        failures += reportCheck("sobel-edges", vertical ? "thin/ступенька по y" : "thin/ступенька по x", image,
+                                expected, 0, true);
+    }
+    return failures;
+}
+
+// Фильтры по рангу сравниваются с перебором окна на маленьких случайных
+// изображениях: окно у края, окно шире изображения (radius >= width / 2),
+// столбец в один пиксель. Результат должен совпасть побитно.
+int runRankChecks(const QString &filter, const Border &border) {
+    const QSize sizes[] = {QSize(23, 17), QSize(7, 40), QSize(1, 5)};
+    int failures = 0;
+    quint32 seed = 0x2545f491u;
+    for (const QSize &size : sizes) {
+        const QImage source = createRandomImage(size.width(), size.height(), seed);
+        seed = seed * 747796405u + 2891336453u;
+        QVector<int> radii;
+        radii << 1 << 2 << std::max(1, size.width() / 2) << std::max(size.width(), size.height());
+        std::sort(radii.begin(), radii.end());
+        radii.erase(std::unique(radii.begin(), radii.end()), radii.end());
+
+        const QString label = QString("%1 %2x%3").arg(filter).arg(size.width()).arg(size.height());
+        for (int radius : radii) {
+            QImage image = source.copy();
+            ImageStats stats;
+            FilterOptions options;
+            options.border = border;
+            options.stats = &stats;
+            rankFilter(image, rankOperation(filter), radius, options);
+
+            ImageStats expectedStats;
+            computeImageStats(image, expectedStats);
+            failures += reportCheck(label, QString("r%1").arg(radius), image,
+                                    referenceRank(source, rankOperation(filter), radius, border), 0,
+                                    sameStats(stats, expectedStats));
+        }
+    }
+    return failures;
+}
+
+QVector<double> parseNumbers(const QString &text) {
+    QVector<double> values;
+    for (const QString &part : splitCommaList(text)) {
+        bool ok = false;
+        double value = part.trimmed().toDouble(&ok);
+        if (ok && value > 0) {
+            values << value;
+        }
+    }
+    return values;
+}
+
+}
+
+bool isBenchmarkInvocation(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int runBenchmarkCommand(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Замеры скорости фильтров и проверка результатов по эталону.");
+    parser.addHelpOption();
+
+    QString threadsDefault;
+    const int cores = std::max(1, QThread::idealThreadCount());
+    for (int threads = 1; threads < cores; threads *= 2) {
+        threadsDefault += QString("%1,").arg(threads);
+    }
+    threadsDefault += QString::number(cores);
+
+    QCommandLineOption benchOption("bench", "Режим замеров.");
+    QCommandLineOption sizesOption("sizes", "Размеры изображений в мегапикселях через запятую.", "mp",
+                                   "0.25,1,4,16,100");
+    QCommandLineOption kernelsOption("kernels", "Размеры ядер через запятую.", "n", "3,5,9,25,49,99");
+    QCommandLineOption filtersOption("filters",
+                                     "Фильтры через запятую: gauss, sharpen, sobel, box, disk, "
+                                     "median, erode, dilate, sobel-edges, stats.",
+                                     "names", "gauss,sharpen,sobel,box,disk,median,erode,dilate,sobel-edges,stats");
+    QCommandLineOption threadsOption("threads", "Числа потоков через запятую.", "list", threadsDefault);
+    QCommandLineOption repeatOption("repeat", "Запусков на замер, берется лучший.", "n", "3");
+    QCommandLineOption fastOption("fast", "Замерять быстрый режим (целочисленная арифметика).");
+    QCommandLineOption engineOption("engine", "Способ свертки: auto, direct, separable, fft.", "name", "auto");
+    QCommandLineOption blurOption("blur", "Способ размытия: auto, direct, recursive.", "name", "auto");
+    QCommandLineOption simdOption("simd", "Наибольший набор инструкций: none, sse41, avx2, avx512.", "name");
+    QCommandLineOption goldenOption("golden", "Каталог с эталонными результатами.", "dir");
+    QCommandLineOption updateGoldenOption("update-golden", "Записать эталоны в --golden скалярной сверткой.");
+    QCommandLineOption checkOnlyOption("check-only", "Только проверка, без замеров.");
+    QCommandLineOption noCheckOption("no-check", "Только замеры, без проверки.");
+    QCommandLineOption borderOption("border", "Продолжение за краем: clamp, reflect, wrap, constant (черный).",
+                                    "mode", "clamp");
+    QCommandLineOption traceOption("trace", "Записать трассировку стадий в файл для about:tracing.", "file");
+    parser.addOptions(QList<QCommandLineOption>() << benchOption << sizesOption << kernelsOption << filtersOption
+                                                  << threadsOption << repeatOption << fastOption << engineOption
+                                                  << blurOption << simdOption << goldenOption << updateGoldenOption
+                                                  << checkOnlyOption << noCheckOption << borderOption << traceOption);
+
+    if (!parser.parse(arguments)) {
+        printLine(stderr, parser.errorText());
+        return 2;
+    }
+    if (parser.isSet("help")) {
+        printLine(stdout, parser.helpText());
+        return 0;
+    }
+
+    QStringList filters;
+    for (const QString &name : splitCommaList(parser.value(filtersOption))) {
+        QString filter = name.trimmed();
+        if (std::find(std::begin(FILTER_NAMES), std::end(FILTER_NAMES), filter) == std::end(FILTER_NAMES)) {
+            printLine(stderr, "Неизвестный фильтр: " + filter);
+            return 2;
+        }
+        filters << filter;
+    }
+    QVector<int> kernels;
+    for (double value : parseNumbers(parser.value(kernelsOption))) {
+        // Четные размеры фильтры все равно увеличивают до нечетных.
+        kernels << (static_cast<int>(value) | 1);
+    }
+    QVector<int> threadCounts;
+    for (double value : parseNumbers(parser.value(threadsOption))) {
+        threadCounts << static_cast<int>(value);
+    }
+    const QVector<double> sizes = parseNumbers(parser.value(sizesOption));
+    if (filters.isEmpty() || kernels.isEmpty() || threadCounts.isEmpty() || sizes.isEmpty()) {
+        printLine(stderr, "Пустой список фильтров, ядер, потоков или размеров.");
+        return 2;
+    }
+    const int repeat = std::max(1, parser.value(repeatOption).toInt());
+
+    FilterOptions options;
+    options.precision = parser.isSet(fastOption) ? PrecisionFast : PrecisionExact;
+    const QString engine = parser.value(engineOption);
+    options.convolutionEngine = engine == "direct" ? ConvolutionDirect
+                                : engine == "separable" ? ConvolutionSeparable
+                                : engine == "fft" ? ConvolutionFft : ConvolutionAuto;
+    const QString blur = parser.value(blurOption);
+    options.blurEngine = blur == "direct" ? BlurDirect : blur == "recursive" ? BlurRecursive : BlurAuto;
+    const QString border = parser.value(borderOption);
+    if (border == "reflect") {
+        options.border = Border(BorderReflect);
+    } else if (border == "wrap") {
+        options.border = Border(BorderWrap);
+    } else if (border == "constant") {
+        options.border = Border(BorderConstant);
+    } else if (border != "clamp") {
+        printLine(stderr, "Неизвестный режим края: " + border);
+        return 2;
+    }
+    if (parser.isSet(simdOption)) {
+        const QString simd = parser.value(simdOption);
+        SimdLevel level = simd == "sse41" ? SimdSse41 : simd == "avx2" ? SimdAvx2
+                          : simd == "avx512" ? SimdAvx512 : SimdNone;
+        setSimdLevel(std::min(level, detectSimdLevel()));
+    }
+    setTracingEnabled(parser.isSet(traceOption));
+    printLine(stdout, QString("Набор инструкций: %1, ядер: %2").arg(simdLevelName(simdLevel())).arg(cores));
+
+    int failures = 0;
+    if (!parser.isSet(noCheckOption)) {
+        const QImage source = createTestImage(CHECK_WIDTH, CHECK_HEIGHT);
+        for (const QString &filter : filters) {
+            if (isRankFilter(filter)) {
+                failures += runRankChecks(filter, options.border);
+                continue;
+            }
+            if (filter == "sobel-edges") {
+                failures += runSobelChecks(source, options.border);
+                continue;
+            }
+            if (!hasKernelSize(filter)) {
+                failures += runChecks(filter, 3, source, options.border, parser.value(goldenOption),
+                                      parser.isSet(updateGoldenOption));
+                continue;
+            }
+            for (int size : kernels) {
+                failures += runChecks(filter, size, source, options.border, parser.value(goldenOption),
+                                      parser.isSet(updateGoldenOption));
+            }
+        }
+    }
+
+    if (!parser.isSet(checkOnlyOption)) {
+        printLine(stdout, "фильтр\tядро\tМпикс\tпотоки\tспособ\tмс\tнс/пикс\tМпикс/с\tускорение");
+        for (double megapixels : sizes) {
+            // Соотношение сторон 4:3, как у типичной фотографии.
+            const int width = std::max(1, static_cast<int>(std::lround(std::sqrt(megapixels * 1e6 * 4.0 / 3.0))));
+            const int height = std::max(1, static_cast<int>(std::lround(width * 3.0 / 4.0)));
+            const double pixels = static_cast<double>(width) * height;
+            const QImage source = createTestImage(width, height);
+
+            for (const QString &filter : filters) {
+                const QVector<int> filterKernels = hasKernelSize(filter) ? kernels : QVector<int>() << 3;
+                for (int size : filterKernels) {
+                    const QString engineLabel = engineName(filter, size, width, height, options);
+                    double baseline = 0.0;
+                    for (int threads : threadCounts) {
+                        setFilterThreadCount(threads);
+                        double nanoseconds = timeFilter(filter, size, source, options, repeat);
+                        if (baseline == 0.0) {
+                            baseline = nanoseconds;
+                        }
+                        printLine(stdout, QString("%1\t%2\t%3\t%4\t%5\t%6\t%7\t%8\t%9")
+                                              .arg(filter)
+                                              .arg(hasKernelSize(filter) ? QString::number(size) : QString("-"))
+                                              .arg(pixels / 1e6, 0, 'f', 2)
+                                              .arg(threads)
+                                              .arg(engineLabel)
+                                              .arg(nanoseconds / 1e6, 0, 'f', 1)
+                                              .arg(nanoseconds / pixels, 0, 'f', 2)
+                                              .arg(pixels / 1e6 / (nanoseconds / 1e9), 0, 'f', 1)
+                                              .arg(baseline / nanoseconds, 0, 'f', 2));
+                    }
+                }
+            }
+        }
+        setFilterThreadCount(0);
+    }
+
+    if (parser.isSet(traceOption)) {
+        QString error;
+        if (!writeChromeTrace(parser.value(traceOption), &error)) {
+            printLine(stderr, error);
+            return 1;
+        }
+    }
+
+    if (failures > 0) {
+        printLine(stderr, QString("Не пройдено проверок: %1").arg(failures));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QStringList>
+
+// Запущена ли программа в режиме замеров (ключ --bench).
+bool isBenchmarkInvocation(int argc, char *argv[]);
+
+// Режим замеров и проверки результатов фильтров.
+//
+// Замеры: для каждого размера изображения, фильтра, размера ядра и числа
+// потоков печатается время, нс/пиксель, Мпикс/с и ускорение относительно
+// первого числа потоков.
+//
+// Проверка: на небольшом синтетическом изображении каждый способ свертки
+// (прямой, раздельный, БПФ, рекурсивный) в точном и быстром режиме
+// сравнивается с эталоном — прямой скалярной сверткой в double, — и
+// статистика, собранная фильтром, сравнивается с отдельным подсчетом.
+// Медиана, эрозия и дилатация должны побитно совпасть с перебором окна
+// на маленьких случайных изображениях при разных радиусах, в том числе
+// больше половины ширины. Детектор краев сравнивается с прямым подсчетом
+// Gx и Gy, а подавление немаксимумов на ступеньке яркости должно оставить
+// край толщиной в пиксель. С --golden эталоны читаются из каталога (или записываются туда с
+// --update-golden), так что можно сравнивать с результатами прошлых версий.
+//
+// Возвращает код завершения процесса: 1, если какая-то проверка не прошла.
+int runBenchmarkCommand(const QStringList &arguments);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef BORDER_H
+#define BORDER_H
+
+#include <QRgb>
+
+// Чем продолжается изображение за краем, когда ядро выходит за него.
+// Clamp повторяет крайний пиксель (aaa|abcd|ddd), Reflect отражает без
+// повтора крайнего (cb|abcd|cb, как BORDER_REFLECT_101 в OpenCV), Wrap
+// продолжает с противоположного края (cd|abcd|ab), Constant — цвет color.
+enum BorderMode {
+    BorderClamp,
+    BorderReflect,
+    BorderWrap,
+    BorderConstant
+};
+
+struct Border {
+    Border(BorderMode mode = BorderClamp, QRgb color = 0xff000000u) : mode(mode), color(color) {}
+
+    BorderMode mode;
+    QRgb color;
+};
+
+// Координата в [0, n), которой продолжается c, или -1, если за краем
+// постоянный цвет. Фильтры вызывают ее только для строк и столбцов у
+// края: внутренняя часть изображения считается без проверок.
+inline int borderIndex(int c, int n, BorderMode mode) {
+    if (c >= 0 && c < n) {
+        return c;
+    }
+    switch (mode) {
+    case BorderClamp:
+        return c < 0 ? 0 : n - 1;
+    case BorderReflect: {
+        if (n == 1) {
+            return 0;
+        }
+        int period = 2 * (n - 1);
+        c %= period;
+        if (c < 0) {
+            c += period;
+        }
+        return c < n ? c : period - c;
+    }
+    case BorderWrap:
+        c %= n;
+        return c < 0 ? c + n : c;
+    default:
+        return -1;
+    }
+}
+
+#endif
@@ -0,0 +1,250 @@
+#include "edgedetect.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QColor>
+#include <QRgb>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace {
+
+const double TWO_PI = 6.283185307179586;
+
+// Участки направления для подавления немаксимумов: с какими соседями
+// сравнивается пиксель. Ось y направлена вниз.
+enum Sector {
+    SectorHorizontal, // градиент вдоль x: соседи слева и справа
+    SectorFalling,    // вдоль диагонали \: (x - 1, y - 1) и (x + 1, y + 1)
+    SectorVertical,   // вдоль y: соседи сверху и снизу
+    SectorRising      // вдоль диагонали /: (x + 1, y - 1) и (x - 1, y + 1)
+};
+
+inline int lumaOf(QRgb pixel) {
+    return (qRed(pixel) * 77 + qGreen(pixel) * 150 + qBlue(pixel) * 29 + 128) >> 8;
+}
+
+// Оттенки полного насыщения по направлению градиента, 256 шагов на круг.
+const std::vector<QRgb> &hueTable() {
+    static const std::vector<QRgb> table = []() {
+        std::vector<QRgb> hues(256);
+        for (int i = 0; i < 256; ++i) {
+            hues[i] = QColor::fromHsv(i * 360 / 256, 255, 255).rgb();
+        }
+        return hues;
+    }();
+    return table;
+}
+
+inline uchar scaleChannel(int channel, int value) {
+    return static_cast<uchar>((channel * value + 127) / 255);
+}
+
+// Полоса строк одного прохода. Строки яркости хранятся с одним пикселем
+// продолжения слева и справа, так что окрестность 3x3 у краев строки
+// берется так же, как внутри.
+class SobelBand {
+public:
+    SobelBand(const QImage &source, EdgeOutput output, const FilterOptions &options, int lumaBorder)
+        : source(source), output(output), options(options), width(source.width()), height(source.height()),
+          grayscale(source.format() == QImage::Format_Grayscale8), constantLuma(lumaBorder),
+          luma(3, std::vector<int>(width + 2)), magnitude(3, std::vector<int>(width + 2, 0)),
+          sector(3, std::vector<uchar>(width, 0)) {}
+
+    void run(uchar *targetBits, int targetStride, int y0, int y1, StatsCollector *stats);
+
+private:
+    static int slot(int y) { return ((y % 3) + 3) % 3; }
+
+    void loadLuma(int y);
+    // Градиент строки y по строкам яркости y - 1, y, y + 1. Модуль идет в
+    // mag[1..width], направление — в sectors или прямо в dst.
+    void gradientRow(int y, int *mag, uchar *sectors, QRgb *dst);
+    void suppressRow(int y, QRgb *dst);
+
+    const QImage &source;
+    const EdgeOutput output;
+    const FilterOptions &options;
+    const int width;
+    const int height;
+    const bool grayscale;
+    const int constantLuma;
+    std::vector<std::vector<int> > luma;
+    std::vector<std::vector<int> > magnitude;
+    std::vector<std::vector<uchar> > sector;
+};
+
+void SobelBand::loadLuma(int y) {
+    int *row = luma[slot(y)].data();
+    const BorderMode mode = options.border.mode;
+    int sourceY = borderIndex(y, height, mode);
+    if (sourceY < 0) {
+        std::fill(row, row + width + 2, constantLuma);
+        return;
+    }
+    if (grayscale) {
+        const uchar *src = source.constScanLine(sourceY);
+        for (int x = 0; x < width; ++x) {
+            row[x + 1] = src[x];
+        }
+    } else {
+        const QRgb *src = reinterpret_cast<const QRgb *>(source.constScanLine(sourceY));
+        for (int x = 0; x < width; ++x) {
+            row[x + 1] = lumaOf(src[x]);
+        }
+    }
+    int left = borderIndex(-1, width, mode);
+    int right = borderIndex(width, width, mode);
+    row[0] = left < 0 ? constantLuma : row[left + 1];
+    row[width + 1] = right < 0 ? constantLuma : row[right + 1];
+}
+
+void SobelBand::gradientRow(int y, int *mag, uchar *sectors, QRgb *dst) {
+    const int *a = luma[slot(y - 1)].data();
+    const int *b = luma[slot(y)].data();
+    const int *c = luma[slot(y + 1)].data();
+    const bool fast = options.precision == PrecisionFast;
+
+    for (int x = 0; x < width; ++x) {
+        int gx = (a[x + 2] - a[x]) + 2 * (b[x + 2] - b[x]) + (c[x + 2] - c[x]);
+        int gy = (c[x] + 2 * c[x + 1] + c[x + 2]) - (a[x] + 2 * a[x + 1] + a[x + 2]);
+        int m = fast ? std::abs(gx) + std::abs(gy)
+                     : static_cast<int>(std::sqrt(static_cast<float>(gx * gx + gy * gy)) + 0.5f);
+        mag[x + 1] = m;
+
+        if (output == EdgeThin) {
+            // tan(22.5°) ≈ 0.414, tan(67.5°) ≈ 2.414.
+            int ax = std::abs(gx), ay = std::abs(gy);
+            if (ay * 1000 <= ax * 414) {
+                sectors[x] = SectorHorizontal;
+            } else if (ay * 1000 >= ax * 2414) {
+                sectors[x] = SectorVertical;
+            } else {
+                sectors[x] = (gx > 0) == (gy > 0) ? SectorFalling : SectorRising;
+            }
+        } else {
+            int value = std::min(255, (m + 2) >> 2);
+            if (output == EdgeMagnitude) {
+                dst[x] = qRgb(value, value, value);
+            } else {
+                double turns = std::atan2(static_cast<double>(gy), static_cast<double>(gx)) / TWO_PI;
+                int hue = static_cast<int>(std::floor((turns + 1.0) * 256.0)) & 255;
+                QRgb color = hueTable()[hue];
+                dst[x] = qRgb(scaleChannel(qRed(color), value), scaleChannel(qGreen(color), value),
+                              scaleChannel(qBlue(color), value));
+            }
+        }
+    }
+}
+
+// Пиксель остается, если его модуль не меньше соседа с одной стороны
+// градиента и больше соседа с другой: у плато ширины 2 остается один край.
+void SobelBand::suppressRow(int y, QRgb *dst) {
+    const int *above = magnitude[slot(y - 1)].data();
+    const int *mag = magnitude[slot(y)].data();
+    const int *below = magnitude[slot(y + 1)].data();
+    const uchar *sectors = sector[slot(y)].data();
+
+    for (int x = 0; x < width; ++x) {
+        const int i = x + 1;
+        int before, after;
+        switch (sectors[x]) {
+        case SectorHorizontal:
+            before = mag[i - 1];
+            after = mag[i + 1];
+            break;
+        case SectorFalling:
+            before = above[i - 1];
+            after = below[i + 1];
+            break;
+        case SectorVertical:
+            before = above[i];
+            after = below[i];
+            break;
+        default:
+            before = above[i + 1];
+            after = below[i - 1];
+            break;
+        }
+        int m = mag[i];
+        int value = m >= before && m > after ? std::min(255, (m + 2) >> 2) : 0;
+        dst[x] = qRgb(value, value, value);
+    }
+}
+
+void SobelBand::run(uchar *targetBits, int targetStride, int y0, int y1, StatsCollector *stats) {
+    StatsCollector::Band band(stats);
+    auto targetRow = [&](int y) {
+        return reinterpret_cast<QRgb *>(targetBits + static_cast<size_t>(y) * targetStride);
+    };
+
+    if (output != EdgeThin) {
+        loadLuma(y0 - 1);
+        loadLuma(y0);
+        for (int y = y0; y < y1 && !isCancelled(options.cancel); ++y) {
+            loadLuma(y + 1);
+            QRgb *dst = targetRow(y);
+            gradientRow(y, magnitude[0].data(), nullptr, dst);
+            band.addRow(dst, width);
+        }
+        return;
+    }
+
+    // Строке y нужен модуль строк y - 1 и y + 1, поэтому градиент идет на
+    // строку впереди вывода. За краем изображения модуль нулевой.
+    loadLuma(y0 - 2);
+    loadLuma(y0 - 1);
+    for (int y = y0 - 1; y <= y1 && !isCancelled(options.cancel); ++y) {
+        loadLuma(y + 1);
+        int *mag = magnitude[slot(y)].data();
+        if (y < 0 || y >= height) {
+            std::fill(mag, mag + width + 2, 0);
+        } else {
+            gradientRow(y, mag, sector[slot(y)].data(), nullptr);
+        }
+        if (y - 1 >= y0) {
+            QRgb *dst = targetRow(y - 1);
+            suppressRow(y - 1, dst);
+            band.addRow(dst, width);
+        }
+    }
+}
+
+}
+
+void sobelEdges(QImage &image, EdgeOutput output, const FilterOptions &options) {
+    if (image.isNull()) {
+        return;
+    }
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    TraceScope scope("sobelEdges", pixels, image.sizeInBytes());
+
+    QImage source = image;
+    if (source.format() != QImage::Format_Grayscale8 && source.format() != QImage::Format_RGB32 &&
+        source.format() != QImage::Format_ARGB32) {
+        TraceScope convertScope("convertToFormat", pixels, source.sizeInBytes());
+        source = source.convertToFormat(QImage::Format_RGB32);
+    }
+    // Окрестность читается из source, результат пишется в новый буфер.
+    image = QImage(source.size(), QImage::Format_RGB32);
+    image.setDotsPerMeterX(source.dotsPerMeterX());
+    image.setDotsPerMeterY(source.dotsPerMeterY());
+
+    const int lumaBorder = lumaOf(options.border.color);
+    std::unique_ptr<StatsCollector> stats(options.stats != nullptr ? new StatsCollector : nullptr);
+    uchar *bits = image.bits();
+    const int stride = image.bytesPerLine();
+    parallelForRows(image.height(), 8, [&](int y0, int y1) {
+        TraceScope bandScope("sobelEdges band", static_cast<qint64>(y1 - y0) * image.width(),
+                             static_cast<qint64>(y1 - y0) * stride);
+        SobelBand band(source, output, options, lumaBorder);
+        band.run(bits, stride, y0, y1, stats.get());
+    });
+
+    if (stats && !isCancelled(options.cancel)) {
+        stats->finish(*options.stats);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef EDGEDETECT_H
+#define EDGEDETECT_H
+
+#include "filter2d.h"
+#include <QImage>
+
+// Что выдает детектор краев в каждом пикселе.
+enum EdgeOutput {
+    // Модуль градиента серым.
+    EdgeMagnitude,
+    // Модуль градиента как яркость, направление как оттенок.
+    EdgeDirection,
+    // Модуль только в локальных максимумах вдоль градиента (подавление
+    // немаксимумов): края толщиной в пиксель.
+    EdgeThin
+};
+
+// Детектор краев Собеля за один проход. Gx и Gy считаются по одной и той
+// же окрестности 3x3 яркости (r * 77 + g * 150 + b * 29) / 256, которую
+// полоса держит в кольце из трех строк, так что ни промежуточных
+// изображений, ни отдельных проходов для Gy и модуля нет. Для EdgeThin
+// в кольце держатся и три строки модуля.
+//
+// Модуль делится на 4, так что ступенька от 0 до 255 дает 255, и
+// ограничивается сверху. В PrecisionFast модуль — |Gx| + |Gy| вместо
+// корня. Продолжение за краем — options.border. Результат — Format_RGB32;
+// Grayscale8, RGB32 и ARGB32 читаются без преобразования, прочие форматы
+// сначала переводятся в RGB32.
+void sobelEdges(QImage &image, EdgeOutput output, const FilterOptions &options = FilterOptions());
+
+#endif
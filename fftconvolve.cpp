@@ -0,0 +1,363 @@
+#include "fftconvolve.h"
+#include "filter2d.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include "spankernels.h"
+#include <QRgb>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FFTCONVOLVE_X86 1
+#endif
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const int MIN_TILE = 32;
+const int MAX_TILE = 1024;
+
+// Строка блока обрабатывается участками постоянной длины; MIN_TILE кратен ей.
+const int FFT_CHUNK = 32;
+
+// Стоимость в условных единицах: бабочка БПФ над одним комплексным отсчетом
+// и отвод прямой свертки по пикселю (три канала). Соотношение замерено на AVX2.
+const double BUTTERFLY_COST = 3.5;
+const double DIRECT_TAP_COST = 1.0;
+
+int log2Of(int n) {
+    int bits = 0;
+    while ((1 << bits) < n) {
+        ++bits;
+    }
+    return bits;
+}
+
+// Бабочек на блок: два прямых и два обратных двумерных БПФ (каналы R+iG и B).
+double tileCost(int n) {
+    return 4.0 * n * n * log2Of(n) * BUTTERFLY_COST;
+}
+
+template <int N>
+SPAN_INLINE void butterfly(float *__restrict aRe, float *__restrict aIm,
+                                                     float *__restrict bRe, float *__restrict bIm,
+                                                     float wr, float wi) {
+    for (int c = 0; c < N; ++c) {
+        float vr = bRe[c] * wr - bIm[c] * wi;
+        float vi = bRe[c] * wi + bIm[c] * wr;
+        float ur = aRe[c], ui = aIm[c];
+        aRe[c] = ur + vr;
+        aIm[c] = ui + vi;
+        bRe[c] = ur - vr;
+        bIm[c] = ui - vi;
+    }
+}
+
+template <int N>
+SPAN_INLINE void multiply(float *__restrict re, float *__restrict im,
+                                                    const float *__restrict hRe, const float *__restrict hIm) {
+    for (int c = 0; c < N; ++c) {
+        float r = re[c] * hRe[c] - im[c] * hIm[c];
+        float i = re[c] * hIm[c] + im[c] * hRe[c];
+        re[c] = r;
+        im[c] = i;
+    }
+}
+
+SPAN_INLINE void butterflyRows(const float *cosTable, const float *sinTable,
+                                                         float *re, float *im, int n, bool invert) {
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len / 2;
+        int step = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int j = 0; j < half; ++j) {
+                float wr = cosTable[j * step];
+                float wi = invert ? -sinTable[j * step] : sinTable[j * step];
+                size_t a = static_cast<size_t>(i + j) * n;
+                size_t b = static_cast<size_t>(i + j + half) * n;
+                for (int c = 0; c < n; c += FFT_CHUNK) {
+                    butterfly<FFT_CHUNK>(re + a + c, im + a + c, re + b + c, im + b + c, wr, wi);
+                }
+            }
+        }
+    }
+}
+
+SPAN_INLINE void multiplySpectrum(float *re, float *im, const float *hRe,
+                                                            const float *hIm, size_t count) {
+    for (size_t i = 0; i < count; i += FFT_CHUNK) {
+        multiply<FFT_CHUNK>(re + i, im + i, hRe + i, hIm + i);
+    }
+}
+
+void butterflyRowsGeneric(const float *cosTable, const float *sinTable, float *re, float *im, int n, bool invert) {
+    butterflyRows(cosTable, sinTable, re, im, n, invert);
+}
+
+void multiplySpectrumGeneric(float *re, float *im, const float *hRe, const float *hIm, size_t count) {
+    multiplySpectrum(re, im, hRe, hIm, count);
+}
+
+#ifdef FFTCONVOLVE_X86
+
+__attribute__((target("avx2,fma")))
+void butterflyRowsAvx2(const float *cosTable, const float *sinTable, float *re, float *im, int n, bool invert) {
+    butterflyRows(cosTable, sinTable, re, im, n, invert);
+}
+
+__attribute__((target("avx2,fma")))
+void multiplySpectrumAvx2(float *re, float *im, const float *hRe, const float *hIm, size_t count) {
+    multiplySpectrum(re, im, hRe, hIm, count);
+}
+
+#endif
+
+// Транспонирование квадратного блока на месте, по плиткам 16 x 16.
+void transpose(float *data, int n) {
+    const int block = 16;
+    for (int bi = 0; bi < n; bi += block) {
+        for (int bj = bi; bj < n; bj += block) {
+            for (int i = bi; i < std::min(bi + block, n); ++i) {
+                for (int j = std::max(bj, i + 1); j < std::min(bj + block, n); ++j) {
+                    std::swap(data[static_cast<size_t>(i) * n + j], data[static_cast<size_t>(j) * n + i]);
+                }
+            }
+        }
+    }
+}
+
+// Блоков n x n, которыми покрывается изображение: из каждого полезны
+// первые (n - kHeight + 1) x (n - kWidth + 1) отсчетов.
+double tileCount(int width, int height, int kWidth, int kHeight, int n) {
+    int tileWidth = n - kWidth + 1;
+    int tileHeight = n - kHeight + 1;
+    return static_cast<double>((width + tileWidth - 1) / tileWidth) *
+           ((height + tileHeight - 1) / tileHeight);
+}
+
+inline int toChannel(float v) {
+    return std::max(0, std::min(255, static_cast<int>(v + 0.5f)));
+}
+
+}
+
+Fft::Fft(int size) : n(size), bitReverse(size), cosTable(size / 2), sinTable(size / 2) {
+    int bits = log2Of(n);
+    for (int i = 0; i < n; ++i) {
+        int reversed = 0;
+        for (int b = 0; b < bits; ++b) {
+            if (i & (1 << b)) {
+                reversed |= 1 << (bits - 1 - b);
+            }
+        }
+        bitReverse[i] = reversed;
+    }
+    for (int k = 0; k < n / 2; ++k) {
+        double angle = -2.0 * PI * k / n;
+        cosTable[k] = static_cast<float>(std::cos(angle));
+        sinTable[k] = static_cast<float>(std::sin(angle));
+    }
+}
+
+void Fft::forwardColumns(float *re, float *im) const {
+    transform(re, im, false);
+}
+
+void Fft::inverseColumns(float *re, float *im) const {
+    transform(re, im, true);
+}
+
+void Fft::forward2D(float *re, float *im) const {
+    transform(re, im, false);
+    transpose(re, n);
+    transpose(im, n);
+    transform(re, im, false);
+}
+
+void Fft::inverse2D(float *re, float *im) const {
+    transform(re, im, true);
+    transpose(re, n);
+    transpose(im, n);
+    transform(re, im, true);
+}
+
+void Fft::transform(float *re, float *im, bool invert) const {
+    for (int i = 0; i < n; ++i) {
+        if (i < bitReverse[i]) {
+            size_t a = static_cast<size_t>(i) * n;
+            size_t b = static_cast<size_t>(bitReverse[i]) * n;
+            std::swap_ranges(re + a, re + a + n, re + b);
+            std::swap_ranges(im + a, im + a + n, im + b);
+        }
+    }
+
+#ifdef FFTCONVOLVE_X86
+    if (simdLevel() >= SimdAvx2) {
+        butterflyRowsAvx2(cosTable.data(), sinTable.data(), re, im, n, invert);
+        return;
+    }
+#endif
+    butterflyRowsGeneric(cosTable.data(), sinTable.data(), re, im, n, invert);
+}
+
+int fftTileSize(int width, int height, int kWidth, int kHeight) {
+    int best = 0;
+    double bestCost = 0.0;
+    for (int n = MIN_TILE; n <= MAX_TILE; n *= 2) {
+        if (n < 2 * std::max(kWidth, kHeight)) {
+            continue;
+        }
+        double cost = tileCount(width, height, kWidth, kHeight, n) * tileCost(n);
+        if (best == 0 || cost < bestCost) {
+            best = n;
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
+bool preferFft(int width, int height, int kWidth, int kHeight) {
+    int n = fftTileSize(width, height, kWidth, kHeight);
+    if (n == 0) {
+        return false;
+    }
+    double fftCost = tileCount(width, height, kWidth, kHeight, n) * tileCost(n);
+    double directCost = static_cast<double>(width) * height * kWidth * kHeight * DIRECT_TAP_COST;
+    return fftCost < directCost;
+}
+
+void computeKernelSpectrum(const double *kernel, int kWidth, int kHeight, int size, KernelSpectrum &spectrum) {
+    const int n = size;
+    const size_t area = static_cast<size_t>(n) * n;
+    spectrum.size = n;
+    spectrum.re.assign(area, 0.0f);
+    spectrum.im.assign(area, 0.0f);
+
+    // h[-ky][-kx] = K[ky][kx] по модулю n.
+    const float scale = 1.0f / (static_cast<float>(n) * n);
+    for (int ky = 0; ky < kHeight; ++ky) {
+        for (int kx = 0; kx < kWidth; ++kx) {
+            size_t index = static_cast<size_t>((n - ky) % n) * n + (n - kx) % n;
+            spectrum.re[index] = static_cast<float>(kernel[ky * kWidth + kx]) * scale;
+        }
+    }
+    Fft(n).forward2D(spectrum.re.data(), spectrum.im.data());
+}
+
+void fftFilter(QImage &image, const double *kernel, int kWidth, int kHeight,
+               const Border &border, const CancelFlag *cancel, StatsCollector *stats,
+               const KernelSpectrum *spectrum) {
+    if (image.isNull() || kernel == nullptr || kWidth <= 0 || kHeight <= 0) {
+        return;
+    }
+    const int width = image.width();
+    const int height = image.height();
+    const int n = fftTileSize(width, height, kWidth, kHeight);
+    if (n == 0) {
+        return;
+    }
+
+    const int kCenterX = kWidth / 2;
+    const int kCenterY = kHeight / 2;
+    const int tileWidth = n - kWidth + 1;
+    const int tileHeight = n - kHeight + 1;
+    const int tilesX = (width + tileWidth - 1) / tileWidth;
+    const int tilesY = (height + tileHeight - 1) / tileHeight;
+    const size_t area = static_cast<size_t>(n) * n;
+    const Fft fft(n);
+
+    KernelSpectrum localSpectrum;
+    if (spectrum == nullptr || spectrum->size != n) {
+        computeKernelSpectrum(kernel, kWidth, kHeight, n, localSpectrum);
+        spectrum = &localSpectrum;
+    }
+    const float *spectrumRe = spectrum->re.data();
+    const float *spectrumIm = spectrum->im.data();
+
+    void (*multiplySpectrumImpl)(float *, float *, const float *, const float *, size_t) = multiplySpectrumGeneric;
+#ifdef FFTCONVOLVE_X86
+    if (simdLevel() >= SimdAvx2) {
+        multiplySpectrumImpl = multiplySpectrumAvx2;
+    }
+#endif
+
+    // Каналы, которые сворачиваются: все, кроме альфы-заполнителя.
+    const PixelLayout layout(image.format());
+    const int pixelBytes = layout.pixelBytes();
+    std::vector<int> channels;
+    for (int c = 0; c < layout.channels; ++c) {
+        if (layout.alpha != AlphaOpaque || c != layout.alphaChannel) {
+            channels.push_back(c);
+        }
+    }
+    const int channelCount = static_cast<int>(channels.size());
+    const int blockCount = (channelCount + 1) / 2;
+
+    QImage original = takeSourceImage(image);
+    const std::vector<uchar> constant = constantRow(layout, border, width);
+    const uchar *srcBits = original.constBits();
+    uchar *dstBits = image.bits();
+    const int srcStride = original.bytesPerLine();
+    const int dstStride = image.bytesPerLine();
+
+    // Блоков обычно немного, поэтому потоки делят их поштучно, а не по рядам.
+    parallelForRows(tilesX * tilesY, 1, [&](int t0, int t1) {
+        // Каналы идут парами в комплексных блоках (у RGB — R и G в первом,
+        // B во втором): ядро вещественное, поэтому части результата не
+        // смешиваются.
+        std::vector<std::vector<float> > re(blockCount, std::vector<float>(area));
+        std::vector<std::vector<float> > im(blockCount, std::vector<float>(area));
+        std::vector<int> columns(n);
+        StatsCollector::Band band(stats);
+
+        for (int tile = t0; tile < t1 && !isCancelled(cancel); ++tile) {
+            int outY = (tile / tilesX) * tileHeight;
+            int outX = (tile % tilesX) * tileWidth;
+
+            // Столбцы за краем при BorderConstant отмечены номером width.
+            for (int j = 0; j < n; ++j) {
+                int pixelX = borderIndex(outX - kCenterX + j, width, border.mode);
+                columns[j] = pixelX < 0 ? width : pixelX;
+            }
+            for (int i = 0; i < n; ++i) {
+                int pixelY = borderIndex(outY - kCenterY + i, height, border.mode);
+                const uchar *src = pixelY < 0 ? constant.data() : srcBits + static_cast<size_t>(pixelY) * srcStride;
+                size_t row = static_cast<size_t>(i) * n;
+                for (int j = 0; j < n; ++j) {
+                    const uchar *pixel = columns[j] < width ? src + columns[j] * pixelBytes : constant.data();
+                    for (int k = 0; k < channelCount; ++k) {
+                        std::vector<float> &plane = k % 2 == 0 ? re[k / 2] : im[k / 2];
+                        plane[row + j] = static_cast<float>(pixel[channels[k]]);
+                    }
+                }
+            }
+            if (channelCount % 2 != 0) {
+                std::fill(im[blockCount - 1].begin(), im[blockCount - 1].end(), 0.0f);
+            }
+
+            for (int b = 0; b < blockCount; ++b) {
+                fft.forward2D(re[b].data(), im[b].data());
+                multiplySpectrumImpl(re[b].data(), im[b].data(), spectrumRe, spectrumIm, area);
+                fft.inverse2D(re[b].data(), im[b].data());
+            }
+
+            // Первые tileHeight x tileWidth отсчетов круговой свертки
+            // не задеты переносом через край блока.
+            int rows = std::min(tileHeight, height - outY);
+            int cols = std::min(tileWidth, width - outX);
+            for (int u = 0; u < rows; ++u) {
+                uchar *dst = dstBits + static_cast<size_t>(outY + u) * dstStride + outX * pixelBytes;
+                size_t row = static_cast<size_t>(u) * n;
+                for (int v = 0; v < cols; ++v) {
+                    for (int k = 0; k < channelCount; ++k) {
+                        const std::vector<float> &plane = k % 2 == 0 ? re[k / 2] : im[k / 2];
+                        dst[v * pixelBytes + channels[k]] = static_cast<uchar>(toChannel(plane[row + v]));
+                    }
+                }
+                finishRow(layout, dst, cols);
+                band.addRow(reinterpret_cast<const QRgb *>(dst), cols);
+            }
+        }
+    });
+}
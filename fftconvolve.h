@@ -0,0 +1,68 @@
+#ifndef FFTCONVOLVE_H
+#define FFTCONVOLVE_H
+
+#include "border.h"
+#include "parallel.h"
+#include <QImage>
+#include <vector>
+
+class StatsCollector;
+
+// БПФ по основанию 2 над квадратным блоком size() x size(), хранящимся
+// в отдельных плоскостях re и im. Преобразуется каждый столбец блока:
+// бабочки идут по целым строкам, поэтому внутренний цикл непрерывен в
+// памяти и векторизуется.
+class Fft {
+public:
+    explicit Fft(int size);
+
+    int size() const { return n; }
+
+    // Обратное преобразование — без деления на size().
+    void forwardColumns(float *re, float *im) const;
+    void inverseColumns(float *re, float *im) const;
+
+    // Двумерное преобразование. Спектр получается транспонированным,
+    // inverse2D возвращает блок в исходную ориентацию.
+    void forward2D(float *re, float *im) const;
+    void inverse2D(float *re, float *im) const;
+
+private:
+    void transform(float *re, float *im, bool invert) const;
+
+    int n;
+    std::vector<int> bitReverse;
+    std::vector<float> cosTable;
+    std::vector<float> sinTable;
+};
+
+// Размер блока БПФ с наименьшей общей стоимостью для изображения
+// width x height и ядра kWidth x kHeight, или 0, если ядро не помещается
+// даже в самый большой блок.
+int fftTileSize(int width, int height, int kWidth, int kHeight);
+
+// Выгоднее ли свертка через БПФ, чем прямая, для такого изображения и ядра.
+bool preferFft(int width, int height, int kWidth, int kHeight);
+
+// Спектр ядра для блока size x size: ядро кладется отраженным (filter2D
+// считает корреляцию), нормировка обратного преобразования входит в спектр.
+struct KernelSpectrum {
+    KernelSpectrum() : size(0) {}
+
+    int size;
+    std::vector<float> re;
+    std::vector<float> im;
+};
+
+void computeKernelSpectrum(const double *kernel, int kWidth, int kHeight, int size, KernelSpectrum &spectrum);
+
+// Свертка через БПФ с перекрывающимися блоками (overlap-save) для
+// 8-битных форматов PixelLayout. За краем изображение продолжается по border, как в
+// filter2D. Память ограничена несколькими блоками на поток.
+// spectrum — готовый спектр ядра; если он не задан или посчитан для
+// другого размера блока, спектр считается заново.
+void fftFilter(QImage &image, const double *kernel, int kWidth, int kHeight,
+               const Border &border = Border(), const CancelFlag *cancel = nullptr,
+               StatsCollector *stats = nullptr, const KernelSpectrum *spectrum = nullptr);
+
+#endif
@@ -1,180 +1,429 @@
 #include "filter2d.h"
+#include "fftconvolve.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include "recursivegaussian.h"
+#include "separable.h"
+#include "trace.h"
 #include <QRgb>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include <vector>
 
-void filter2D(QImage &image, double *kernel, size_t kWidth, size_t kHeight) {
-    if (image.isNull() || kernel == nullptr || kWidth == 0 || kHeight == 0) {
-        return;
-    }
+namespace {
 
-    if (image.format() != QImage::Format_RGB32 &&
-        image.format() != QImage::Format_ARGB32) {
-        image = image.convertToFormat(QImage::Format_RGB32);
+void convolveSpanAs(const PixelLayout &layout, const uchar *const *taps, const SpanWeights &weights,
+                    FilterPrecision precision, uchar *dst, int pixels) {
+    if (layout.channelBytes == 2) {
+        convolveSpan16(taps, weights, reinterpret_cast<quint16 *>(dst), pixels * layout.channels);
+    } else {
+        convolveSpan(taps, weights, dst, pixels * layout.channels, precision);
     }
+}
 
-    int width = image.width();
-    int height = image.height();
-
-    QImage original = image.copy();
-
-    int kCenterX = static_cast<int>(kWidth) / 2;
-    int kCenterY = static_cast<int>(kHeight) / 2;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            double sumR = 0.0, sumG = 0.0, sumB = 0.0;
+}
 
-            for (size_t ky = 0; ky < kHeight; ++ky) {
-                for (size_t kx = 0; kx < kWidth; ++kx) {
-                    int pixelX = x + static_cast<int>(kx) - kCenterX;
-                    int pixelY = y + static_cast<int>(ky) - kCenterY;
+// Внутренние пиксели идут одним вызовом convolveSpan без проверок
+// координат, а у краев, где ядро выходит за изображение, отводы
+// указывают на пиксели по правилу borderMode или на constantPixel.
+void convolveRow(const uchar *const *rows, int rowCount, int kWidth, int kCenterX,
+                 const SpanWeights &weights, FilterPrecision precision, const PixelLayout &layout,
+                 BorderMode borderMode, const uchar *constantPixel, int width, uchar *dst,
+                 std::vector<const uchar *> &taps) {
+    const int pixelBytes = layout.pixelBytes();
+    int x0 = std::min(kCenterX, width);
+    int x1 = std::max(x0, width - (kWidth - 1 - kCenterX));
+
+    for (int x = 0; x < width; ++x) {
+        if (x == x0) {
+            x = x1;
+            if (x >= width) {
+                break;
+            }
+        }
+        for (int r = 0; r < rowCount; ++r) {
+            for (int kx = 0; kx < kWidth; ++kx) {
+                int pixelX = borderIndex(x + kx - kCenterX, width, borderMode);
+                taps[r * kWidth + kx] = pixelX >= 0 ? rows[r] + pixelX * pixelBytes : constantPixel;
+            }
+        }
+        convolveSpanAs(layout, taps.data(), weights, precision, dst + x * pixelBytes, 1);
+    }
 
-                    pixelX = std::max(0, std::min(width - 1, pixelX));
-                    pixelY = std::max(0, std::min(height - 1, pixelY));
+    if (x1 > x0) {
+        for (int r = 0; r < rowCount; ++r) {
+            for (int kx = 0; kx < kWidth; ++kx) {
+                taps[r * kWidth + kx] = rows[r] + (x0 + kx - kCenterX) * pixelBytes;
+            }
+        }
+        convolveSpanAs(layout, taps.data(), weights, precision, dst + x0 * pixelBytes, x1 - x0);
+    }
 
-                    QRgb pixel = original.pixel(pixelX, pixelY);
-                    double kernelValue = kernel[ky * kWidth + kx];
+    finishRow(layout, dst, width);
+}
 
-                    sumR += qRed(pixel) * kernelValue;
-                    sumG += qGreen(pixel) * kernelValue;
-                    sumB += qBlue(pixel) * kernelValue;
+namespace {
+
+// Один проход прямой свертки с результатом в том же изображении.
+//
+// Если данные изображения ни с кем не разделены, свертка идет на месте:
+// перед записью строки y ее исходное значение кладется в кольцо из
+// kCenterY + 1 строк, откуда его берут следующие строки, а строки ниже y
+// еще не тронуты и читаются прямо из изображения. Полосы пишут параллельно,
+// поэтому строки на стыках, которые нужны соседней полосе, сохраняются до
+// запуска. Памяти нужно на kHeight строк на полосу, а не на второе изображение.
+//
+// Разделенные данные (например, копия originalImage) только читаются,
+// а результат пишется в новый буфер: это дешевле, чем отделить копию.
+// Так же идет BorderWrap: первым строкам нужны последние строки
+// изображения, которые на месте к тому времени уже перезаписаны.
+// Строки за краем при BorderConstant берутся из строки цвета border.color.
+// Строки результата передаются в stats, если он задан (только для
+// Format_RGB32, см. statsCollector). Каждая полоса
+// отмечается в трассировке как стадия stage.
+void convolveImage(QImage &image, const SpanWeights &weights, int kWidth, int kHeight, const char *stage,
+                   const FilterOptions &options, StatsCollector *stats = nullptr) {
+    const PixelLayout layout(image.format());
+    const int width = image.width();
+    const int height = image.height();
+    const int kCenterX = kWidth / 2;
+    const int kCenterY = kHeight / 2;
+    const int below = kHeight - 1 - kCenterY;
+    const size_t rowBytes = static_cast<size_t>(width) * layout.pixelBytes();
+    const BorderMode borderMode = options.border.mode;
+    const std::vector<uchar> constant = constantRow(layout, options.border, width);
+
+    if (!image.isDetached() || borderMode == BorderWrap) {
+        QImage source = takeSourceImage(image);
+        const uchar *srcBits = source.constBits();
+        uchar *dstBits = image.bits();
+        const int srcStride = source.bytesPerLine();
+        const int dstStride = image.bytesPerLine();
+
+        parallelForRows(height, 8, [&](int y0, int y1) {
+            TraceScope scope(stage, static_cast<qint64>(y1 - y0) * width, static_cast<qint64>(y1 - y0) * rowBytes);
+            std::vector<const uchar *> rows(kHeight);
+            std::vector<const uchar *> taps(static_cast<size_t>(kWidth) * kHeight);
+            StatsCollector::Band band(stats);
+
+            for (int y = y0; y < y1 && !isCancelled(options.cancel); ++y) {
+                for (int ky = 0; ky < kHeight; ++ky) {
+                    int pixelY = borderIndex(y + ky - kCenterY, height, borderMode);
+                    rows[ky] = pixelY < 0 ? constant.data() : srcBits + static_cast<size_t>(pixelY) * srcStride;
                 }
+                uchar *dst = dstBits + static_cast<size_t>(y) * dstStride;
+                convolveRow(rows.data(), kHeight, kWidth, kCenterX, weights, options.precision, layout,
+                            borderMode, constant.data(), width, dst, taps);
+                band.addRow(reinterpret_cast<const QRgb *>(dst), width);
             }
-
-            int r = std::max(0, std::min(255, static_cast<int>(std::round(sumR))));
-            int g = std::max(0, std::min(255, static_cast<int>(std::round(sumG))));
-            int b = std::max(0, std::min(255, static_cast<int>(std::round(sumB))));
-
-            image.setPixel(x, y, qRgb(r, g, b));
-        }
+        });
+        return;
     }
-}
 
-double* createGaussianKernel1D(size_t size, double sigma) {
-    if (size % 2 == 0) {
-        size++;
+    uchar *bits = image.bits();
+    const int stride = image.bytesPerLine();
+    auto imageRow = [&](int y) {
+        return bits + static_cast<size_t>(y) * stride;
+    };
+
+    // Полосы в несколько раз выше ядра, чтобы копии стыков были малой долей.
+    const int bandRows = rowBandHeight(height, std::max(8, 4 * kHeight));
+    const int bandCount = (height + bandRows - 1) / bandRows;
+
+    // Для каждого стыка: строки [стык - kCenterY, стык + below) до свертки.
+    const int seamRows = kCenterY + below;
+    std::vector<uchar> seams(static_cast<size_t>(std::max(0, bandCount - 1)) * seamRows * rowBytes);
+    auto seamRow = [&](int band, int y) {
+        int seam = band * bandRows;
+        return seams.data() + (static_cast<size_t>(band - 1) * seamRows + (y - seam + kCenterY)) * rowBytes;
+    };
+    for (int band = 1; band < bandCount; ++band) {
+        int seam = band * bandRows;
+        for (int y = std::max(0, seam - kCenterY); y < std::min(height, seam + below); ++y) {
+            std::memcpy(seamRow(band, y), imageRow(y), rowBytes);
+        }
     }
 
-    double *kernel = new double[size];
-    double sum = 0.0;
-    int center = static_cast<int>(size) / 2;
+    parallelForBands(height, bandRows, [&](int y0, int y1) {
+        TraceScope scope(stage, static_cast<qint64>(y1 - y0) * width, static_cast<qint64>(y1 - y0) * rowBytes);
+        const int ringRows = kCenterY + 1;
+        ScratchFrame frame;
+        uchar *ring = frame.allocate<uchar>(static_cast<size_t>(ringRows) * rowBytes);
+        std::vector<const uchar *> rows(kHeight);
+        std::vector<const uchar *> taps(static_cast<size_t>(kWidth) * kHeight);
+        StatsCollector::Band band(stats);
+
+        for (int y = y0; y < y1 && !isCancelled(options.cancel); ++y) {
+            uchar *dst = imageRow(y);
+            uchar *saved = ring + static_cast<size_t>(y % ringRows) * rowBytes;
+            std::memcpy(saved, dst, rowBytes);
+
+            // Отражение у края дает строки из того же окна [y - kCenterY,
+            // y + below], что и без него, поэтому кольца и стыков хватает.
+            for (int ky = 0; ky < kHeight; ++ky) {
+                int pixelY = borderIndex(y + ky - kCenterY, height, borderMode);
+                if (pixelY < 0) {
+                    rows[ky] = constant.data();
+                } else if (pixelY < y0) {
+                    rows[ky] = seamRow(y0 / bandRows, pixelY);
+                } else if (pixelY >= y1) {
+                    rows[ky] = seamRow(y1 / bandRows, pixelY);
+                } else if (pixelY <= y) {
+                    rows[ky] = ring + static_cast<size_t>(pixelY % ringRows) * rowBytes;
+                } else {
+                    rows[ky] = imageRow(pixelY);
+                }
+            }
+            convolveRow(rows.data(), kHeight, kWidth, kCenterX, weights, options.precision, layout,
+                        borderMode, constant.data(), width, dst, taps);
+            band.addRow(reinterpret_cast<const QRgb *>(dst), width);
+        }
+    });
+}
 
-    for (size_t i = 0; i < size; ++i) {
-        int x = static_cast<int>(i) - center;
-        double value = std::exp(-(x * x) / (2.0 * sigma * sigma));
-        kernel[i] = value;
-        sum += value;
+// Прямая свертка Format_ARGB32 без перевода всего изображения в
+// премультиплицированный вид и обратно. Строки источника премультиплицируются
+// при загрузке в кольцо полосы из kHeight строк (каждая по разу на полосу),
+// результат сворачивается как ARGB32_Premultiplied и возвращается в ARGB32
+// при записи строки. Результат тот же, что у пути через toFilterFormat:
+// qPremultiply и qUnpremultiply — те же преобразования, что у convertToFormat.
+//
+// На месте, как в convolveImage: стыки полос сохраняются до запуска, а
+// строки полосы попадают в кольцо раньше, чем перезаписываются, — окно
+// строки y, в том числе отраженное у края, лежит в [y - kCenterY, y + below].
+void convolveStraightAlpha(QImage &image, const SpanWeights &weights, int kWidth, int kHeight, const char *stage,
+                           const FilterOptions &options) {
+    const PixelLayout layout(QImage::Format_ARGB32_Premultiplied);
+    const int width = image.width();
+    const int height = image.height();
+    const int kCenterX = kWidth / 2;
+    const int kCenterY = kHeight / 2;
+    const int below = kHeight - 1 - kCenterY;
+    const size_t rowBytes = static_cast<size_t>(width) * 4;
+    const BorderMode borderMode = options.border.mode;
+    const std::vector<uchar> constant = constantRow(layout, options.border, width);
+
+    const bool inPlace = image.isDetached() && borderMode != BorderWrap;
+    QImage source = inPlace ? QImage() : takeSourceImage(image);
+    const uchar *srcBits = inPlace ? image.constBits() : source.constBits();
+    const int srcStride = inPlace ? image.bytesPerLine() : source.bytesPerLine();
+    uchar *dstBits = image.bits();
+    const int dstStride = image.bytesPerLine();
+
+    const int bandRows = rowBandHeight(height, std::max(8, 4 * kHeight));
+    const int bandCount = (height + bandRows - 1) / bandRows;
+    const int seamRows = kCenterY + below;
+    std::vector<uchar> seams(inPlace ? static_cast<size_t>(std::max(0, bandCount - 1)) * seamRows * rowBytes : 0);
+    auto seamRow = [&](int band, int y) {
+        int seam = band * bandRows;
+        return seams.data() + (static_cast<size_t>(band - 1) * seamRows + (y - seam + kCenterY)) * rowBytes;
+    };
+    if (inPlace) {
+        for (int band = 1; band < bandCount; ++band) {
+            int seam = band * bandRows;
+            for (int y = std::max(0, seam - kCenterY); y < std::min(height, seam + below); ++y) {
+                std::memcpy(seamRow(band, y), srcBits + static_cast<size_t>(y) * srcStride, rowBytes);
+            }
+        }
     }
 
-    for (size_t i = 0; i < size; ++i) {
-        kernel[i] /= sum;
-    }
+    parallelForBands(height, bandRows, [&](int y0, int y1) {
+        TraceScope scope(stage, static_cast<qint64>(y1 - y0) * width, static_cast<qint64>(y1 - y0) * rowBytes);
+        ScratchFrame frame;
+        uchar *ring = frame.allocate<uchar>(static_cast<size_t>(kHeight) * rowBytes);
+        uchar *result = frame.allocate<uchar>(rowBytes);
+        // Строка изображения, которая лежит в ячейке кольца, или -1.
+        std::vector<int> loaded(kHeight, -1);
+        std::vector<const uchar *> rows(kHeight);
+        std::vector<const uchar *> taps(static_cast<size_t>(kWidth) * kHeight);
+
+        auto straightRow = [&](int y) -> const uchar * {
+            if (inPlace && y < y0) {
+                return seamRow(y0 / bandRows, y);
+            }
+            if (inPlace && y >= y1) {
+                return seamRow(y1 / bandRows, y);
+            }
+            return srcBits + static_cast<size_t>(y) * srcStride;
+        };
+
+        for (int y = y0; y < y1 && !isCancelled(options.cancel); ++y) {
+            for (int ky = 0; ky < kHeight; ++ky) {
+                int pixelY = borderIndex(y + ky - kCenterY, height, borderMode);
+                if (pixelY < 0) {
+                    rows[ky] = constant.data();
+                    continue;
+                }
+                const int slot = pixelY % kHeight;
+                uchar *cached = ring + static_cast<size_t>(slot) * rowBytes;
+                if (loaded[slot] != pixelY) {
+                    const QRgb *src = reinterpret_cast<const QRgb *>(straightRow(pixelY));
+                    QRgb *dst = reinterpret_cast<QRgb *>(cached);
+                    for (int x = 0; x < width; ++x) {
+                        dst[x] = qPremultiply(src[x]);
+                    }
+                    loaded[slot] = pixelY;
+                }
+                rows[ky] = cached;
+            }
+            convolveRow(rows.data(), kHeight, kWidth, kCenterX, weights, options.precision, layout,
+                        borderMode, constant.data(), width, result, taps);
+            const QRgb *premultiplied = reinterpret_cast<const QRgb *>(result);
+            QRgb *dst = reinterpret_cast<QRgb *>(dstBits + static_cast<size_t>(y) * dstStride);
+            for (int x = 0; x < width; ++x) {
+                dst[x] = qUnpremultiply(premultiplied[x]);
+            }
+        }
+    });
+}
 
-    return kernel;
+// Сборщик статистики для options.stats или nullptr, если она не нужна.
+// Строки при записи собираются только у Format_RGB32: у остальных форматов
+// они не в виде QRgb, и статистика считается по готовому результату.
+std::unique_ptr<StatsCollector> statsCollector(const FilterOptions &options, const QImage &image) {
+    bool collect = options.stats != nullptr && image.format() == QImage::Format_RGB32;
+    return std::unique_ptr<StatsCollector>(collect ? new StatsCollector : nullptr);
 }
 
-void gaussianBlur(QImage &image, size_t size, double sigma) {
-    if (image.isNull() || size == 0) {
+void finishStats(const StatsCollector *collector, const FilterOptions &options, const QImage &image) {
+    if (options.stats == nullptr || isCancelled(options.cancel)) {
         return;
     }
-    if (image.format() != QImage::Format_RGB32 &&
-        image.format() != QImage::Format_ARGB32) {
-        image = image.convertToFormat(QImage::Format_RGB32);
+    if (collector != nullptr) {
+        collector->finish(*options.stats);
+        return;
     }
+    ImageStats stats;
+    if (computeImageStats(image, stats, options.cancel)) {
+        *options.stats = stats;
+    }
+}
 
-    int width = image.width();
-    int height = image.height();
-
-    double* kernel = createGaussianKernel1D(size, sigma);
-    int kCenter = static_cast<int>(size) / 2;
-
-    QImage tempImage(image.size(), image.format());
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            double sumR = 0.0, sumG = 0.0, sumB = 0.0;
-            for (size_t k = 0; k < size; ++k) {
-                int pixelX = x + static_cast<int>(k) - kCenter;
-                pixelX = std::max(0, std::min(width - 1, pixelX));
-
-                QRgb pixel = image.pixel(pixelX, y);
-                double kernelValue = kernel[k];
+}
 
-                sumR += qRed(pixel) * kernelValue;
-                sumG += qGreen(pixel) * kernelValue;
-                sumB += qBlue(pixel) * kernelValue;
-            }
-            int r = std::max(0, std::min(255, static_cast<int>(std::round(sumR))));
-            int g = std::max(0, std::min(255, static_cast<int>(std::round(sumG))));
-            int b = std::max(0, std::min(255, static_cast<int>(std::round(sumB))));
-            tempImage.setPixel(x, y, qRgb(r, g, b));
-        }
+void filter2D(QImage &image, const Kernel &kernel, const FilterOptions &options) {
+    if (image.isNull() || kernel.isNull()) {
+        return;
     }
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            double sumR = 0.0, sumG = 0.0, sumB = 0.0;
-            for (size_t k = 0; k < size; ++k) {
-                int pixelY = y + static_cast<int>(k) - kCenter;
-                pixelY = std::max(0, std::min(height - 1, pixelY));
-
-                QRgb pixel = tempImage.pixel(x, pixelY);
-                double kernelValue = kernel[k];
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    const int kW = kernel.width();
+    const int kH = kernel.height();
+    if (image.format() == QImage::Format_ARGB32 &&
+        selectConvolutionEngine(kernel, image.width(), image.height(), options.convolutionEngine) ==
+            ConvolutionDirect) {
+        TraceScope scope("filter2D", pixels, pixels * 4);
+        convolveStraightAlpha(image, kernel.spanWeights(), kW, kH, "filter2D band", options);
+        finishStats(nullptr, options, image);
+        return;
+    }
 
-                sumR += qRed(pixel) * kernelValue;
-                sumG += qGreen(pixel) * kernelValue;
-                sumB += qBlue(pixel) * kernelValue;
-            }
-            int r = std::max(0, std::min(255, static_cast<int>(std::round(sumR))));
-            int g = std::max(0, std::min(255, static_cast<int>(std::round(sumG))));
-            int b = std::max(0, std::min(255, static_cast<int>(std::round(sumB))));
-            image.setPixel(x, y, qRgb(r, g, b));
-        }
+    const QImage::Format restore = toFilterFormat(image);
+    const PixelLayout layout(image.format());
+    const qint64 bytes = pixels * layout.pixelBytes();
+    TraceScope scope("filter2D", pixels, bytes);
+
+    // Раздельная свертка и БПФ считают каналы во float и пишут байты,
+    // поэтому 16-битные форматы сворачиваются прямо.
+    ConvolutionEngine engine = layout.channelBytes == 2
+        ? ConvolutionDirect
+        : selectConvolutionEngine(kernel, image.width(), image.height(), options.convolutionEngine);
+    std::unique_ptr<StatsCollector> stats = statsCollector(options, image);
+    if (engine == ConvolutionSeparable) {
+        TraceScope engineScope("separableFilter", pixels, bytes);
+        separableFilter(image, kernel.separableTerms(), kW, kH, options.border, options.cancel, stats.get());
+    } else if (engine == ConvolutionFft) {
+        TraceScope engineScope("fftFilter", pixels, bytes);
+        const KernelSpectrum &spectrum = kernel.spectrum(fftTileSize(image.width(), image.height(), kW, kH));
+        fftFilter(image, kernel.data(), kW, kH, options.border, options.cancel, stats.get(), &spectrum);
+    } else {
+        convolveImage(image, kernel.spanWeights(), kW, kH, "filter2D band", options, stats.get());
     }
+    restoreFilterFormat(image, restore);
+    finishStats(stats.get(), options, image);
+}
 
-    delete[] kernel;
+void filter2D(QImage &image, const double *kernel, size_t kWidth, size_t kHeight,
+              const FilterOptions &options) {
+    filter2D(image, Kernel(kernel, static_cast<int>(kWidth), static_cast<int>(kHeight)), options);
 }
 
-double* createGaussianKernel(size_t size, double sigma) {
-    if (size % 2 == 0) {
-        size++;
+ConvolutionEngine selectConvolutionEngine(const Kernel &kernel, int width, int height,
+                                          ConvolutionEngine requested) {
+    if (requested == ConvolutionDirect) {
+        return ConvolutionDirect;
     }
 
-    double *kernel = new double[size * size];
-    double sum = 0.0;
-    int center = static_cast<int>(size) / 2;
-
-    for (size_t i = 0; i < size; ++i) {
-        for (size_t j = 0; j < size; ++j) {
-            int x = static_cast<int>(j) - center;
-            int y = static_cast<int>(i) - center;
-            double value = std::exp(-(x * x + y * y) / (2.0 * sigma * sigma));
-            kernel[i * size + j] = value;
-            sum += value;
-        }
+    const int kW = kernel.width();
+    const int kH = kernel.height();
+    int rank = static_cast<int>(kernel.separableTerms().size());
+    bool automatic = requested == ConvolutionAuto;
+    if (rank > 0 && (requested == ConvolutionSeparable || (automatic && preferSeparable(rank, kW, kH)))) {
+        return ConvolutionSeparable;
     }
-
-    for (size_t i = 0; i < size * size; ++i) {
-        kernel[i] /= sum;
+    bool fftPossible = fftTileSize(width, height, kW, kH) > 0;
+    if (fftPossible && (requested == ConvolutionFft || (automatic && preferFft(width, height, kW, kH)))) {
+        return ConvolutionFft;
     }
+    return ConvolutionDirect;
+}
 
-    return kernel;
+ConvolutionEngine selectConvolutionEngine(const double *kernel, size_t kWidth, size_t kHeight,
+                                          int width, int height, ConvolutionEngine requested) {
+    return selectConvolutionEngine(Kernel(kernel, static_cast<int>(kWidth), static_cast<int>(kHeight)),
+                                   width, height, requested);
 }
 
-double* createSharpenKernel() {
-    double *kernel = new double[9];
-    kernel[0] =  0.0; kernel[1] = -1.5; kernel[2] =  0.0;
-    kernel[3] = -1.5; kernel[4] =  7.5; kernel[5] = -1.5;
-    kernel[6] =  0.0; kernel[7] = -1.5; kernel[8] =  0.0;
-    return kernel;
+QImage takeSourceImage(QImage &image) {
+    TraceScope scope("takeSourceImage", 0, image.sizeInBytes());
+    QImage source = image;
+    image = QImage(source.size(), source.format());
+    image.setDotsPerMeterX(source.dotsPerMeterX());
+    image.setDotsPerMeterY(source.dotsPerMeterY());
+    return source;
 }
 
-double* createSobelXKernel() {
-    double *kernel = new double[9];
-    kernel[0] = -2.0; kernel[1] = 0.0; kernel[2] = 2.0;
-    kernel[3] = -4.0; kernel[4] = 0.0; kernel[5] = 4.0;
-    kernel[6] = -2.0; kernel[7] = 0.0; kernel[8] = 2.0;
-    return kernel;
+BlurEngine selectBlurEngine(size_t size, double sigma, BlurEngine requested, double *kernelError) {
+    bool large = size >= RECURSIVE_BLUR_MIN_SIZE;
+    if (kernelError != nullptr) {
+        *kernelError = (large || requested == BlurRecursive) ? recursiveGaussianError(size, sigma) : -1.0;
+    }
+    if (requested != BlurAuto) {
+        return requested;
+    }
+    if (!large) {
+        return BlurDirect;
+    }
+    double error = kernelError != nullptr ? *kernelError : recursiveGaussianError(size, sigma);
+    return error <= RECURSIVE_BLUR_MAX_ERROR ? BlurRecursive : BlurDirect;
+}
+
+void gaussianBlur(QImage &image, size_t size, double sigma,
+                  const FilterOptions &options) {
+    if (image.isNull() || size == 0) {
+        return;
+    }
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    const QImage::Format restore = toFilterFormat(image);
+    const PixelLayout layout(image.format());
+    const qint64 bytes = pixels * layout.pixelBytes();
+    TraceScope scope("gaussianBlur", pixels, bytes);
+
+    std::unique_ptr<StatsCollector> stats = statsCollector(options, image);
+    if (options.border.mode == BorderClamp && layout.channelBytes == 1 &&
+        selectBlurEngine(size, sigma, options.blurEngine) == BlurRecursive) {
+        TraceScope engineScope("recursiveGaussianBlur", pixels, bytes);
+        recursiveGaussianBlur(image, sigma, options.cancel, stats.get());
+    } else {
+        // Горизонтальный проход, затем вертикальный, оба на месте, с одними
+        // весами. Статистику собирает последний.
+        Kernel kernel = Kernel::gaussian1D(size, sigma);
+        const int kSize = kernel.width();
+        convolveImage(image, kernel.spanWeights(), kSize, 1, "gaussianBlur horizontal", options);
+        convolveImage(image, kernel.spanWeights(), 1, kSize, "gaussianBlur vertical", options, stats.get());
+    }
+    restoreFilterFormat(image, restore);
+    finishStats(stats.get(), options, image);
 }
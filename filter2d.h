@@ -3,15 +3,100 @@
 
 #include <QImage>
 #include <cstddef>
+#include "border.h"
+#include "imagestats.h"
+#include "kernel.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include "separable.h"
+#include "spankernels.h"
 
-void filter2D(QImage &image, double *kernel, size_t kWidth, size_t kHeight);
+// Способ гауссова размытия. BlurAuto выбирает рекурсивный фильтр для
+// больших ядер, если его отклонение от прямой свертки достаточно мало.
+enum BlurEngine {
+    BlurAuto,
+    BlurDirect,
+    BlurRecursive
+};
 
-void gaussianBlur(QImage &image, size_t size, double sigma);
-double* createGaussianKernel1D(size_t size, double sigma);
+const size_t RECURSIVE_BLUR_MIN_SIZE = 41;
+const double RECURSIVE_BLUR_MAX_ERROR = 0.01;
 
+// Способ свертки в filter2D. ConvolutionAuto раскладывает ядро и
+// сворачивает раздельно, если ранг ядра достаточно мал, а большие
+// неразделимые ядра сворачивает через БПФ, если это дешевле.
+enum ConvolutionEngine {
+    ConvolutionAuto,
+    ConvolutionDirect,
+    ConvolutionSeparable,
+    ConvolutionFft
+};
 
-double* createGaussianKernel(size_t size, double sigma);
-double* createSharpenKernel();
-double* createSobelXKernel();
+struct FilterOptions {
+    FilterOptions()
+        : precision(PrecisionExact), blurEngine(BlurAuto), convolutionEngine(ConvolutionAuto),
+          cancel(nullptr), stats(nullptr) {}
+
+    FilterPrecision precision;
+    BlurEngine blurEngine;
+    ConvolutionEngine convolutionEngine;
+    // Продолжение за краем. Рекурсивное размытие умеет только BorderClamp,
+    // с другими режимами gaussianBlur сворачивает прямо.
+    Border border;
+    // Если задан, обработку можно прервать (см. isCancelled). Флаг должен
+    // жить, пока идет обработка.
+    const CancelFlag *cancel;
+    // Если задан, сюда записывается статистика результата, собранная
+    // при записи пикселей, без отдельного прохода. Если фильтр ничего
+    // не сделал или отменен, stats не меняется.
+    ImageStats *stats;
+};
+
+// Прямая свертка и gaussianBlur работают на месте, если данные image ни с
+// кем не разделены; иначе общие данные только читаются, а image получает
+// новый буфер. Передавать копию (image.copy()) поэтому не нужно.
+// Форматы с раскладкой PixelLayout (Grayscale8, RGB888, RGB32, 16-битные
+// и премультиплицированные) сворачиваются в своем формате. ARGB32 при
+// прямой свертке тоже обходится без преобразования изображения: строки
+// премультиплицируются при загрузке и возвращаются в ARGB32 при записи.
+// Раздельная свертка и БПФ, а также gaussianBlur и другие форматы с
+// отдельной альфой (RGBA8888, RGBA64) пока переводят изображение в
+// премультиплицированный формат и обратно — это два лишних прохода;
+// прочие форматы переводятся в RGB32 (см. toFilterFormat).
+// 16-битные форматы сворачиваются только прямо.
+// Веса, разложение и спектр ядра берутся из kernel и при повторных
+// вызовах с тем же ядром (или его копией) не пересчитываются.
+void filter2D(QImage &image, const Kernel &kernel, const FilterOptions &options = FilterOptions());
+void filter2D(QImage &image, const double *kernel, size_t kWidth, size_t kHeight,
+              const FilterOptions &options = FilterOptions());
+
+// Какой способ использует filter2D для ядра на изображении width x height.
+ConvolutionEngine selectConvolutionEngine(const Kernel &kernel, int width, int height,
+                                          ConvolutionEngine requested = ConvolutionAuto);
+ConvolutionEngine selectConvolutionEngine(const double *kernel, size_t kWidth, size_t kHeight,
+                                          int width, int height, ConvolutionEngine requested = ConvolutionAuto);
+
+// Свертка одной выходной строки в раскладке layout по rowCount исходным
+// строкам; столбцы за краем продолжаются по borderMode, а при
+// BorderConstant берутся из пикселя constantPixel (см. constantRow).
+// Альфа результата доводится по finishRow. taps — рабочий буфер на
+// rowCount * kWidth указателей.
+void convolveRow(const uchar *const *rows, int rowCount, int kWidth, int kCenterX,
+                 const SpanWeights &weights, FilterPrecision precision, const PixelLayout &layout,
+                 BorderMode borderMode, const uchar *constantPixel, int width, uchar *dst,
+                 std::vector<const uchar *> &taps);
+
+// Отдает данные image как источник свертки и заменяет image новым буфером
+// того же размера и формата. Пиксели не копируются: если вызывающий код
+// еще держит то же изображение, источник остается с ним общим.
+QImage takeSourceImage(QImage &image);
+
+void gaussianBlur(QImage &image, size_t size, double sigma,
+                  const FilterOptions &options = FilterOptions());
+
+// Какой способ использует gaussianBlur. В kernelError, если задан,
+// записывается отклонение рекурсивного фильтра от ядра (recursiveGaussianError).
+BlurEngine selectBlurEngine(size_t size, double sigma, BlurEngine requested = BlurAuto,
+                            double *kernelError = nullptr);
 
 #endif
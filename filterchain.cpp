@@ -0,0 +1,278 @@
+#include "filterchain.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+namespace {
+
+// Один проход прямой свертки внутри слитой группы. Размеры задаются
+// отдельно от ядра: вертикальный проход размытия берет веса строки.
+struct Pass {
+    Pass(const Kernel &kernel, int kWidth, int kHeight)
+        : kernel(kernel), weights(kernel.spanWeights()), kWidth(kWidth), kHeight(kHeight),
+          kCenterX(kWidth / 2), kCenterY(kHeight / 2) {}
+
+    Kernel kernel;
+    const SpanWeights &weights;
+    int kWidth;
+    int kHeight;
+    int kCenterX;
+    int kCenterY;
+};
+
+// Проходы группы выполняются по полосам. Каждый проход, кроме последнего,
+// пишет в кольцо из kHeight строк следующего прохода: строки вычисляются
+// по требованию, когда следующему проходу не хватает очередной строки.
+// Полосы пересчитывают ореол соседей, зато не ждут друг друга.
+//
+// Первый проход читает источник через такое же кольцо: строка копируется
+// туда, когда впервые нужна, а это всегда раньше, чем последний проход
+// перезапишет ее результатом. Поэтому группа работает на месте, как и
+// filter2D; строки на стыках полос сохраняются до запуска. Статистика
+// для options.stats собирается по строкам последнего прохода.
+void runFused(QImage &image, const std::vector<std::unique_ptr<Pass> > &passes, const FilterOptions &options) {
+    if (passes.empty()) {
+        return;
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    const int passCount = static_cast<int>(passes.size());
+    const PixelLayout layout(image.format());
+    const size_t rowBytes = static_cast<size_t>(width) * layout.pixelBytes();
+    const BorderMode borderMode = options.border.mode;
+    const std::vector<uchar> constant = constantRow(layout, options.border, width);
+
+    int haloAbove = 0;
+    int haloBelow = 0;
+    for (const std::unique_ptr<Pass> &pass : passes) {
+        haloAbove += pass->kCenterY;
+        haloBelow += pass->kHeight - 1 - pass->kCenterY;
+    }
+
+    // Разделенные данные только читаются, результат идет в новый буфер.
+    QImage source = image.isDetached() ? QImage() : takeSourceImage(image);
+    uchar *dstBits = image.bits();
+    const uchar *srcBits = source.isNull() ? dstBits : source.constBits();
+    const int srcStride = source.isNull() ? image.bytesPerLine() : source.bytesPerLine();
+    const int dstStride = image.bytesPerLine();
+
+    // Полоса в несколько раз выше суммарного ореола, чтобы пересчет
+    // на стыках оставался небольшой долей работы.
+    const int bandRows = rowBandHeight(height, std::max(16, 4 * (haloAbove + haloBelow)));
+    const int bandCount = (height + bandRows - 1) / bandRows;
+    const int seamRows = haloAbove + haloBelow;
+    std::vector<uchar> seams;
+    if (source.isNull()) {
+        seams.resize(static_cast<size_t>(std::max(0, bandCount - 1)) * seamRows * rowBytes);
+        for (int band = 1; band < bandCount; ++band) {
+            int seam = band * bandRows;
+            for (int y = std::max(0, seam - haloAbove); y < std::min(height, seam + haloBelow); ++y) {
+                std::memcpy(seams.data() + (static_cast<size_t>(band - 1) * seamRows + y - seam + haloAbove) * rowBytes,
+                            srcBits + static_cast<size_t>(y) * srcStride, rowBytes);
+            }
+        }
+    }
+
+    // Строки собираются в статистику только в виде QRgb (RGB32), для
+    // остальных форматов ее считает FilterChain::apply по результату.
+    const bool collectStats = options.stats != nullptr && image.format() == QImage::Format_RGB32;
+    std::unique_ptr<StatsCollector> stats(collectStats ? new StatsCollector : nullptr);
+    parallelForBands(height, bandRows, [&](int y0, int y1) {
+        StatsCollector::Band band(stats.get());
+        std::vector<std::vector<uchar> > rings(passCount);
+        std::vector<int> capacity(passCount);
+        std::vector<int> produced(passCount);
+        std::vector<std::vector<const uchar *> > rows(passCount);
+        std::vector<std::vector<const uchar *> > taps(passCount);
+
+        // rings[k] — входные строки прохода k, rings[0] — копии источника.
+        produced[passCount - 1] = y0;
+        for (int k = passCount - 1; k > 0; --k) {
+            produced[k - 1] = std::max(0, produced[k] - passes[k]->kCenterY);
+        }
+        for (int k = 0; k < passCount; ++k) {
+            capacity[k] = passes[k]->kHeight;
+            rings[k].resize(static_cast<size_t>(capacity[k]) * rowBytes);
+            rows[k].resize(passes[k]->kHeight);
+            taps[k].resize(static_cast<size_t>(passes[k]->kHeight) * passes[k]->kWidth);
+        }
+        int copied = std::max(0, produced[0] - passes[0]->kCenterY);
+
+        auto ringRow = [&](int k, int y) {
+            return rings[k].data() + static_cast<size_t>(y % capacity[k]) * rowBytes;
+        };
+        auto sourceRow = [&](int y) {
+            if (source.isNull() && (y < y0 || y >= y1)) {
+                int band = y < y0 ? y0 / bandRows : y1 / bandRows;
+                int seam = band * bandRows;
+                return static_cast<const uchar *>(
+                    seams.data() + (static_cast<size_t>(band - 1) * seamRows + y - seam + haloAbove) * rowBytes);
+            }
+            return srcBits + static_cast<size_t>(y) * srcStride;
+        };
+
+        // Вычисляет следующую строку прохода k, досчитав нужные строки
+        // предыдущих проходов.
+        std::function<void(int)> produce = [&](int k) {
+            const Pass &pass = *passes[k];
+            int y = produced[k];
+            int last = std::min(height - 1, y + pass.kHeight - 1 - pass.kCenterY);
+            if (borderMode == BorderReflect) {
+                // Первым строкам отражение дает строки до kCenterY - y.
+                last = std::max(last, std::min(height - 1, pass.kCenterY - y));
+            }
+            if (k > 0) {
+                while (produced[k - 1] <= last) {
+                    produce(k - 1);
+                }
+            } else {
+                for (; copied <= last; ++copied) {
+                    std::memcpy(ringRow(0, copied), sourceRow(copied), rowBytes);
+                }
+            }
+            for (int ky = 0; ky < pass.kHeight; ++ky) {
+                int pixelY = borderIndex(y + ky - pass.kCenterY, height, borderMode);
+                rows[k][ky] = pixelY < 0 ? constant.data() : ringRow(k, pixelY);
+            }
+            uchar *dst = k == passCount - 1 ? dstBits + static_cast<size_t>(y) * dstStride : ringRow(k + 1, y);
+            convolveRow(rows[k].data(), pass.kHeight, pass.kWidth, pass.kCenterX,
+                        pass.weights, options.precision, layout, borderMode, constant.data(), width, dst, taps[k]);
+            if (k == passCount - 1) {
+                band.addRow(reinterpret_cast<const QRgb *>(dst), width);
+            }
+            ++produced[k];
+        };
+
+        for (int y = y0; y < y1 && !isCancelled(options.cancel); ++y) {
+            produce(passCount - 1);
+        }
+    });
+    if (stats && !isCancelled(options.cancel)) {
+        stats->finish(*options.stats);
+    }
+}
+
+}
+
+void FilterChain::addGaussian(size_t size, double sigma) {
+    Stage stage;
+    stage.gaussian = true;
+    stage.size = size;
+    stage.sigma = sigma;
+    stage.kWidth = 0;
+    stage.kHeight = 0;
+    stages.push_back(stage);
+}
+
+void FilterChain::addKernel(const Kernel &kernel) {
+    Stage stage;
+    stage.gaussian = false;
+    stage.size = 0;
+    stage.sigma = 0.0;
+    stage.kernel = kernel;
+    stage.kWidth = kernel.width();
+    stage.kHeight = kernel.height();
+    stages.push_back(stage);
+}
+
+void FilterChain::addKernel(const double *kernel, size_t kWidth, size_t kHeight) {
+    addKernel(Kernel(kernel, static_cast<int>(kWidth), static_cast<int>(kHeight)));
+}
+
+void FilterChain::clear() {
+    stages.clear();
+}
+
+int FilterChain::halo() const {
+    int rows = 0;
+    for (const Stage &stage : stages) {
+        // Четный размер гауссова ядра gaussianBlur округляет вверх.
+        rows += stage.gaussian ? static_cast<int>(stage.size | 1) / 2 : static_cast<int>(stage.kHeight) / 2;
+    }
+    return rows;
+}
+
+void FilterChain::apply(QImage &image, const FilterOptions &options) const {
+    if (image.isNull() || stages.empty()) {
+        return;
+    }
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    // Формат переводится один раз на всю цепочку, а не на каждую ступень.
+    const QImage::Format restore = toFilterFormat(image);
+    TraceScope scope("FilterChain::apply", pixels, pixels * PixelLayout(image.format()).pixelBytes());
+
+    // Статистика нужна только от последней ступени, которая что-то делает.
+    int lastStage = -1;
+    for (int i = 0; i < static_cast<int>(stages.size()); ++i) {
+        const Stage &stage = stages[i];
+        if (stage.gaussian ? stage.size != 0 : stage.kWidth != 0 && stage.kHeight != 0) {
+            lastStage = i;
+        }
+    }
+    FilterOptions stageOptions = options;
+    stageOptions.stats = nullptr;
+    // Последняя ступень собирает статистику при записи только у RGB32;
+    // для остальных форматов она считается по результату в исходном формате.
+    const bool stageStats = image.format() == QImage::Format_RGB32;
+    const FilterOptions &lastOptions = stageStats ? options : stageOptions;
+
+    // Подряд идущие ступени прямой свертки сливаются в одну группу.
+    // Рекурсивное размытие и раздельная свертка или БПФ для больших ядер
+    // строку за строкой не считаются и выполняются отдельным проходом.
+    // С BorderWrap каждой ступени нужны строки с другого края изображения,
+    // поэтому ступени тоже идут отдельными проходами.
+    const bool fuse = options.border.mode != BorderWrap;
+    std::vector<std::unique_ptr<Pass> > group;
+    auto flush = [&](const FilterOptions &flushOptions) {
+        runFused(image, group, flushOptions);
+        group.clear();
+    };
+
+    for (int i = 0; i < static_cast<int>(stages.size()); ++i) {
+        const Stage &stage = stages[i];
+        const FilterOptions &ownOptions = i == lastStage ? lastOptions : stageOptions;
+        if (stage.gaussian) {
+            if (stage.size == 0) {
+                continue;
+            }
+            if (!fuse || (options.border.mode == BorderClamp &&
+                          selectBlurEngine(stage.size, stage.sigma, options.blurEngine) == BlurRecursive)) {
+                flush(stageOptions);
+                gaussianBlur(image, stage.size, stage.sigma, ownOptions);
+                continue;
+            }
+            // Те же горизонтальный и вертикальный проходы, что в gaussianBlur.
+            Kernel kernel = Kernel::gaussian1D(stage.size, stage.sigma);
+            int kSize = kernel.width();
+            group.emplace_back(new Pass(kernel, kSize, 1));
+            group.emplace_back(new Pass(kernel, 1, kSize));
+        } else {
+            if (stage.kWidth == 0 || stage.kHeight == 0) {
+                continue;
+            }
+            if (!fuse || selectConvolutionEngine(stage.kernel, image.width(), image.height(),
+                                                 options.convolutionEngine) != ConvolutionDirect) {
+                flush(stageOptions);
+                filter2D(image, stage.kernel, ownOptions);
+                continue;
+            }
+            group.emplace_back(new Pass(stage.kernel, static_cast<int>(stage.kWidth),
+                                        static_cast<int>(stage.kHeight)));
+        }
+    }
+    flush(lastOptions);
+    restoreFilterFormat(image, restore);
+
+    if (!stageStats && lastStage >= 0 && options.stats != nullptr && !isCancelled(options.cancel)) {
+        ImageStats stats;
+        if (computeImageStats(image, stats, options.cancel)) {
+            *options.stats = stats;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef FILTERCHAIN_H
+#define FILTERCHAIN_H
+
+#include "filter2d.h"
+#include <QImage>
+#include <vector>
+
+// Последовательность фильтров, применяемая за один проход по памяти.
+// Ступени прямой свертки не пишут промежуточные изображения: строки
+// текущей полосы протягиваются через кольцевые буферы от ступени к
+// ступени, и в память изображения попадает только результат последней.
+// Результат побитно совпадает с последовательными вызовами gaussianBlur
+// и filter2D с теми же параметрами.
+class FilterChain {
+public:
+    void addGaussian(size_t size, double sigma);
+    void addKernel(const Kernel &kernel);
+    void addKernel(const double *kernel, size_t kWidth, size_t kHeight);
+    void clear();
+
+    bool isEmpty() const { return stages.empty(); }
+    int stageCount() const { return static_cast<int>(stages.size()); }
+
+    // На сколько строк вверх и вниз результат зависит от источника.
+    int halo() const;
+
+    void apply(QImage &image, const FilterOptions &options = FilterOptions()) const;
+
+private:
+    struct Stage {
+        bool gaussian;
+        size_t size;
+        double sigma;
+        Kernel kernel;
+        size_t kWidth;
+        size_t kHeight;
+    };
+
+    std::vector<Stage> stages;
+};
+
+#endif
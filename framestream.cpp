@@ -0,0 +1,638 @@
+#include "framestream.h"
+#include "batchprocessor.h"
+#include "imageio.h"
+#include "trace.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace {
+
+// Отчет и ошибки идут в stderr: stdout занят кадрами.
+void printError(const QString &line) {
+    QTextStream stream(stderr);
+    stream << line << '\n';
+}
+
+// Номер кадра в шаблоне имени: %d или %0Nd, как у ffmpeg.
+const QRegularExpression &sequencePattern() {
+    static const QRegularExpression pattern("%(0(\\d+))?d");
+    return pattern;
+}
+
+bool isSequence(const QString &path) {
+    return sequencePattern().match(path).hasMatch();
+}
+
+QString sequenceFileName(const QString &pattern, qint64 index) {
+    QRegularExpressionMatch match = sequencePattern().match(pattern);
+    const int width = match.captured(2).toInt();
+    return pattern.left(match.capturedStart()) + QString("%1").arg(index, width, 10, QChar('0'))
+         + pattern.mid(match.capturedEnd());
+}
+
+// Читает ровно bytes байт; возвращает, сколько прочитано до конца потока.
+qint64 readFully(QIODevice &in, char *data, qint64 bytes) {
+    qint64 total = 0;
+    while (total < bytes) {
+        qint64 count = in.read(data + total, bytes - total);
+        if (count <= 0) {
+            break;
+        }
+        total += count;
+    }
+    return total;
+}
+
+int planeRowBytes(const QImage &plane) {
+    return plane.width() * plane.depth() / 8;
+}
+
+// Строки плоскости читаются прямо в ее память. Если строки идут без
+// выравнивания, плоскость читается одним вызовом.
+bool readPlane(QIODevice &in, QImage &plane, bool &empty) {
+    const int rowBytes = planeRowBytes(plane);
+    if (plane.bytesPerLine() == rowBytes) {
+        const qint64 bytes = static_cast<qint64>(rowBytes) * plane.height();
+        qint64 count = readFully(in, reinterpret_cast<char *>(plane.bits()), bytes);
+        empty = count == 0;
+        return count == bytes;
+    }
+    for (int y = 0; y < plane.height(); ++y) {
+        qint64 count = readFully(in, reinterpret_cast<char *>(plane.scanLine(y)), rowBytes);
+        if (count != rowBytes) {
+            empty = y == 0 && count == 0;
+            return false;
+        }
+    }
+    empty = false;
+    return true;
+}
+
+bool writePlane(QIODevice &out, const QImage &plane) {
+    const int rowBytes = planeRowBytes(plane);
+    if (plane.bytesPerLine() == rowBytes) {
+        const qint64 bytes = static_cast<qint64>(rowBytes) * plane.height();
+        return out.write(reinterpret_cast<const char *>(plane.constBits()), bytes) == bytes;
+    }
+    for (int y = 0; y < plane.height(); ++y) {
+        if (out.write(reinterpret_cast<const char *>(plane.constScanLine(y)), rowBytes) != rowBytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// YUV4MPEG2 с 8 битами на отсчет: после строки заголовка каждый кадр —
+// строка FRAME и плоскости Y, U, V подряд (у mono только Y).
+class Y4mSource : public FrameSource {
+public:
+    explicit Y4mSource(QIODevice &in) : in(in), width(0), height(0), chromaWidth(0), chromaHeight(0) {}
+
+    bool open(QString &error);
+    QByteArray headerLine() const { return header; }
+
+    Frame allocateFrame() const override;
+    bool readFrame(Frame &frame, QString &error) override;
+
+private:
+    QIODevice &in;
+    QByteArray header;
+    int width;
+    int height;
+    // 0 — цветовых плоскостей нет (mono).
+    int chromaWidth;
+    int chromaHeight;
+};
+
+bool Y4mSource::open(QString &error) {
+    header = in.readLine(4096);
+    if (!header.startsWith("YUV4MPEG2 ") || !header.endsWith('\n')) {
+        error = "На входе не YUV4MPEG2.";
+        return false;
+    }
+    QByteArray colorspace = "420";
+    for (const QByteArray &token : header.trimmed().split(' ')) {
+        if (token.startsWith('W')) {
+            width = token.mid(1).toInt();
+        } else if (token.startsWith('H')) {
+            height = token.mid(1).toInt();
+        } else if (token.startsWith('C')) {
+            colorspace = token.mid(1);
+        }
+    }
+    if (width <= 0 || height <= 0) {
+        error = "В заголовке YUV4MPEG2 нет размера кадра.";
+        return false;
+    }
+
+    int subsampleX = 0, subsampleY = 0;
+    if (colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2") {
+        subsampleX = subsampleY = 2;
+    } else if (colorspace == "422") {
+        subsampleX = 2;
+        subsampleY = 1;
+    } else if (colorspace == "444") {
+        subsampleX = subsampleY = 1;
+    } else if (colorspace != "mono") {
+        error = "Цветовое пространство YUV4MPEG2 C" + QString::fromLatin1(colorspace)
+              + " не поддерживается (нужны 8 бит: 420, 422, 444 или mono).";
+        return false;
+    }
+    if (subsampleX > 0) {
+        chromaWidth = (width + subsampleX - 1) / subsampleX;
+        chromaHeight = (height + subsampleY - 1) / subsampleY;
+    }
+    return true;
+}
+
+Frame Y4mSource::allocateFrame() const {
+    Frame frame;
+    frame.push_back(QImage(width, height, QImage::Format_Grayscale8));
+    if (chromaWidth > 0) {
+        frame.push_back(QImage(chromaWidth, chromaHeight, QImage::Format_Grayscale8));
+        frame.push_back(QImage(chromaWidth, chromaHeight, QImage::Format_Grayscale8));
+    }
+    return frame;
+}
+
+bool Y4mSource::readFrame(Frame &frame, QString &error) {
+    QByteArray line = in.readLine(4096);
+    if (line.isEmpty()) {
+        return false;
+    }
+    if (!line.startsWith("FRAME") || !line.endsWith('\n')) {
+        error = "Нарушена структура YUV4MPEG2: нет заголовка кадра.";
+        return false;
+    }
+    for (QImage &plane : frame) {
+        bool empty = false;
+        if (!readPlane(in, plane, empty)) {
+            error = "Поток YUV4MPEG2 оборван посреди кадра.";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Сырые кадры одного размера подряд: gray (Grayscale8) или rgb24 (RGB888).
+class RawSource : public FrameSource {
+public:
+    RawSource(QIODevice &in, const QSize &size, QImage::Format format) : in(in), size(size), format(format) {}
+
+    Frame allocateFrame() const override {
+        return Frame(1, QImage(size, format));
+    }
+
+    bool readFrame(Frame &frame, QString &error) override {
+        bool empty = false;
+        if (readPlane(in, frame[0], empty)) {
+            return true;
+        }
+        if (!empty) {
+            error = "Поток сырых кадров оборван посреди кадра.";
+        }
+        return false;
+    }
+
+private:
+    QIODevice &in;
+    QSize size;
+    QImage::Format format;
+};
+
+// Нумерованные файлы; поток кончается на первом отсутствующем номере.
+// Кадры создает кодек, так что буферы пула здесь не переиспользуются.
+class SequenceSource : public FrameSource {
+public:
+    SequenceSource(const QString &pattern, qint64 start) : pattern(pattern), next(start) {}
+
+    Frame allocateFrame() const override {
+        return Frame();
+    }
+
+    bool readFrame(Frame &frame, QString &error) override {
+        const QString fileName = sequenceFileName(pattern, next);
+        if (!QFile::exists(fileName)) {
+            return false;
+        }
+        ++next;
+        QImage image = readImageFile(fileName, &error);
+        if (image.isNull()) {
+            return false;
+        }
+        if (!size.isEmpty() && image.size() != size) {
+            error = "Размер кадра " + fileName + " отличается от первого.";
+            return false;
+        }
+        size = image.size();
+        frame.assign(1, image);
+        return true;
+    }
+
+private:
+    QString pattern;
+    qint64 next;
+    QSize size;
+};
+
+// Кадры в поток: Y4M с тем же заголовком или сырые кадры. Сырой кадр
+// пишется в формате плоскости, если это gray или rgb24, иначе в rgb24.
+class DeviceSink : public FrameSink {
+public:
+    DeviceSink(QIODevice &out, const QByteArray &y4mHeader) : out(out), header(y4mHeader) {}
+
+    bool writeFrame(const Frame &frame, qint64 index, QString &error) override {
+        bool ok = true;
+        if (!header.isEmpty()) {
+            if (index == 0) {
+                ok = out.write(header) == header.size();
+            }
+            ok = ok && out.write("FRAME\n", 6) == 6;
+            for (const QImage &plane : frame) {
+                ok = ok && writePlane(out, plane);
+            }
+        } else {
+            const QImage &plane = frame[0];
+            bool native = plane.format() == QImage::Format_Grayscale8 || plane.format() == QImage::Format_RGB888;
+            ok = writePlane(out, native ? plane : plane.convertToFormat(QImage::Format_RGB888));
+        }
+        // Кадр уходит дальше сразу, а не когда заполнится буфер.
+        ok = ok && (!qobject_cast<QFile *>(&out) || static_cast<QFile &>(out).flush());
+        if (!ok) {
+            error = "Не удалось записать кадр " + QString::number(index) + ".";
+        }
+        return ok;
+    }
+
+private:
+    QIODevice &out;
+    QByteArray header;
+};
+
+class SequenceSink : public FrameSink {
+public:
+    SequenceSink(const QString &pattern, qint64 start) : pattern(pattern), start(start) {}
+
+    bool writeFrame(const Frame &frame, qint64 index, QString &error) override {
+        return writeImageFile(frame[0], sequenceFileName(pattern, start + index), &error);
+    }
+
+private:
+    QString pattern;
+    qint64 start;
+};
+
+double percentile(const std::vector<qint64> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1] / 1e6;
+}
+
+bool openStandard(QFile &file, FILE *stream, QIODevice::OpenMode mode) {
+#ifdef _WIN32
+    _setmode(_fileno(stream), _O_BINARY);
+#endif
+    // Без буфера QIODevice кадры читаются прямо в память плоскостей.
+    return file.open(stream, mode | QIODevice::Unbuffered);
+}
+
+}
+
+bool runFrameStream(FrameSource &source, FrameSink &sink, const StreamOptions &options,
+                    StreamReport &report, QString &error) {
+    report = StreamReport();
+    const int slotCount = std::max(1, options.framesInFlight);
+    const int workers = std::max(1, std::min(options.workers, slotCount));
+
+    // Буфер кадра в пуле. index и arrival действительны, пока кадр в работе.
+    struct Slot {
+        Slot() : index(0), arrival(0), filtered(false) {}
+
+        Frame frame;
+        qint64 index;
+        qint64 arrival;
+        bool filtered;
+    };
+    std::vector<Slot> buffers(slotCount);
+    std::deque<int> freeSlots;
+    std::deque<int> filledSlots;
+    for (int i = 0; i < slotCount; ++i) {
+        freeSlots.push_back(i);
+    }
+
+    QMutex mutex;
+    QWaitCondition changed;
+    bool readerDone = false;
+    bool failed = false;
+    qint64 framesRead = 0;
+    std::vector<qint64> latencies;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(workers + 1);
+    QList<QFuture<void> > stages;
+
+    for (int i = 0; i < workers; ++i) {
+        stages << QtConcurrent::run(&pool, [&]() {
+            for (;;) {
+                int slot;
+                {
+                    QMutexLocker locker(&mutex);
+                    while (filledSlots.empty() && !readerDone && !failed) {
+                        changed.wait(&mutex);
+                    }
+                    if (filledSlots.empty() || failed) {
+                        return;
+                    }
+                    slot = filledSlots.front();
+                    filledSlots.pop_front();
+                }
+                Frame &frame = buffers[slot].frame;
+                const size_t planes = options.filterChroma ? frame.size() : std::min<size_t>(1, frame.size());
+                for (size_t p = 0; p < planes; ++p) {
+                    options.chain.apply(frame[p], options.filterOptions);
+                }
+                QMutexLocker locker(&mutex);
+                buffers[slot].filtered = true;
+                changed.wakeAll();
+            }
+        });
+    }
+
+    // Кадры пишутся строго по порядку: следующий ждет, даже если более
+    // поздний уже готов.
+    stages << QtConcurrent::run(&pool, [&]() {
+        for (qint64 next = 0;; ++next) {
+            int slot = -1;
+            {
+                QMutexLocker locker(&mutex);
+                for (;;) {
+                    if (failed) {
+                        return;
+                    }
+                    for (int i = 0; i < slotCount && slot < 0; ++i) {
+                        if (buffers[i].filtered && buffers[i].index == next) {
+                            slot = i;
+                        }
+                    }
+                    if (slot >= 0) {
+                        break;
+                    }
+                    if (readerDone && next >= framesRead) {
+                        return;
+                    }
+                    changed.wait(&mutex);
+                }
+            }
+
+            QString writeError;
+            bool ok;
+            {
+                TraceScope scope("writeFrame");
+                ok = sink.writeFrame(buffers[slot].frame, next, writeError);
+            }
+            const qint64 latency = timer.nsecsElapsed() - buffers[slot].arrival;
+            const QImage &first = buffers[slot].frame[0];
+
+            QMutexLocker locker(&mutex);
+            if (!ok) {
+                failed = true;
+                error = writeError;
+                changed.wakeAll();
+                return;
+            }
+            latencies.push_back(latency);
+            report.pixels += static_cast<qint64>(first.width()) * first.height();
+            buffers[slot].filtered = false;
+            freeSlots.push_back(slot);
+            changed.wakeAll();
+        }
+    });
+
+    // Чтение идет в вызывающем потоке и ждет, когда запись вернет буфер:
+    // так кадров в работе не больше, чем буферов.
+    for (;;) {
+        int slot;
+        {
+            QMutexLocker locker(&mutex);
+            while (freeSlots.empty() && !failed) {
+                changed.wait(&mutex);
+            }
+            if (failed) {
+                break;
+            }
+            slot = freeSlots.front();
+            freeSlots.pop_front();
+        }
+
+        Slot &buffer = buffers[slot];
+        if (buffer.frame.empty()) {
+            buffer.frame = source.allocateFrame();
+        }
+        QString readError;
+        bool ok;
+        {
+            TraceScope scope("readFrame");
+            ok = source.readFrame(buffer.frame, readError);
+        }
+
+        QMutexLocker locker(&mutex);
+        if (!ok) {
+            if (!readError.isEmpty()) {
+                failed = true;
+                error = readError;
+            }
+            freeSlots.push_back(slot);
+            break;
+        }
+        buffer.index = framesRead++;
+        buffer.arrival = timer.nsecsElapsed();
+        buffer.filtered = false;
+        filledSlots.push_back(slot);
+        changed.wakeAll();
+    }
+    {
+        QMutexLocker locker(&mutex);
+        readerDone = true;
+        changed.wakeAll();
+    }
+    for (QFuture<void> &stage : stages) {
+        stage.waitForFinished();
+    }
+
+    report.seconds = timer.nsecsElapsed() / 1e9;
+    report.frames = static_cast<qint64>(latencies.size());
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        double total = 0.0;
+        for (qint64 latency : latencies) {
+            total += latency;
+        }
+        report.meanLatency = total / latencies.size() / 1e6;
+        report.p50Latency = percentile(latencies, 0.50);
+        report.p99Latency = percentile(latencies, 0.99);
+        report.maxLatency = latencies.back() / 1e6;
+    }
+    return !failed;
+}
+
+bool isStreamInvocation(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--stream") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int runStreamCommand(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Потоковая обработка кадров: YUV4MPEG2 или сырые кадры со stdin "
+                                     "либо нумерованные файлы, результат в stdout.");
+    parser.addHelpOption();
+
+    QCommandLineOption streamOption("stream", "Потоковый режим.");
+    QCommandLineOption inputOption(QStringList() << "i" << "input",
+                                   "Источник: - (stdin), файл или шаблон имен кадров, например frame%04d.png.",
+                                   "path", "-");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Куда писать: - (stdout), файл или шаблон имен кадров.", "path", "-");
+    QCommandLineOption startOption("start", "Номер первого кадра в шаблоне имен.", "n", "0");
+    QCommandLineOption rawOption("raw", "Сырые кадры размером WxH вместо YUV4MPEG2.", "WxH");
+    QCommandLineOption pixOption("pix", "Формат сырых кадров: gray или rgb24.", "format", "rgb24");
+    QCommandLineOption framesOption("frames", "Кадров в работе одновременно (буферов в пуле).", "n", "3");
+    QCommandLineOption workersOption("workers", "Кадров, которые фильтруются одновременно.", "n", "2");
+    QCommandLineOption chromaOption("filter-chroma",
+                                    "Фильтровать и цветовые плоскости YUV4MPEG2 (по умолчанию только яркость).");
+    QCommandLineOption traceOption("trace", "Записать трассировку стадий в файл для about:tracing.", "file");
+    parser.addOptions(QList<QCommandLineOption>() << streamOption << inputOption << outputOption << startOption
+                                                  << rawOption << pixOption << framesOption << workersOption
+                                                  << chromaOption << traceOption);
+    addFilterOptions(parser);
+
+    if (!parser.parse(arguments)) {
+        printError(parser.errorText());
+        return 2;
+    }
+    if (parser.isSet("help")) {
+        QTextStream(stdout) << parser.helpText();
+        return 0;
+    }
+
+    StreamOptions options;
+    QString error;
+    if (!parseFilterOptions(parser, options.chain, options.filterOptions, error)) {
+        printError(error);
+        return 2;
+    }
+    options.framesInFlight = std::max(1, parser.value(framesOption).toInt());
+    options.workers = std::max(1, parser.value(workersOption).toInt());
+    options.filterChroma = parser.isSet(chromaOption);
+    const qint64 start = parser.value(startOption).toLongLong();
+
+    // Источник.
+    const QString input = parser.value(inputOption);
+    QFile inputFile;
+    std::unique_ptr<FrameSource> source;
+    QByteArray y4mHeader;
+    if (isSequence(input)) {
+        source.reset(new SequenceSource(input, start));
+    } else {
+        inputFile.setFileName(input);
+        bool opened = input == "-" ? openStandard(inputFile, stdin, QIODevice::ReadOnly)
+                                   : inputFile.open(QIODevice::ReadOnly);
+        if (!opened) {
+            printError("Не удалось открыть " + input);
+            return 1;
+        }
+        if (parser.isSet(rawOption)) {
+            QStringList size = parser.value(rawOption).split('x');
+            const int width = size.size() == 2 ? size[0].toInt() : 0;
+            const int height = size.size() == 2 ? size[1].toInt() : 0;
+            const QString pix = parser.value(pixOption);
+            if (width <= 0 || height <= 0 || (pix != "gray" && pix != "rgb24")) {
+                printError("Нужны --raw WxH и --pix gray или rgb24.");
+                return 2;
+            }
+            source.reset(new RawSource(inputFile, QSize(width, height),
+                                       pix == "gray" ? QImage::Format_Grayscale8 : QImage::Format_RGB888));
+        } else {
+            Y4mSource *y4m = new Y4mSource(inputFile);
+            source.reset(y4m);
+            if (!y4m->open(error)) {
+                printError(error);
+                return 1;
+            }
+            y4mHeader = y4m->headerLine();
+        }
+    }
+
+    // Приемник.
+    const QString output = parser.value(outputOption);
+    QFile outputFile;
+    std::unique_ptr<FrameSink> sink;
+    if (isSequence(output)) {
+        if (!y4mHeader.isEmpty()) {
+            printError("Кадры YUV4MPEG2 можно писать только в поток YUV4MPEG2.");
+            return 2;
+        }
+        sink.reset(new SequenceSink(output, start));
+    } else {
+        outputFile.setFileName(output);
+        bool opened = output == "-" ? openStandard(outputFile, stdout, QIODevice::WriteOnly)
+                                    : outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        if (!opened) {
+            printError("Не удалось открыть " + output);
+            return 1;
+        }
+        sink.reset(new DeviceSink(outputFile, y4mHeader));
+    }
+
+    setTracingEnabled(parser.isSet(traceOption));
+    StreamReport report;
+    bool ok = runFrameStream(*source, *sink, options, report, error);
+    double seconds = std::max(report.seconds, 1e-9);
+    printError(QString("Кадров: %1 за %2 с, %3 кадр/с, %4 Мпикс/с. Задержка кадра: средняя %5 мс, "
+                       "p50 %6 мс, p99 %7 мс, наибольшая %8 мс.")
+                   .arg(report.frames)
+                   .arg(report.seconds, 0, 'f', 2)
+                   .arg(report.frames / seconds, 0, 'f', 1)
+                   .arg(report.pixels / 1e6 / seconds, 0, 'f', 1)
+                   .arg(report.meanLatency, 0, 'f', 1)
+                   .arg(report.p50Latency, 0, 'f', 1)
+                   .arg(report.p99Latency, 0, 'f', 1)
+                   .arg(report.maxLatency, 0, 'f', 1));
+    if (parser.isSet(traceOption)) {
+        QString traceError;
+        if (!writeChromeTrace(parser.value(traceOption), &traceError)) {
+            printError(traceError);
+            return 1;
+        }
+    }
+    if (!ok) {
+        printError(error);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include "filterchain.h"
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+// Кадр — набор плоскостей: у Y4M это Y, U и V (Format_Grayscale8, цветовые
+// плоскости меньше по размеру), у сырых кадров и файлов — одна плоскость.
+typedef std::vector<QImage> Frame;
+
+// Откуда берутся кадры.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Плоскости пустого кадра для буфера из пула. Пустой набор, если
+    // размер заранее не известен (кадры из файлов создает кодек).
+    virtual Frame allocateFrame() const = 0;
+    // Читает следующий кадр в буфер frame. false — кадров больше нет или
+    // ошибка; тогда в error сообщение, а в конце потока он пуст.
+    virtual bool readFrame(Frame &frame, QString &error) = 0;
+};
+
+// Куда пишутся кадры, по порядку.
+class FrameSink {
+public:
+    virtual ~FrameSink() {}
+
+    virtual bool writeFrame(const Frame &frame, qint64 index, QString &error) = 0;
+};
+
+struct StreamOptions {
+    StreamOptions() : framesInFlight(3), workers(2), filterChroma(false) {}
+
+    FilterChain chain;
+    FilterOptions filterOptions;
+
+    // Сколько кадров одновременно между чтением и записью: столько буферов
+    // в пуле. Задержка кадра ограничена временем обработки этого числа
+    // кадров, а памяти нужно ровно на них.
+    int framesInFlight;
+    // Сколько кадров фильтруется одновременно; каждый еще делится на полосы.
+    int workers;
+    // Фильтровать и цветовые плоскости Y4M, а не только яркость. U и V
+    // хранятся со смещением 128, и ядро с нулевой суммой весов (Собель,
+    // выделение краев) свело бы их к нулю: кадр стал бы зеленым.
+    bool filterChroma;
+};
+
+struct StreamReport {
+    StreamReport() : frames(0), pixels(0), seconds(0.0), meanLatency(0.0), p50Latency(0.0),
+                     p99Latency(0.0), maxLatency(0.0) {}
+
+    qint64 frames;
+    qint64 pixels;
+    double seconds;
+    // Задержка кадра в миллисекундах: от конца чтения до конца записи.
+    double meanLatency;
+    double p50Latency;
+    double p99Latency;
+    double maxLatency;
+};
+
+// Читает кадры из source, фильтрует и пишет в sink в исходном порядке.
+// Чтение, фильтр и запись идут одновременно на разных кадрах; буферы
+// кадров берутся из пула и после записи возвращаются в него, так что
+// кадр не выделяет память (если ее не выделяет сам фильтр). Возвращает
+// false при ошибке чтения или записи.
+bool runFrameStream(FrameSource &source, FrameSink &sink, const StreamOptions &options,
+                    StreamReport &report, QString &error);
+
+// Запущена ли программа в потоковом режиме (ключ --stream).
+bool isStreamInvocation(int argc, char *argv[]);
+
+// Разбирает командную строку потокового режима, обрабатывает кадры и
+// печатает отчет в stderr (stdout занят кадрами). Возвращает код
+// завершения процесса.
+int runStreamCommand(const QStringList &arguments);
+
+#endif
@@ -0,0 +1,66 @@
+#include "histogramwidget.h"
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+
+HistogramWidget::HistogramWidget(QWidget *parent)
+    : QWidget(parent), hasStats(false) {
+    setMinimumHeight(100);
+}
+
+void HistogramWidget::setStats(const ImageStats &stats) {
+    this->stats = stats;
+    hasStats = stats.pixelCount > 0;
+    update();
+}
+
+void HistogramWidget::clear() {
+    hasStats = false;
+    update();
+}
+
+QSize HistogramWidget::sizeHint() const {
+    return QSize(256, 120);
+}
+
+void HistogramWidget::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(0xf0, 0xf0, 0xf0));
+    if (!hasStats) {
+        return;
+    }
+
+    // Масштаб по крайним значениям 0 и 255 не берется: у обрезанных
+    // после фильтра каналов там пик, который сплющил бы остальное.
+    qint64 peak = 1;
+    for (int channel = 0; channel < StatsChannelCount; ++channel) {
+        for (int value = 1; value < 255; ++value) {
+            peak = std::max(peak, stats.histograms[channel][value]);
+        }
+    }
+
+    const QColor colors[StatsChannelCount] = {
+        QColor(220, 40, 40, 90), QColor(40, 170, 40, 90), QColor(40, 80, 220, 90), QColor(60, 60, 60)
+    };
+    const double w = width();
+    const double h = height();
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    for (int channel = 0; channel < StatsChannelCount; ++channel) {
+        QPainterPath path;
+        path.moveTo(0, h);
+        for (int value = 0; value < 256; ++value) {
+            double level = std::min(1.0, static_cast<double>(stats.histograms[channel][value]) / peak);
+            path.lineTo(value * w / 255.0, h - level * (h - 1));
+        }
+        path.lineTo(w, h);
+        if (channel == StatsBrightness) {
+            painter.setPen(colors[channel]);
+            painter.setBrush(Qt::NoBrush);
+        } else {
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(colors[channel]);
+        }
+        painter.drawPath(path);
+    }
+}
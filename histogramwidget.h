@@ -0,0 +1,27 @@
+#ifndef HISTOGRAMWIDGET_H
+#define HISTOGRAMWIDGET_H
+
+#include <QWidget>
+#include "imagestats.h"
+
+// Гистограммы каналов R, G, B и яркости из ImageStats.
+class HistogramWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit HistogramWidget(QWidget *parent = nullptr);
+
+    void setStats(const ImageStats &stats);
+    void clear();
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    ImageStats stats;
+    bool hasStats;
+};
+
+#endif
@@ -1,7 +1,8 @@
 #include "imageinfowidget.h"
+#include "jobscheduler.h"
+#include "trace.h"
 #include <QFormLayout>
-#include <QSet>
-#include <QRgb>
+#include <QFutureWatcher>
 
 ImageInfoWidget::ImageInfoWidget(QWidget *parent)
     : QWidget(parent) {
@@ -9,6 +10,7 @@ ImageInfoWidget::ImageInfoWidget(QWidget *parent)
 }
 
 ImageInfoWidget::~ImageInfoWidget() {
+    cancelStats();
 }
 
 void ImageInfoWidget::setupUI() {
@@ -40,8 +42,14 @@ void ImageInfoWidget::setupUI() {
     colorLayout->addRow("Средний цвет:", avgColorLabel);
     colorLayout->addRow("Средняя яркость:", brightnessLabel);
 
+    histogramGroup = new QGroupBox("Гистограмма", this);
+    QVBoxLayout *histogramLayout = new QVBoxLayout(histogramGroup);
+    histogramWidget = new HistogramWidget(this);
+    histogramLayout->addWidget(histogramWidget);
+
     mainLayout->addWidget(basicInfoGroup);
     mainLayout->addWidget(colorInfoGroup);
+    mainLayout->addWidget(histogramGroup);
     mainLayout->addStretch();
 
     setLayout(mainLayout);
@@ -53,9 +61,21 @@ void ImageInfoWidget::setImage(const QImage &image) {
         return;
     }
     updateInfo(image);
+    startStats(image);
+}
+
+void ImageInfoWidget::setImage(const QImage &image, const ImageStats &stats) {
+    if (image.isNull()) {
+        clear();
+        return;
+    }
+    updateInfo(image);
+    cancelStats();
+    showStats(stats);
 }
 
 void ImageInfoWidget::clear() {
+    cancelStats();
     widthLabel->setText("—");
     heightLabel->setText("—");
     formatLabel->setText("—");
@@ -64,9 +84,12 @@ void ImageInfoWidget::clear() {
     colorCountLabel->setText("—");
     avgColorLabel->setText("—");
     brightnessLabel->setText("—");
+    avgColorLabel->setStyleSheet(QString());
+    histogramWidget->clear();
 }
 
 void ImageInfoWidget::updateInfo(const QImage &image) {
+    TraceScope scope("updateInfo");
     widthLabel->setText(QString::number(image.width()) + " px");
     heightLabel->setText(QString::number(image.height()) + " px");
 
@@ -84,50 +107,60 @@ void ImageInfoWidget::updateInfo(const QImage &image) {
 
     qint64 bytes = static_cast<qint64>(image.sizeInBytes());
     sizeLabel->setText(formatSize(bytes));
+}
+
+void ImageInfoWidget::startStats(const QImage &image) {
+    cancelStats();
+    colorCountLabel->setText("вычисляется…");
+    avgColorLabel->setText("—");
+    avgColorLabel->setStyleSheet(QString());
+    brightnessLabel->setText("—");
+
+    std::shared_ptr<CancelFlag> cancel = std::make_shared<CancelFlag>(false);
+    statsCancel = cancel;
 
-    if (image.width() * image.height() < 1000000) {
-        QSet<QRgb> uniqueColors;
-        qint64 sumR = 0, sumG = 0, sumB = 0;
-        qint64 sumBrightness = 0;
-        int pixelCount = 0;
-
-        for (int y = 0; y < image.height(); ++y) {
-            for (int x = 0; x < image.width(); ++x) {
-                QRgb pixel = image.pixel(x, y);
-                uniqueColors.insert(pixel);
-
-                int r = qRed(pixel);
-                int g = qGreen(pixel);
-                int b = qBlue(pixel);
-
-                sumR += r;
-                sumG += g;
-                sumB += b;
-                sumBrightness += (r + g + b) / 3;
-                pixelCount++;
-            }
+    QFutureWatcher<ImageStats> *watcher = new QFutureWatcher<ImageStats>(this);
+    connect(watcher, &QFutureWatcher<ImageStats>::finished, this, [this, watcher, cancel](){
+        if (!*cancel) {
+            showStats(watcher->result());
         }
+        if (statsCancel == cancel) {
+            statsCancel.reset();
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(scheduleJob(JobBackground, QString(), cancel, [image, cancel](){
+        ImageStats stats;
+        computeImageStats(image, stats, cancel.get());
+        return stats;
+    }));
+}
 
-        colorCountLabel->setText(QString::number(uniqueColors.size()));
+void ImageInfoWidget::showStats(const ImageStats &stats) {
+    TraceScope scope("showStats");
+    colorCountLabel->setText(QString::number(stats.uniqueColors));
 
-        if (pixelCount > 0) {
-            int avgR = static_cast<int>(sumR / pixelCount);
-            int avgG = static_cast<int>(sumG / pixelCount);
-            int avgB = static_cast<int>(sumB / pixelCount);
+    if (stats.pixelCount > 0) {
+        int avgR = static_cast<int>(stats.mean(StatsRed));
+        int avgG = static_cast<int>(stats.mean(StatsGreen));
+        int avgB = static_cast<int>(stats.mean(StatsBlue));
 
-            QString colorText = QString("RGB(%1, %2, %3)").arg(avgR).arg(avgG).arg(avgB);
-            QString colorStyle = QString("QLabel { background-color: rgb(%1, %2, %3); padding: 3px; }")
-                                     .arg(avgR).arg(avgG).arg(avgB);
-            avgColorLabel->setText(colorText);
-            avgColorLabel->setStyleSheet(colorStyle);
+        QString colorText = QString("RGB(%1, %2, %3)").arg(avgR).arg(avgG).arg(avgB);
+        QString colorStyle = QString("QLabel { background-color: rgb(%1, %2, %3); padding: 3px; }")
+                                 .arg(avgR).arg(avgG).arg(avgB);
+        avgColorLabel->setText(colorText);
+        avgColorLabel->setStyleSheet(colorStyle);
 
-            int avgBright = static_cast<int>(sumBrightness / pixelCount);
-            brightnessLabel->setText(QString::number(avgBright) + " / 255");
-        }
-    } else {
-        colorCountLabel->setText("(слишком большое изображение)");
-        avgColorLabel->setText("—");
-        brightnessLabel->setText("—");
+        int avgBright = static_cast<int>(stats.mean(StatsBrightness));
+        brightnessLabel->setText(QString::number(avgBright) + " / 255");
+    }
+    histogramWidget->setStats(stats);
+}
+
+void ImageInfoWidget::cancelStats() {
+    if (statsCancel) {
+        *statsCancel = true;
+        statsCancel.reset();
     }
 }
 
@@ -6,6 +6,9 @@
 #include <QVBoxLayout>
 #include <QImage>
 #include <QGroupBox>
+#include <memory>
+#include "histogramwidget.h"
+#include "imagestats.h"
 
 class ImageInfoWidget : public QWidget {
     Q_OBJECT
@@ -15,17 +18,24 @@ public:
     ~ImageInfoWidget();
 
     void setImage(const QImage &image);
+    // Статистика уже известна (собрана фильтром при записи image),
+    // отдельный подсчет не запускается.
+    void setImage(const QImage &image, const ImageStats &stats);
 
     void clear();
 
 private:
     void setupUI();
     void updateInfo(const QImage &image);
+    void startStats(const QImage &image);
+    void showStats(const ImageStats &stats);
+    void cancelStats();
     QString formatSize(qint64 bytes);
 
     QVBoxLayout *mainLayout;
     QGroupBox *basicInfoGroup;
     QGroupBox *colorInfoGroup;
+    QGroupBox *histogramGroup;
 
     QLabel *widthLabel;
     QLabel *heightLabel;
@@ -35,6 +45,11 @@ private:
     QLabel *colorCountLabel;
     QLabel *avgColorLabel;
     QLabel *brightnessLabel;
+    HistogramWidget *histogramWidget;
+
+    // Статистика считается в фоне; новое изображение отменяет подсчет
+    // для предыдущего.
+    std::shared_ptr<CancelFlag> statsCancel;
 };
 
 #endif
@@ -0,0 +1,204 @@
+#include "imageio.h"
+#include "trace.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <climits>
+#include <memory>
+
+namespace {
+
+void setError(QString *error, const QString &message) {
+    if (error != nullptr) {
+        *error = message;
+    }
+}
+
+bool isPnmFile(const QString &fileName) {
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "pgm" || suffix == "ppm" || suffix == "pnm";
+}
+
+// Разбор заголовка PNM в отображенных данных, как в PpmReader: пробелы и
+// комментарии между полями, после последнего поля ровно один пробельный
+// символ.
+class PnmHeader {
+public:
+    PnmHeader(const uchar *data, qint64 size) : data(data), size(size), pos(0) {}
+
+    bool parse(int &channels, int &width, int &height, qint64 &offset) {
+        if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+            return false;
+        }
+        channels = data[1] == '5' ? 1 : 3;
+        pos = 2;
+        int maxValue = 0;
+        if (!readValue(width) || !readValue(height) || !readValue(maxValue)) {
+            return false;
+        }
+        offset = pos;
+        return width > 0 && height > 0 && maxValue == 255;
+    }
+
+private:
+    static bool isSpace(uchar c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    bool readValue(int &value) {
+        while (pos < size && (isSpace(data[pos]) || data[pos] == '#')) {
+            if (data[pos] == '#') {
+                while (pos < size && data[pos] != '\n') {
+                    ++pos;
+                }
+            } else {
+                ++pos;
+            }
+        }
+        value = 0;
+        qint64 start = pos;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+            if (value > (1 << 24)) {
+                return false;
+            }
+            value = value * 10 + (data[pos] - '0');
+            ++pos;
+        }
+        if (pos == start || pos >= size || !isSpace(data[pos])) {
+            return false;
+        }
+        ++pos;
+        return true;
+    }
+
+    const uchar *data;
+    qint64 size;
+    qint64 pos;
+};
+
+// Файл живет, пока живет изображение поверх его отображения.
+struct MappedFile {
+    QFile file;
+    uchar *data;
+};
+
+void unmapFile(void *info) {
+    MappedFile *mapped = static_cast<MappedFile *>(info);
+    mapped->file.unmap(mapped->data);
+    delete mapped;
+}
+
+}
+
+QImage mapPnmFile(const QString &fileName, QString *error) {
+    TraceScope scope("mapPnmFile");
+    std::unique_ptr<MappedFile> mapped(new MappedFile);
+    mapped->file.setFileName(fileName);
+    if (!mapped->file.open(QIODevice::ReadOnly)) {
+        setError(error, "Не удалось открыть " + fileName);
+        return QImage();
+    }
+    const qint64 size = mapped->file.size();
+    mapped->data = mapped->file.map(0, size, QFileDevice::MapPrivateOption);
+    if (mapped->data == nullptr) {
+        setError(error, "Не удалось отобразить в память " + fileName);
+        return QImage();
+    }
+
+    int channels = 0, width = 0, height = 0;
+    qint64 offset = 0;
+    if (!PnmHeader(mapped->data, size).parse(channels, width, height, offset)) {
+        mapped->file.unmap(mapped->data);
+        setError(error, "Файл " + fileName + " не является двоичным PGM/PPM с 8 битами на канал.");
+        return QImage();
+    }
+    const qint64 rowBytes = static_cast<qint64>(width) * channels;
+    if (rowBytes > INT_MAX || offset + rowBytes * height > size) {
+        mapped->file.unmap(mapped->data);
+        setError(error, "Файл " + fileName + " обрезан.");
+        return QImage();
+    }
+
+    uchar *bits = mapped->data + offset;
+    QImage image(bits, width, height, static_cast<int>(rowBytes),
+                 channels == 1 ? QImage::Format_Grayscale8 : QImage::Format_RGB888,
+                 unmapFile, mapped.get());
+    if (image.isNull()) {
+        mapped->file.unmap(mapped->data);
+        setError(error, "Не удалось прочитать " + fileName);
+        return QImage();
+    }
+    mapped.release();
+    scope.setWork(static_cast<qint64>(width) * height, rowBytes * height);
+    return image;
+}
+
+namespace {
+
+// Чтение кодеком Qt: 16-битные и текстовые PNM и все прочие форматы.
+QImage decodeImageFile(const QString &fileName, QString *error) {
+    TraceScope scope("decode");
+    QImageReader reader(fileName);
+    QImage image = reader.read();
+    if (image.isNull()) {
+        setError(error, "Не удалось прочитать " + fileName + ": " + reader.errorString());
+        return image;
+    }
+    scope.setWork(static_cast<qint64>(image.width()) * image.height(), image.sizeInBytes());
+    return image;
+}
+
+}
+
+QImage readImageFile(const QString &fileName, QString *error) {
+    if (isPnmFile(fileName)) {
+        QImage image = mapPnmFile(fileName);
+        if (!image.isNull()) {
+            return image;
+        }
+    }
+    return decodeImageFile(fileName, error);
+}
+
+QImage readImageCopy(const QString &fileName, QString *error) {
+    if (isPnmFile(fileName)) {
+        QImage mapped = mapPnmFile(fileName);
+        if (!mapped.isNull()) {
+            TraceScope scope("copyMapped", static_cast<qint64>(mapped.width()) * mapped.height(),
+                             mapped.sizeInBytes());
+            return mapped.copy();
+        }
+    }
+    return decodeImageFile(fileName, error);
+}
+
+QImage readImagePreview(const QString &fileName, const QSize &maxSize, QSize *fullSize) {
+    QImageReader reader(fileName);
+    const QSize size = reader.size();
+    if (fullSize != nullptr) {
+        *fullSize = size;
+    }
+    // ScaledSize сообщают и кодеки, которые декодируют полный кадр и потом
+    // уменьшают его (PNG). Такой предпросмотр был бы вторым полным чтением
+    // рядом с основным, поэтому он берется только у JPEG.
+    if (reader.format() != "jpeg" || !size.isValid() || maxSize.isEmpty() ||
+        (size.width() <= maxSize.width() && size.height() <= maxSize.height())) {
+        return QImage();
+    }
+    TraceScope scope("decodePreview");
+    reader.setScaledSize(size.scaled(maxSize, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    scope.setWork(static_cast<qint64>(image.width()) * image.height(), image.sizeInBytes());
+    return image;
+}
+
+bool writeImageFile(const QImage &image, const QString &fileName, QString *error) {
+    TraceScope scope("encode", static_cast<qint64>(image.width()) * image.height(), image.sizeInBytes());
+    QImageWriter writer(fileName);
+    if (!writer.write(image)) {
+        setError(error, "Не удалось сохранить " + fileName + ": " + writer.errorString());
+        return false;
+    }
+    return true;
+}
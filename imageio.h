@@ -0,0 +1,41 @@
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+// Чтение и запись файлов изображений. Функции не трогают интерфейс и
+// вызываются из фоновых потоков.
+
+// Двоичный PGM (P5) или PPM (P6) с 8 битами на канал без копирования:
+// файл отображается в память, и строки изображения Format_Grayscale8 или
+// Format_RGB888 указывают прямо в отображение. Страницы подгружаются по
+// мере обращения, так что фильтр начинает работу с первыми строками, пока
+// остальные еще на диске. Отображение частное: запись в изображение файл
+// не меняет. Но если файл усекут или перепишут, пока изображение живо
+// (в том числе сохранением поверх него), чтение пикселей завершит процесс
+// по SIGBUS, поэтому отображение годится только для изображений, которые
+// живут недолго, — в пакетном и потоковом режимах. Для других файлов
+// возвращает пустое изображение.
+QImage mapPnmFile(const QString &fileName, QString *error = nullptr);
+
+// Полное чтение: PGM/PPM через mapPnmFile, если получится, остальное —
+// кодеками Qt.
+QImage readImageFile(const QString &fileName, QString *error = nullptr);
+// То же, но PGM/PPM копируется из отображения в собственный буфер:
+// изображение не зависит от файла. Для интерфейса, где изображение живет
+// сколько угодно и может быть сохранено поверх своего файла.
+QImage readImageCopy(const QString &fileName, QString *error = nullptr);
+
+// Уменьшенная копия, вписанная в maxSize, если файл — JPEG (он
+// декодируется сразу в меньшем размере по коэффициентам DCT, в разы
+// быстрее полного чтения), а изображение больше maxSize. Иначе пустое
+// изображение: остальные кодеки, в том числе PNG, уменьшают уже полный
+// кадр, и предпросмотр был бы не дешевле полного чтения. В fullSize, если
+// задан, записывается размер изображения в файле.
+QImage readImagePreview(const QString &fileName, const QSize &maxSize, QSize *fullSize = nullptr);
+
+bool writeImageFile(const QImage &image, const QString &fileName, QString *error = nullptr);
+
+#endif
@@ -0,0 +1,138 @@
+#include "imagestats.h"
+#include "trace.h"
+#include <QRgb>
+#include <QtGlobal>
+#include <cstring>
+
+namespace {
+
+const int COLOR_WORDS = (1 << 24) / 64;
+
+// Биты r, g и b, разнесенные через два: номер цвета в карте — код Мортона,
+// так что близкие цвета (куб 8x8x8 на строку кэша) лежат рядом, и карта
+// в 2 МБ читается почти без промахов.
+struct MortonTable {
+    MortonTable() {
+        for (int v = 0; v < 256; ++v) {
+            quint32 spread = 0;
+            for (int bit = 0; bit < 8; ++bit) {
+                spread |= static_cast<quint32>((v >> bit) & 1) << (3 * bit);
+            }
+            values[v] = spread;
+        }
+    }
+    quint32 values[256];
+};
+
+const MortonTable MORTON;
+
+// Большинство пикселей повторяет уже встреченный цвет, и для них хватает
+// чтения слова; запись нужна не чаще одного раза на цвет.
+inline void markColor(std::atomic<quint64> *colorBits, int r, int g, int b) {
+    quint32 color = MORTON.values[r] << 2 | MORTON.values[g] << 1 | MORTON.values[b];
+    std::atomic<quint64> &word = colorBits[color >> 6];
+    quint64 mask = quint64(1) << (color & 63);
+    if ((word.load(std::memory_order_relaxed) & mask) == 0) {
+        word.fetch_or(mask, std::memory_order_relaxed);
+    }
+}
+
+}
+
+ImageStats::ImageStats() : pixelCount(0), uniqueColors(0) {
+    std::memset(histograms, 0, sizeof(histograms));
+}
+
+double ImageStats::mean(StatsChannel channel) const {
+    if (pixelCount == 0) {
+        return 0.0;
+    }
+    qint64 sum = 0;
+    for (int value = 0; value < 256; ++value) {
+        sum += histograms[channel][value] * value;
+    }
+    return static_cast<double>(sum) / pixelCount;
+}
+
+StatsCollector::StatsCollector() : colorBits(new std::atomic<quint64>[COLOR_WORDS]()) {
+    std::memset(histograms, 0, sizeof(histograms));
+}
+
+StatsCollector::Band::Band(StatsCollector *owner) : owner(owner) {
+    if (owner != nullptr) {
+        std::memset(histograms, 0, sizeof(histograms));
+    }
+}
+
+StatsCollector::Band::~Band() {
+    if (owner == nullptr) {
+        return;
+    }
+    QMutexLocker locker(&owner->mutex);
+    for (int channel = 0; channel < StatsChannelCount; ++channel) {
+        for (int value = 0; value < 256; ++value) {
+            owner->histograms[channel][value] += histograms[channel][value];
+        }
+    }
+}
+
+void StatsCollector::Band::addRow(const QRgb *row, int count) {
+    if (owner == nullptr) {
+        return;
+    }
+    std::atomic<quint64> *colorBits = owner->colorBits.get();
+    for (int x = 0; x < count; ++x) {
+        QRgb pixel = row[x];
+        int r = qRed(pixel);
+        int g = qGreen(pixel);
+        int b = qBlue(pixel);
+        ++histograms[StatsRed][r];
+        ++histograms[StatsGreen][g];
+        ++histograms[StatsBlue][b];
+        ++histograms[StatsBrightness][(r + g + b) / 3];
+        markColor(colorBits, r, g, b);
+    }
+}
+
+void StatsCollector::finish(ImageStats &stats) const {
+    stats = ImageStats();
+    QMutexLocker locker(&mutex);
+    std::memcpy(stats.histograms, histograms, sizeof(histograms));
+    for (int value = 0; value < 256; ++value) {
+        stats.pixelCount += histograms[StatsRed][value];
+    }
+    for (int i = 0; i < COLOR_WORDS; ++i) {
+        stats.uniqueColors += qPopulationCount(static_cast<quint64>(colorBits[i].load(std::memory_order_relaxed)));
+    }
+}
+
+bool computeImageStats(const QImage &image, ImageStats &stats, const CancelFlag *cancel) {
+    stats = ImageStats();
+    if (image.isNull()) {
+        return true;
+    }
+
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    TraceScope scope("computeImageStats", pixels, image.sizeInBytes());
+    QImage source = image;
+    if (source.format() != QImage::Format_RGB32 && source.format() != QImage::Format_ARGB32) {
+        source = source.convertToFormat(source.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    }
+    const int width = source.width();
+    const uchar *bits = source.constBits();
+    const int stride = source.bytesPerLine();
+
+    StatsCollector collector;
+    parallelForRows(source.height(), 64, [&](int y0, int y1) {
+        StatsCollector::Band band(&collector);
+        for (int y = y0; y < y1 && !isCancelled(cancel); ++y) {
+            band.addRow(reinterpret_cast<const QRgb *>(bits + static_cast<size_t>(y) * stride), width);
+        }
+    });
+
+    if (isCancelled(cancel)) {
+        return false;
+    }
+    collector.finish(stats);
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef IMAGESTATS_H
+#define IMAGESTATS_H
+
+#include "parallel.h"
+#include <QImage>
+#include <QMutex>
+#include <atomic>
+#include <memory>
+
+// Каналы гистограмм ImageStats. Яркость пикселя — (r + g + b) / 3
+// с округлением вниз.
+enum StatsChannel {
+    StatsRed,
+    StatsGreen,
+    StatsBlue,
+    StatsBrightness,
+    StatsChannelCount
+};
+
+struct ImageStats {
+    ImageStats();
+
+    // Среднее значение канала по гистограмме.
+    double mean(StatsChannel channel) const;
+
+    qint64 pixelCount;
+    // Число различных цветов RGB, альфа не учитывается.
+    qint64 uniqueColors;
+    // histograms[channel][value] — число пикселей с таким значением канала.
+    qint64 histograms[StatsChannelCount][256];
+};
+
+// Накопитель статистики по строкам пикселей Format_RGB32/ARGB32.
+// Различные цвета отмечаются в общей битовой карте на 2^24 бит, а
+// гистограммы каждая полоса копит в своем Band и сливает в общие при
+// его уничтожении. Фильтры добавляют строки результата сразу после
+// записи, пока те в кэше, и отдельный проход по изображению не нужен.
+class StatsCollector {
+public:
+    StatsCollector();
+
+    class Band {
+    public:
+        // owner == nullptr — статистика не нужна, addRow ничего не делает.
+        explicit Band(StatsCollector *owner);
+        ~Band();
+
+        void addRow(const QRgb *row, int count);
+
+    private:
+        Band(const Band &);
+        Band &operator=(const Band &);
+
+        StatsCollector *owner;
+        qint64 histograms[StatsChannelCount][256];
+    };
+
+    // Итог по всем строкам, добавленным к этому моменту.
+    void finish(ImageStats &stats) const;
+
+private:
+    std::unique_ptr<std::atomic<quint64>[]> colorBits;
+    mutable QMutex mutex;
+    qint64 histograms[StatsChannelCount][256];
+};
+
+// Считает статистику за один параллельный проход по изображению.
+// Возвращает false, если подсчет отменен через cancel.
+bool computeImageStats(const QImage &image, ImageStats &stats, const CancelFlag *cancel = nullptr);
+
+#endif
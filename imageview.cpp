@@ -0,0 +1,327 @@
+#include "imageview.h"
+#include "jobscheduler.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QFutureWatcher>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace {
+
+// Уменьшать дальше нет смысла: такой уровень целиком меньше окна.
+const int MIN_LEVEL_SIZE = 64;
+const double MAX_ZOOM = 32.0;
+// Шаг масштаба на одно деление колеса.
+const double WHEEL_ZOOM_STEP = 1.25;
+
+bool isNativeFormat(QImage::Format format) {
+    return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32
+           || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+int levelCount(const QSize &size) {
+    int count = 1;
+    while ((std::max(size.width(), size.height()) >> count) >= MIN_LEVEL_SIZE) {
+        ++count;
+    }
+    return count;
+}
+
+// Уровень level пирамиды: source, уменьшенное в 2^level раз усреднением
+// блоков 2^level x 2^level. Уровень строится прямо из source, а не из
+// предыдущего, чтобы после смены изображения хватало одного прохода по
+// нему для уровня, который на экране. Остаток у правого и нижнего края
+// входит в последний столбец и последнюю строку.
+QImage buildLevel(const QImage &source, int level, const CancelFlag *cancel) {
+    TraceScope scope("display level", static_cast<qint64>(source.width()) * source.height());
+    QImage base = source;
+    if (!isNativeFormat(base.format())) {
+        base = base.convertToFormat(base.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                           : QImage::Format_RGB32);
+    }
+    if (level == 0) {
+        return base;
+    }
+
+    const int width = base.width();
+    const int height = base.height();
+    const int outWidth = std::max(1, width >> level);
+    const int outHeight = std::max(1, height >> level);
+    QImage result(outWidth, outHeight, base.format());
+    const uchar *srcBits = base.constBits();
+    const int srcStride = base.bytesPerLine();
+    uchar *dstBits = result.bits();
+    const int dstStride = result.bytesPerLine();
+
+    parallelForRows(outHeight, 1, [&](int y0, int y1) {
+        std::vector<quint64> sums(static_cast<size_t>(outWidth) * 4);
+        for (int y = y0; y < y1 && !isCancelled(cancel); ++y) {
+            const int top = y << level;
+            const int bottom = y == outHeight - 1 ? height : std::min(height, top + (1 << level));
+            std::fill(sums.begin(), sums.end(), 0);
+            for (int sy = top; sy < bottom; ++sy) {
+                const QRgb *row = reinterpret_cast<const QRgb *>(srcBits + static_cast<size_t>(sy) * srcStride);
+                for (int x = 0; x < width; ++x) {
+                    quint64 *sum = &sums[static_cast<size_t>(std::min(x >> level, outWidth - 1)) * 4];
+                    sum[0] += qRed(row[x]);
+                    sum[1] += qGreen(row[x]);
+                    sum[2] += qBlue(row[x]);
+                    sum[3] += qAlpha(row[x]);
+                }
+            }
+            QRgb *out = reinterpret_cast<QRgb *>(dstBits + static_cast<size_t>(y) * dstStride);
+            for (int x = 0; x < outWidth; ++x) {
+                const int left = x << level;
+                const int right = x == outWidth - 1 ? width : std::min(width, left + (1 << level));
+                const quint64 count = static_cast<quint64>(right - left) * (bottom - top);
+                const quint64 *sum = &sums[static_cast<size_t>(x) * 4];
+                out[x] = qRgba(static_cast<int>((sum[0] + count / 2) / count),
+                               static_cast<int>((sum[1] + count / 2) / count),
+                               static_cast<int>((sum[2] + count / 2) / count),
+                               static_cast<int>((sum[3] + count / 2) / count));
+            }
+        }
+    });
+    return isCancelled(cancel) ? QImage() : result;
+}
+
+}
+
+ImageView::ImageView(QWidget *parent)
+    : QWidget(parent), generation(0), cancel(std::make_shared<CancelFlag>(false)), viewZoom(1.0), fit(true),
+      dragging(false) {
+    setCursor(Qt::OpenHandCursor);
+    setToolTip("Колесо мыши — масштаб, перетаскивание — сдвиг, двойной щелчок — по размеру окна или 1:1.");
+}
+
+void ImageView::setImage(const QImage &newImage, const QSize &newFullSize) {
+    const QSize size = newFullSize.isValid() ? newFullSize : newImage.size();
+    if (newImage.cacheKey() == image.cacheKey() && size == fullSize) {
+        return;
+    }
+
+    *cancel = true;
+    cancel = std::make_shared<CancelFlag>(false);
+    ++generation;
+    if (size != fullSize) {
+        fit = true;
+    }
+    image = newImage;
+    fullSize = size;
+    const int count = image.isNull() ? 0 : levelCount(image.size());
+    levels.assign(count, QImage());
+    pending.assign(count, false);
+    if (count > 0 && isNativeFormat(image.format())) {
+        levels[0] = image;
+    }
+
+    if (fit) {
+        viewZoom = fitZoom();
+        viewCenter = QPointF(fullSize.width() / 2.0, fullSize.height() / 2.0);
+    }
+    clampCenter();
+    if (count > 0) {
+        requestLevel(wantedLevel());
+    }
+    update();
+}
+
+void ImageView::clear() {
+    setImage(QImage());
+}
+
+QSize ImageView::sizeHint() const {
+    return QSize(400, 400);
+}
+
+void ImageView::setView(double zoom, const QPointF &center, bool fitsWindow) {
+    fit = fitsWindow;
+    viewZoom = fit ? fitZoom() : zoom;
+    viewCenter = center;
+    clampCenter();
+    if (!levels.empty()) {
+        requestLevel(wantedLevel());
+    }
+    update();
+}
+
+void ImageView::fitToWindow() {
+    setView(fitZoom(), QPointF(fullSize.width() / 2.0, fullSize.height() / 2.0), true);
+    emit viewChanged();
+}
+
+double ImageView::fitZoom() const {
+    if (fullSize.isEmpty()) {
+        return 1.0;
+    }
+    return std::min(static_cast<double>(width()) / fullSize.width(),
+                    static_cast<double>(height()) / fullSize.height());
+}
+
+void ImageView::setZoomAround(double zoom, const QPointF &widgetPoint) {
+    if (fullSize.isEmpty()) {
+        return;
+    }
+    const QPointF offset = widgetPoint - QPointF(width() / 2.0, height() / 2.0);
+    const QPointF imagePoint = viewCenter + offset / viewZoom;
+    viewZoom = std::max(std::min(fitZoom(), 1.0), std::min(MAX_ZOOM, zoom));
+    viewCenter = imagePoint - offset / viewZoom;
+    fit = false;
+    clampCenter();
+    requestLevel(wantedLevel());
+    update();
+    emit viewChanged();
+}
+
+// Точка в центре окна остается над изображением; по оси, где оно меньше
+// окна, изображение стоит посередине.
+void ImageView::clampCenter() {
+    const double halfWidth = width() / (2.0 * viewZoom);
+    const double halfHeight = height() / (2.0 * viewZoom);
+    if (fullSize.width() <= 2.0 * halfWidth) {
+        viewCenter.setX(fullSize.width() / 2.0);
+    } else {
+        viewCenter.setX(std::max(halfWidth, std::min(fullSize.width() - halfWidth, viewCenter.x())));
+    }
+    if (fullSize.height() <= 2.0 * halfHeight) {
+        viewCenter.setY(fullSize.height() / 2.0);
+    } else {
+        viewCenter.setY(std::max(halfHeight, std::min(fullSize.height() - halfHeight, viewCenter.y())));
+    }
+}
+
+// Самый мелкий уровень, в котором на экранный пиксель приходится не
+// меньше пикселя уровня.
+int ImageView::wantedLevel() const {
+    const double imageZoom = viewZoom * fullSize.width() / image.width();
+    if (imageZoom >= 1.0) {
+        return 0;
+    }
+    int level = static_cast<int>(std::floor(std::log2(1.0 / imageZoom) + 1e-9));
+    return std::min(level, static_cast<int>(levels.size()) - 1);
+}
+
+void ImageView::requestLevel(int level) {
+    if (!levels[level].isNull() || pending[level]) {
+        return;
+    }
+    pending[level] = true;
+
+    const quint64 requestGeneration = generation;
+    const QImage source = image;
+    const std::shared_ptr<CancelFlag> requestCancel = cancel;
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, requestGeneration, level]() {
+        if (requestGeneration == generation) {
+            levels[level] = watcher->result();
+            pending[level] = false;
+            update();
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(scheduleJob(JobInteractive, QString(), requestCancel, [source, level, requestCancel]() {
+        return buildLevel(source, level, requestCancel.get());
+    }));
+}
+
+void ImageView::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(0xf0, 0xf0, 0xf0));
+    if (!levels.empty()) {
+        // Пока нужный уровень строится, берется ближайший готовый более
+        // грубый (он дешев) или на один подробнее. Полное изображение или
+        // уровень еще подробнее QPainter уменьшал бы в потоке интерфейса, у
+        // 100 Мп с преобразованием формата — заметная пауза, поэтому до
+        // прихода уровня не рисуется ничего.
+        const int wanted = wantedLevel();
+        int level = -1;
+        for (int k = wanted; k < static_cast<int>(levels.size()) && level < 0; ++k) {
+            if (!levels[k].isNull()) {
+                level = k;
+            }
+        }
+        if (level < 0 && wanted > 0 && !levels[wanted - 1].isNull()) {
+            level = wanted - 1;
+        }
+
+        const QPointF halfView(width() / (2.0 * viewZoom), height() / (2.0 * viewZoom));
+        const QRectF visible = QRectF(viewCenter - halfView, viewCenter + halfView)
+                                   .intersected(QRectF(QPointF(0, 0), QSizeF(fullSize)));
+        if (level >= 0 && !visible.isEmpty()) {
+            const QImage &source = levels[level];
+            TraceScope scope("display paint", static_cast<qint64>(width()) * height());
+            const double sx = static_cast<double>(source.width()) / fullSize.width();
+            const double sy = static_cast<double>(source.height()) / fullSize.height();
+            const QRectF sourceRect(visible.x() * sx, visible.y() * sy, visible.width() * sx, visible.height() * sy);
+            const QPointF origin = QPointF(width() / 2.0, height() / 2.0) - viewCenter * viewZoom;
+            const QRectF target(origin + visible.topLeft() * viewZoom, visible.size() * viewZoom);
+            // При увеличении пиксели видны как есть; при уменьшении уровень
+            // отличается от экрана не больше чем вдвое (пока нужный строится —
+            // вчетверо), и хватает билинейной интерполяции.
+            painter.setRenderHint(QPainter::SmoothPixmapTransform, viewZoom < 1.0);
+            painter.drawImage(target, source, sourceRect);
+        }
+    }
+    painter.setPen(QColor(0xcc, 0xcc, 0xcc));
+    painter.drawRect(rect().adjusted(0, 0, -1, -1));
+}
+
+void ImageView::resizeEvent(QResizeEvent *) {
+    if (fit) {
+        viewZoom = fitZoom();
+    }
+    clampCenter();
+    if (!levels.empty()) {
+        requestLevel(wantedLevel());
+    }
+}
+
+void ImageView::wheelEvent(QWheelEvent *event) {
+    const double steps = event->angleDelta().y() / 120.0;
+    if (steps != 0.0) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        setZoomAround(viewZoom * std::pow(WHEEL_ZOOM_STEP, steps), event->position());
+#else
+        setZoomAround(viewZoom * std::pow(WHEEL_ZOOM_STEP, steps), event->posF());
+#endif
+    }
+    event->accept();
+}
+
+void ImageView::mousePressEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton) {
+        dragging = true;
+        dragStart = event->pos();
+        dragCenter = viewCenter;
+        setCursor(Qt::ClosedHandCursor);
+    }
+}
+
+void ImageView::mouseMoveEvent(QMouseEvent *event) {
+    if (!dragging || fullSize.isEmpty()) {
+        return;
+    }
+    viewCenter = dragCenter - QPointF(event->pos() - dragStart) / viewZoom;
+    clampCenter();
+    update();
+    emit viewChanged();
+}
+
+void ImageView::mouseReleaseEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton) {
+        dragging = false;
+        setCursor(Qt::OpenHandCursor);
+    }
+}
+
+void ImageView::mouseDoubleClickEvent(QMouseEvent *event) {
+    if (fit) {
+        setZoomAround(1.0, event->pos());
+    } else {
+        fitToWindow();
+    }
+}
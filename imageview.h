@@ -0,0 +1,88 @@
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+#include <QImage>
+#include <QPoint>
+#include <QPointF>
+#include <QWidget>
+#include <memory>
+#include <vector>
+#include "parallel.h"
+
+// Просмотр изображения с масштабом и сдвигом. Рисуется только видимая
+// часть, причем из уровня пирамиды (уменьшенной в 2^k раз копии), ближайшего
+// к текущему масштабу сверху, так что перерисовка не зависит от размера
+// изображения. Уровни строятся в фоне по мере надобности: после смены
+// изображения — только тот, что на экране; пока его нет, рисуется
+// ближайший готовый.
+//
+// Колесо мыши меняет масштаб вокруг курсора, перетаскивание сдвигает,
+// двойной щелчок переключает «по размеру окна» и 1:1.
+class ImageView : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit ImageView(QWidget *parent = nullptr);
+
+    // fullSize, если задан, — размер изображения, уменьшенной копией
+    // которого является image (предпросмотр): масштаб и сдвиг считаются в
+    // пикселях fullSize и при замене копии на полный результат не меняются.
+    // То же самое изображение (общие данные QImage) повторно не обрабатывается.
+    void setImage(const QImage &image, const QSize &fullSize = QSize());
+    void clear();
+
+    // Экранных пикселей на пиксель изображения и точка изображения в
+    // центре окна.
+    double zoom() const { return viewZoom; }
+    QPointF center() const { return viewCenter; }
+    bool fitsWindow() const { return fit; }
+
+    QSize sizeHint() const override;
+
+public slots:
+    // Для синхронизации с другим просмотром; viewChanged не посылает.
+    void setView(double zoom, const QPointF &center, bool fitsWindow);
+    void fitToWindow();
+
+signals:
+    // Масштаб или сдвиг изменил пользователь.
+    void viewChanged();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    double fitZoom() const;
+    void setZoomAround(double zoom, const QPointF &widgetPoint);
+    void clampCenter();
+    // Уровень пирамиды для текущего масштаба.
+    int wantedLevel() const;
+    void requestLevel(int level);
+
+    QImage image;
+    QSize fullSize;
+    // levels[k] — копия image, уменьшенная в 2^k раз; пустая, пока не
+    // построена. levels[0] — сам image в формате, который рисуется без
+    // преобразования.
+    std::vector<QImage> levels;
+    std::vector<bool> pending;
+    // Меняется с изображением, чтобы не принять уровень прежнего;
+    // построение уровней прежнего изображения отменяется.
+    quint64 generation;
+    std::shared_ptr<CancelFlag> cancel;
+
+    double viewZoom;
+    QPointF viewCenter;
+    bool fit;
+    bool dragging;
+    QPoint dragStart;
+    QPointF dragCenter;
+};
+
+#endif
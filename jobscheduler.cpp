@@ -0,0 +1,174 @@
+#include "jobscheduler.h"
+#include "trace.h"
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <deque>
+#include <vector>
+
+namespace {
+
+const int MAX_RUNNING_JOBS = 3;
+// Не интерактивные задачи занимают не больше стольких мест, так что одно
+// всегда остается интерактивным.
+const int MAX_RUNNING_NON_INTERACTIVE_JOBS = 2;
+// Фоновые — не больше стольких, так что одно место всегда остается
+// обработке: долгое сохранение не задерживает следующую.
+const int MAX_RUNNING_BACKGROUND_JOBS = 1;
+const int PRIORITY_COUNT = JobBackground + 1;
+
+struct Job {
+    JobPriority priority;
+    QString key;
+    std::shared_ptr<CancelFlag> cancel;
+    std::function<void(bool)> run;
+};
+
+class Scheduler {
+public:
+    Scheduler() : running(0), runningNonInteractive(0), runningBackground(0) {
+        pool.setMaxThreadCount(MAX_RUNNING_JOBS);
+    }
+
+    void submit(const Job &job);
+
+private:
+    class JobRunnable : public QRunnable {
+    public:
+        JobRunnable(Scheduler *scheduler, const Job &job) : scheduler(scheduler), job(job) {}
+        void run() override;
+
+    private:
+        Scheduler *scheduler;
+        Job job;
+    };
+
+    // Вызывается под mutex.
+    void startReadyJobs();
+    void finished(const Job &job);
+
+    QMutex mutex;
+    QThreadPool pool;
+    std::deque<Job> queues[PRIORITY_COUNT];
+    std::vector<Job> active;
+    int running;
+    int runningNonInteractive;
+    int runningBackground;
+};
+
+Scheduler &scheduler() {
+    static Scheduler instance;
+    return instance;
+}
+
+void Scheduler::submit(const Job &job) {
+    std::vector<Job> dropped;
+    {
+        QMutexLocker locker(&mutex);
+        if (!job.key.isEmpty()) {
+            for (std::deque<Job> &queue : queues) {
+                for (auto it = queue.begin(); it != queue.end();) {
+                    if (it->key == job.key) {
+                        dropped.push_back(*it);
+                        it = queue.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            for (const Job &other : active) {
+                if (other.key == job.key && other.cancel) {
+                    *other.cancel = true;
+                }
+            }
+        }
+        queues[job.priority].push_back(job);
+        startReadyJobs();
+    }
+
+    // Выброшенные задачи завершаются вне блокировки: run может снова
+    // обратиться к планировщику.
+    for (const Job &other : dropped) {
+        if (other.cancel) {
+            *other.cancel = true;
+        }
+        other.run(false);
+    }
+}
+
+void Scheduler::startReadyJobs() {
+    while (running < MAX_RUNNING_JOBS) {
+        int priority = -1;
+        for (int p = 0; p < PRIORITY_COUNT && priority < 0; ++p) {
+            bool allowed = p == JobInteractive || runningNonInteractive < MAX_RUNNING_NON_INTERACTIVE_JOBS;
+            if (p == JobBackground) {
+                allowed = allowed && runningBackground < MAX_RUNNING_BACKGROUND_JOBS;
+            }
+            if (!queues[p].empty() && allowed) {
+                priority = p;
+            }
+        }
+        if (priority < 0) {
+            return;
+        }
+        Job job = queues[priority].front();
+        queues[priority].pop_front();
+        ++running;
+        if (priority != JobInteractive) {
+            ++runningNonInteractive;
+        }
+        if (priority == JobBackground) {
+            ++runningBackground;
+        }
+        active.push_back(job);
+        pool.start(new JobRunnable(this, job));
+    }
+}
+
+void Scheduler::finished(const Job &job) {
+    QMutexLocker locker(&mutex);
+    --running;
+    if (job.priority != JobInteractive) {
+        --runningNonInteractive;
+    }
+    if (job.priority == JobBackground) {
+        --runningBackground;
+    }
+    for (auto it = active.begin(); it != active.end(); ++it) {
+        if (it->cancel == job.cancel && it->key == job.key) {
+            active.erase(it);
+            break;
+        }
+    }
+    startReadyJobs();
+}
+
+void Scheduler::JobRunnable::run() {
+    // Место задачи освобождается, как бы она ни завершилась, иначе
+    // несколько упавших задач остановили бы планировщик.
+    struct Release {
+        Scheduler *scheduler;
+        const Job &job;
+        ~Release() { scheduler->finished(job); }
+    } release = {scheduler, job};
+
+    setThreadBandPriority(PRIORITY_COUNT - 1 - job.priority);
+    TraceScope scope("job");
+    try {
+        job.run(!isCancelled(job.cancel.get()));
+    } catch (...) {
+        // Исключение из потока пула завершило бы процесс.
+    }
+}
+
+}
+
+void submitJob(JobPriority priority, const QString &key, const std::shared_ptr<CancelFlag> &cancel,
+               const std::function<void(bool)> &run) {
+    Job job;
+    job.priority = priority;
+    job.key = key;
+    job.cancel = cancel;
+    job.run = run;
+    scheduler().submit(job);
+}
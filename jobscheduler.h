@@ -0,0 +1,64 @@
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include "parallel.h"
+#include <QFuture>
+#include <QFutureInterface>
+#include <QString>
+#include <functional>
+#include <memory>
+
+// Срочность задачи, от самой срочной.
+enum JobPriority {
+    // Предпросмотр и все, чего пользователь ждет глядя на экран.
+    JobInteractive,
+    // Обработка в полном разрешении.
+    JobRender,
+    // Сохранение, пакетная обработка, статистика.
+    JobBackground
+};
+
+// Ставит задачу в общую очередь. Задачи запускаются по срочности, а в
+// пределах одной — по порядку. Одновременно идут не больше трех задач:
+// одно место всегда остается интерактивным, так что предпросмотр не ждет
+// окончания долгой обработки, а фоновые задачи занимают не больше одного,
+// так что сохранение не задерживает обработку. Полосы задач раздаются
+// общему пулу с приоритетом задачи (см. setThreadBandPriority), поэтому
+// сколько бы задач ни было поставлено, ядра делят три потока задач и пул
+// полос, а свободные потоки пула помогают сначала самой срочной. Вся
+// фоновая работа интерфейса идет через планировщик, а не через
+// глобальный пул QtConcurrent.
+//
+// key, если не пуст, — то, что задача заменяет: еще не начатая задача с
+// тем же ключом выбрасывается, у начатой выставляется ее cancel. run
+// вызывается ровно один раз: в потоке планировщика с true, чтобы
+// выполнить задачу, или с false, если она выброшена или отменена до
+// начала (выброшенная завершается в потоке, который ее заменил).
+void submitJob(JobPriority priority, const QString &key, const std::shared_ptr<CancelFlag> &cancel,
+               const std::function<void(bool)> &run);
+
+// То же для функции с результатом, как QtConcurrent::run: результат
+// приходит в QFuture (например, через QFutureWatcher). Выброшенная задача
+// и задача, в которой work бросила исключение, отдают результат по
+// умолчанию: будущее завершается в любом случае.
+template <typename Work>
+auto scheduleJob(JobPriority priority, const QString &key, const std::shared_ptr<CancelFlag> &cancel, Work work)
+    -> QFuture<decltype(work())> {
+    typedef decltype(work()) Result;
+    std::shared_ptr<QFutureInterface<Result> > promise = std::make_shared<QFutureInterface<Result> >();
+    promise->reportStarted();
+    submitJob(priority, key, cancel, [promise, work](bool run) {
+        Result result = Result();
+        if (run) {
+            try {
+                result = work();
+            } catch (...) {
+            }
+        }
+        promise->reportResult(result);
+        promise->reportFinished();
+    });
+    return promise->future();
+}
+
+#endif
@@ -0,0 +1,205 @@
+#include "kernel.h"
+#include "fftconvolve.h"
+#include <QMutex>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+struct Kernel::Data {
+    Data(const double *begin, int width, int height)
+        : width(width), height(height), values(begin, begin + static_cast<size_t>(width) * height), sum(0.0) {
+        for (double value : values) {
+            sum += value;
+        }
+    }
+
+    int width;
+    int height;
+    std::vector<double> values;
+    double sum;
+
+    std::once_flag weightsOnce;
+    std::unique_ptr<SpanWeights> weights;
+    std::once_flag termsOnce;
+    std::vector<SeparableTerm> terms;
+    // Спектр зависит от набора инструкций БПФ в последнем знаке float,
+    // поэтому он входит в ключ вместе с размером блока.
+    QMutex spectraMutex;
+    std::map<std::pair<int, int>, std::unique_ptr<KernelSpectrum> > spectra;
+};
+
+namespace {
+
+// Ядер в кэше немного (размеры и сигмы из интерфейса), но запросы с
+// произвольными параметрами не должны копить память без ограничения.
+const size_t KERNEL_CACHE_SIZE = 64;
+
+enum KernelType {
+    KernelGaussian,
+    KernelGaussian1D,
+    KernelSharpen,
+    KernelSobelX
+};
+
+typedef std::tuple<int, size_t, double> KernelKey;
+
+struct CacheEntry {
+    Kernel kernel;
+    quint64 lastUse;
+};
+
+QMutex cacheMutex;
+std::map<KernelKey, CacheEntry> cache;
+quint64 cacheClock = 0;
+
+Kernel buildKernel(KernelType type, size_t size, double sigma) {
+    if (type == KernelSharpen) {
+        const double values[9] = {0.0, -1.5, 0.0, -1.5, 7.5, -1.5, 0.0, -1.5, 0.0};
+        return Kernel(values, 3, 3);
+    }
+    if (type == KernelSobelX) {
+        const double values[9] = {-2.0, 0.0, 2.0, -4.0, 0.0, 4.0, -2.0, 0.0, 2.0};
+        return Kernel(values, 3, 3);
+    }
+
+    const int n = static_cast<int>(size);
+    const int center = n / 2;
+    if (type == KernelGaussian1D) {
+        std::vector<double> row(n);
+        for (int i = 0; i < n; ++i) {
+            int x = i - center;
+            row[i] = std::exp(-(x * x) / (2.0 * sigma * sigma));
+        }
+        return Kernel(row.data(), n, 1).normalized();
+    }
+    // Не произведение строк: так веса побитно совпадают с прежними.
+    std::vector<double> values(static_cast<size_t>(n) * n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            int x = j - center;
+            int y = i - center;
+            values[static_cast<size_t>(i) * n + j] = std::exp(-(x * x + y * y) / (2.0 * sigma * sigma));
+        }
+    }
+    return Kernel(values.data(), n, n).normalized();
+}
+
+Kernel cachedKernel(KernelType type, size_t size, double sigma) {
+    if (type == KernelGaussian || type == KernelGaussian1D) {
+        size |= 1;
+    }
+    KernelKey key(type, size, sigma);
+
+    QMutexLocker locker(&cacheMutex);
+    ++cacheClock;
+    auto found = cache.find(key);
+    if (found != cache.end()) {
+        found->second.lastUse = cacheClock;
+        return found->second.kernel;
+    }
+
+    if (cache.size() >= KERNEL_CACHE_SIZE) {
+        auto oldest = cache.begin();
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->second.lastUse < oldest->second.lastUse) {
+                oldest = it;
+            }
+        }
+        cache.erase(oldest);
+    }
+    CacheEntry entry;
+    entry.kernel = buildKernel(type, size, sigma);
+    entry.lastUse = cacheClock;
+    cache[key] = entry;
+    return entry.kernel;
+}
+
+}
+
+Kernel::Kernel() {}
+
+Kernel::Kernel(const double *values, int width, int height) {
+    if (values != nullptr && width > 0 && height > 0) {
+        d = std::make_shared<Data>(values, width, height);
+    }
+}
+
+Kernel Kernel::gaussian(size_t size, double sigma) {
+    return cachedKernel(KernelGaussian, size, sigma);
+}
+
+Kernel Kernel::gaussian1D(size_t size, double sigma) {
+    return cachedKernel(KernelGaussian1D, size, sigma);
+}
+
+Kernel Kernel::sharpen() {
+    return cachedKernel(KernelSharpen, 3, 0.0);
+}
+
+Kernel Kernel::sobelX() {
+    return cachedKernel(KernelSobelX, 3, 0.0);
+}
+
+int Kernel::width() const {
+    return d ? d->width : 0;
+}
+
+int Kernel::height() const {
+    return d ? d->height : 0;
+}
+
+const double *Kernel::data() const {
+    return d ? d->values.data() : nullptr;
+}
+
+double Kernel::sum() const {
+    return d ? d->sum : 0.0;
+}
+
+Kernel Kernel::normalized() const {
+    if (!d || d->sum == 0.0 || d->sum == 1.0) {
+        return *this;
+    }
+    std::vector<double> values(d->values);
+    for (double &value : values) {
+        value /= d->sum;
+    }
+    return Kernel(values.data(), d->width, d->height);
+}
+
+const SpanWeights &Kernel::spanWeights() const {
+    static const SpanWeights empty(nullptr, 0);
+    if (!d) {
+        return empty;
+    }
+    std::call_once(d->weightsOnce, [this]() {
+        d->weights.reset(new SpanWeights(d->values.data(), static_cast<int>(d->values.size())));
+    });
+    return *d->weights;
+}
+
+const std::vector<SeparableTerm> &Kernel::separableTerms() const {
+    static const std::vector<SeparableTerm> empty;
+    if (!d) {
+        return empty;
+    }
+    std::call_once(d->termsOnce, [this]() {
+        decomposeKernel(d->values.data(), d->width, d->height, d->terms);
+    });
+    return d->terms;
+}
+
+const KernelSpectrum &Kernel::spectrum(int size) const {
+    static const KernelSpectrum empty;
+    if (!d) {
+        return empty;
+    }
+    QMutexLocker locker(&d->spectraMutex);
+    std::unique_ptr<KernelSpectrum> &spectrum = d->spectra[std::make_pair(size, static_cast<int>(simdLevel()))];
+    if (!spectrum) {
+        spectrum.reset(new KernelSpectrum);
+        computeKernelSpectrum(d->values.data(), d->width, d->height, size, *spectrum);
+    }
+    return *spectrum;
+}
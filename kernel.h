@@ -0,0 +1,55 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "separable.h"
+#include "spankernels.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+struct KernelSpectrum;
+
+// Ядро свертки: коэффициенты width x height по строкам, якорь в центре
+// (width / 2, height / 2), как в filter2D. Копии дешевы и делят данные и
+// производные формы, которые строятся при первом обращении и дальше
+// переиспользуются: веса для convolveSpan (float и фиксированная точка),
+// разложение на одномерные слагаемые и спектры для БПФ. Обращаться к
+// ним можно из нескольких потоков.
+class Kernel {
+public:
+    Kernel();
+    Kernel(const double *values, int width, int height);
+
+    // Стандартные ядра берутся из общего кэша по (виду, размеру, сигме),
+    // так что повторные вызовы не считают экспоненты и не строят
+    // производные формы заново. Четный size увеличивается до нечетного.
+    static Kernel gaussian(size_t size, double sigma);
+    // Строка 1 x size; для вертикального прохода те же веса идут столбцом.
+    static Kernel gaussian1D(size_t size, double sigma);
+    static Kernel sharpen();
+    static Kernel sobelX();
+
+    bool isNull() const { return width() == 0 || height() == 0; }
+    int width() const;
+    int height() const;
+    int anchorX() const { return width() / 2; }
+    int anchorY() const { return height() / 2; }
+    const double *data() const;
+    // Сумма коэффициентов: 1 у нормированных ядер, 0 у детекторов краев.
+    double sum() const;
+
+    // То же ядро с суммой 1 (если сумма не равна нулю).
+    Kernel normalized() const;
+
+    const SpanWeights &spanWeights() const;
+    // Слагаемые decomposeKernel; пусто, если ядро не раскладывается.
+    const std::vector<SeparableTerm> &separableTerms() const;
+    // Спектр для блока БПФ size x size (см. computeKernelSpectrum).
+    const KernelSpectrum &spectrum(int size) const;
+
+private:
+    struct Data;
+    std::shared_ptr<Data> d;
+};
+
+#endif
@@ -1,7 +1,25 @@
 #include <QApplication>
+#include <QCoreApplication>
+#include "batchprocessor.h"
+#include "benchmark.h"
+#include "framestream.h"
 #include "mainwindow.h"
 
 int main(int argc, char *argv[]) {
+    // Пакетный и потоковый режимы и замеры не создают окон и работают без дисплея.
+    if (isBatchInvocation(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return runBatchCommand(app.arguments());
+    }
+    if (isBenchmarkInvocation(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return runBenchmarkCommand(app.arguments());
+    }
+    if (isStreamInvocation(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return runStreamCommand(app.arguments());
+    }
+
     QApplication app(argc, argv);
 
     MainWindow window;
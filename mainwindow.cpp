@@ -1,5 +1,11 @@
 #include "mainwindow.h"
+#include "edgedetect.h"
 #include "filter2d.h"
+#include "imageio.h"
+#include "jobscheduler.h"
+#include "parallel.h"
+#include "rankfilter.h"
+#include "trace.h"
 #include <QHBoxLayout>
 #include <QVBoxLayout>
 #include <QFormLayout>
@@ -9,14 +15,17 @@
 #include <QScrollArea>
 #include <QStatusBar>
 #include <QDebug>
-#include <QtConcurrent/QtConcurrent>
+#include <QElapsedTimer>
 #include <QFuture>
 #include <QFutureWatcher>
+#include <algorithm>
+#include <cmath>
 
 const double MainWindow::SHARPEN_DEFAULTS[9] = {0.0, -1.5, 0.0, -1.5, 7.5, -1.5, 0.0, -1.5, 0.0};
 const double MainWindow::SOBEL_DEFAULTS[9] = {-2.0, 0.0, 2.0, -4.0, 0.0, 4.0, -2.0, 0.0, 2.0};
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
+MainWindow::MainWindow(QWidget *parent)
+    : QMainWindow(parent), resultCache(RESULT_CACHE_BYTES, COMPRESSED_CACHE_BYTES), historyIndex(0) {
     setupUI();
     createTestImage();
 }
@@ -24,89 +33,535 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 void MainWindow::loadImage() {
     QString fileName = QFileDialog::getOpenFileName(this,
                                                     "Открыть изображение", "",
-                                                    "Images (*.png *.jpg *.jpeg *.bmp)");
+                                                    "Images (*.png *.jpg *.jpeg *.bmp *.ppm *.pgm *.pnm)");
     if (!fileName.isEmpty()) {
-        if (originalImage.load(fileName)) {
-            processedImage = originalImage;
-            updateDisplay();
-            statusBar()->showMessage("Изображение " + fileName + " загружено.", 3000);
-        } else {
-            QMessageBox::warning(this, "Ошибка", "Не удалось загрузить изображение.");
-        }
+        startLoad(fileName);
     }
 }
 
+// Файл читается в фоне. Уменьшенная копия читается параллельно с полным
+// изображением и, если кодек умеет ее быстро получить и она успевает
+// раньше, показывается в обоих просмотрах. Пока идет чтение, applyBtn
+// отменяет его.
+void MainWindow::startLoad(const QString &fileName) {
+    cancelPreview();
+    setControlsEnabled(false);
+    statusBar()->showMessage("Загрузка " + fileName + "...");
+
+    std::shared_ptr<CancelFlag> cancel = std::make_shared<CancelFlag>(false);
+    loadCancel = cancel;
+
+    const QSize previewSize = processedView->size();
+    std::shared_ptr<QSize> fullSize = std::make_shared<QSize>();
+    QFutureWatcher<QImage> *previewWatcher = new QFutureWatcher<QImage>(this);
+    connect(previewWatcher, &QFutureWatcher<QImage>::finished, this,
+            [this, previewWatcher, cancel, fullSize, fileName](){
+        QImage preview = previewWatcher->result();
+        if (loadCancel == cancel && !preview.isNull()) {
+            originalView->setImage(preview, *fullSize);
+            processedView->setImage(preview, *fullSize);
+            statusBar()->showMessage("Загрузка " + fileName + ": уменьшенная копия, полное изображение еще читается...");
+        }
+        previewWatcher->deleteLater();
+    });
+    previewWatcher->setFuture(scheduleJob(JobInteractive, "load preview", cancel, [=](){
+        return readImagePreview(fileName, previewSize, fullSize.get());
+    }));
+
+    std::shared_ptr<QString> error = std::make_shared<QString>();
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, cancel, error, fileName](){
+        if (loadCancel == cancel) {
+            loadCancel.reset();
+            setControlsEnabled(true);
+            QImage image = watcher->result();
+            if (!image.isNull()) {
+                originalImage = image;
+                processedImage = originalImage;
+                previewSource = QImage();
+                resetHistory();
+                updateDisplay();
+                schedulePreview();
+                statusBar()->showMessage("Изображение " + fileName + " загружено.", 3000);
+            } else {
+                updateDisplay();
+                statusBar()->clearMessage();
+                QMessageBox::warning(this, "Ошибка", *error);
+            }
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(scheduleJob(JobRender, "load", cancel, [=](){
+        return readImageCopy(fileName, error.get());
+    }));
+}
+
 void MainWindow::saveImage() {
     if (processedImage.isNull()) {
         QMessageBox::warning(this, "Предупреждение", "Нет изображения для сохранения.");
         return;
     }
     QString fileName = QFileDialog::getSaveFileName(this, "Сохранить изображение", "",
-                                                    "PNG Image (*.png);;JPEG Image (*.jpg);;BMP Image (*.bmp)");
-    if (!fileName.isEmpty()) {
-        if (processedImage.save(fileName)) {
+                                                    "PNG Image (*.png);;JPEG Image (*.jpg);;BMP Image (*.bmp);;"
+                                                    "PPM Image (*.ppm)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+
+    // Кодирование идет в фоне; копия делит данные с processedImage, а
+    // фильтры общие данные не меняют.
+    statusBar()->showMessage("Сохранение " + fileName + "...");
+    QImage imageToSave = processedImage;
+    std::shared_ptr<QString> error = std::make_shared<QString>();
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, error, fileName](){
+        if (watcher->result()) {
             statusBar()->showMessage("Изображение успешно сохранено в " + fileName, 3000);
         } else {
-            QMessageBox::warning(this, "Ошибка сохранения", "Не удалось сохранить изображение.");
+            statusBar()->clearMessage();
+            QMessageBox::warning(this, "Ошибка сохранения", *error);
         }
-    }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(scheduleJob(JobBackground, QString(), std::shared_ptr<CancelFlag>(), [=](){
+        return writeImageFile(imageToSave, fileName, error.get());
+    }));
 }
 
 void MainWindow::applyFilter() {
+    if (loadCancel) {
+        // Чтение не прерывается, но его результат будет отброшен.
+        *loadCancel = true;
+        loadCancel.reset();
+        setControlsEnabled(true);
+        updateDisplay();
+        statusBar()->showMessage("Загрузка отменена.", 3000);
+        return;
+    }
+    if (renderCancel) {
+        *renderCancel = true;
+        statusBar()->showMessage("Отмена...");
+        return;
+    }
     if (originalImage.isNull()) {
         QMessageBox::warning(this, "Предупреждение", "Сначала загрузите изображение!");
         return;
     }
 
+    QString doneMessage = "Фильтр применен успешно!";
+    if (filterCombo->currentIndex() == 0 && currentFilterOptions().border.mode == BorderClamp) {
+        double kernelError = 0.0;
+        if (selectBlurEngine(gaussSizeSpinBox->value(), gaussSigmaSpinBox->value(),
+                             currentFilterOptions().blurEngine, &kernelError) == BlurRecursive) {
+            // Оценка сверху для двух проходов, в уровнях яркости.
+            doneMessage += QString(" Рекурсивное размытие, отклонение от прямой свертки до %1 ур.")
+                               .arg(kernelError * 255.0 * 2.0, 0, 'f', 2);
+        }
+    }
+    HistoryStep step;
+    step.label = currentFilterLabel();
+    step.settings = currentFilterSettings() + optionsSettings(currentFilterOptions());
+    step.job = currentFilterJob();
+    step.options = currentFilterOptions();
+    showStep(step, true, doneMessage);
+}
+
+QString MainWindow::currentFilterLabel() const {
+    if (filterCombo->currentIndex() == 0) {
+        return QString("Размытие %1, σ=%2").arg(gaussSizeSpinBox->value()).arg(gaussSigmaSpinBox->value());
+    }
+    if (filterCombo->currentIndex() == EDGE_FILTER_INDEX) {
+        return "Контуры: " + edgeOutputCombo->currentText();
+    }
+    if (filterCombo->currentIndex() == RANK_FILTER_INDEX) {
+        return QString("%1, радиус %2").arg(rankOperationCombo->currentText()).arg(rankRadiusSpinBox->value());
+    }
+    return filterCombo->currentText();
+}
+
+// Числа записываются с полной точностью: параметры, различимые в
+// интерфейсе, должны давать разные ключи.
+QString MainWindow::currentFilterSettings() const {
+    int filterIndex = filterCombo->currentIndex();
+    if (filterIndex == 0) {
+        return QString("gauss %1 %2").arg(gaussSizeSpinBox->value()).arg(gaussSigmaSpinBox->value(), 0, 'g', 17);
+    }
+    if (filterIndex == EDGE_FILTER_INDEX) {
+        return QString("sobel %1").arg(edgeOutputCombo->currentIndex());
+    }
+    if (filterIndex == RANK_FILTER_INDEX) {
+        return QString("rank %1 %2").arg(rankOperationCombo->currentIndex()).arg(rankRadiusSpinBox->value());
+    }
+    QDoubleSpinBox *const *inputs = filterIndex == 1 ? sharpenKernelInputs : sobelKernelInputs;
+    QStringList values;
+    for (int i = 0; i < 9; ++i) {
+        values << QString::number(inputs[i]->value(), 'g', 17);
+    }
+    return "kernel " + values.join(',');
+}
+
+QString MainWindow::optionsSettings(const FilterOptions &options) {
+    return QString(" precision=%1 blur=%2 engine=%3 border=%4/%5")
+        .arg(options.precision)
+        .arg(options.blurEngine)
+        .arg(options.convolutionEngine)
+        .arg(options.border.mode)
+        .arg(options.border.color, 8, 16, QChar('0'));
+}
+
+void MainWindow::showStep(const HistoryStep &step, bool addToHistory, const QString &doneMessage) {
+    cancelPreview();
+    if (!step.job) {
+        processedImage = originalImage;
+        updateDisplay();
+        if (addToHistory) {
+            pushHistory(step);
+        }
+        if (!doneMessage.isEmpty()) {
+            statusBar()->showMessage(doneMessage, 3000);
+        }
+        return;
+    }
+
+    const QString key = ResultCache::makeKey(originalImage, step.settings);
+    QImage cached;
+    ImageStats stats;
+    bool hasStats = false;
+    if (resultCache.find(key, cached, stats, hasStats)) {
+        processedImage = cached;
+        updateDisplay(hasStats ? &stats : nullptr);
+        if (addToHistory) {
+            pushHistory(step);
+        }
+        statusBar()->showMessage(step.label + ": готовый результат из кэша.", 5000);
+        return;
+    }
+
+    std::shared_ptr<const CompressedImage> compressed = resultCache.findCompressed(key);
+    if (compressed) {
+        startRender(step, [compressed](QImage &image, const FilterOptions &) {
+            image = decompressImage(*compressed);
+        }, addToHistory, step.label + ": результат распакован из кэша.");
+    } else {
+        startRender(step, step.job, addToHistory, doneMessage);
+    }
+}
+
+void MainWindow::pushHistory(const HistoryStep &step) {
+    history.resize(historyIndex + 1);
+    history.append(step);
+    if (history.size() > MAX_HISTORY) {
+        history.removeFirst();
+    }
+    historyIndex = history.size() - 1;
+    updateHistoryButtons();
+}
+
+void MainWindow::resetHistory() {
+    resultCache.clear();
+    history.clear();
+    HistoryStep original;
+    original.label = "Оригинал";
+    history.append(original);
+    historyIndex = 0;
+    updateHistoryButtons();
+}
+
+void MainWindow::updateHistoryButtons(bool enabled) {
+    undoBtn->setEnabled(enabled && historyIndex > 0);
+    redoBtn->setEnabled(enabled && historyIndex + 1 < history.size());
+}
+
+void MainWindow::undo() {
+    if (renderCancel || historyIndex <= 0) {
+        return;
+    }
+    --historyIndex;
+    updateHistoryButtons();
+    showStep(history[historyIndex], false, QString("Шаг %1 из %2: %3.")
+                                                .arg(historyIndex + 1).arg(history.size())
+                                                .arg(history[historyIndex].label));
+}
+
+void MainWindow::redo() {
+    if (renderCancel || historyIndex + 1 >= history.size()) {
+        return;
+    }
+    ++historyIndex;
+    updateHistoryButtons();
+    showStep(history[historyIndex], false, QString("Шаг %1 из %2: %3.")
+                                                .arg(historyIndex + 1).arg(history.size())
+                                                .arg(history[historyIndex].label));
+}
+
+MainWindow::ImageJob MainWindow::currentFilterJob(double scale) const {
+    int filterIndex = filterCombo->currentIndex();
+    if (filterIndex == 0) {
+        size_t size = gaussSizeSpinBox->value();
+        double sigma = gaussSigmaSpinBox->value();
+        if (scale < 1.0) {
+            size = std::max<size_t>(1, static_cast<size_t>(std::lround(size * scale))) | 1;
+            sigma = std::max(0.1, sigma * scale);
+        }
+        return [size, sigma](QImage &image, const FilterOptions &options) {
+            gaussianBlur(image, size, sigma, options);
+        };
+    }
+    if (filterIndex == EDGE_FILTER_INDEX) {
+        EdgeOutput output = static_cast<EdgeOutput>(edgeOutputCombo->currentIndex());
+        return [output](QImage &image, const FilterOptions &options) {
+            sobelEdges(image, output, options);
+        };
+    }
+    if (filterIndex == RANK_FILTER_INDEX) {
+        RankOperation operation = static_cast<RankOperation>(rankOperationCombo->currentIndex());
+        int radius = rankRadiusSpinBox->value();
+        if (scale < 1.0) {
+            radius = std::max(1, static_cast<int>(std::lround(radius * scale)));
+        }
+        return [operation, radius](QImage &image, const FilterOptions &options) {
+            rankFilter(image, operation, radius, options);
+        };
+    }
+
+    // Ядра 3x3 не масштабируются: на уменьшенной копии они действуют
+    // на более крупные детали, но характер результата сохраняется.
+    // Ядро собирается один раз на задачу; копия в лямбде делит с ним веса.
+    QDoubleSpinBox *const *inputs = filterIndex == 1 ? sharpenKernelInputs : sobelKernelInputs;
+    double kernelValues[9];
+    for(int i = 0; i < 9; ++i) kernelValues[i] = inputs[i]->value();
+    Kernel kernel(kernelValues, 3, 3);
+    return [kernel](QImage &image, const FilterOptions &options) {
+        filter2D(image, kernel, options);
+    };
+}
+
+void MainWindow::startRender(const HistoryStep &step, const ImageJob &job, bool addToHistory,
+                             const QString &doneMessage) {
+    cancelPreview();
     setControlsEnabled(false);
     statusBar()->showMessage("Применение фильтра...");
 
-    QImage imageToProcess = originalImage.copy();
-    int filterIndex = filterCombo->currentIndex();
+    std::shared_ptr<CancelFlag> cancel = std::make_shared<CancelFlag>(false);
+    renderCancel = cancel;
+
+    // Копия не нужна: фильтры не пишут в общие с originalImage данные,
+    // а берут для результата новый буфер.
+    QImage imageToProcess = originalImage;
+    FilterOptions options = step.options;
+    const QString key = ResultCache::makeKey(originalImage, step.settings);
+    // Статистику для панели сведений фильтр собирает при записи результата.
+    std::shared_ptr<ImageStats> stats = std::make_shared<ImageStats>();
+    std::shared_ptr<qint64> elapsed = std::make_shared<qint64>(0);
+    const qint64 traceStart = traceClock();
 
     QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
-    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher](){
-        processedImage = watcher->result();
-        updateDisplay();
-        statusBar()->showMessage("Фильтр применен успешно!", 3000);
-        setControlsEnabled(true);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this,
+            [this, watcher, cancel, stats, elapsed, traceStart, doneMessage, step, key, addToHistory](){
+        if (*cancel) {
+            updateDisplay();
+            statusBar()->showMessage("Обработка отменена.", 3000);
+        } else {
+            processedImage = watcher->result();
+            // Если фильтр ничего не делал, статистика не заполнена.
+            bool complete = stats->pixelCount == static_cast<qint64>(processedImage.width()) * processedImage.height();
+            updateDisplay(complete ? stats.get() : nullptr);
+            resultCache.insert(key, processedImage, complete ? stats.get() : nullptr);
+            if (addToHistory) {
+                pushHistory(step);
+            }
+            double seconds = std::max<qint64>(*elapsed, 1) / 1e9;
+            QString message = doneMessage + QString(" %1 мс, %2 Мпикс/с.")
+                                                .arg(seconds * 1e3, 0, 'f', 1)
+                                                .arg(processedImage.width() * static_cast<double>(processedImage.height())
+                                                     / 1e6 / seconds, 0, 'f', 1);
+            if (tracingEnabled()) {
+                message += " " + traceSummaryText(traceStart);
+            }
+            statusBar()->showMessage(message, 10000);
+        }
+        if (renderCancel == cancel) {
+            renderCancel.reset();
+            setControlsEnabled(true);
+        }
         watcher->deleteLater();
     });
 
-    if (filterIndex == 0) {
-        int size = gaussSizeSpinBox->value();
-        double sigma = gaussSigmaSpinBox->value();
-        QFuture<QImage> future = QtConcurrent::run([=](){
-            QImage resultImage = imageToProcess;
-            gaussianBlur(resultImage, size, sigma);
-            return resultImage;
-        });
-        watcher->setFuture(future);
+    // Флаг живет в задаче, пока она не закончится.
+    watcher->setFuture(scheduleJob(JobRender, "render", cancel, [=](){
+        QImage resultImage = imageToProcess;
+        FilterOptions jobOptions = options;
+        jobOptions.cancel = cancel.get();
+        jobOptions.stats = stats.get();
+        QElapsedTimer timer;
+        timer.start();
+        job(resultImage, jobOptions);
+        *elapsed = timer.nsecsElapsed();
+        return resultImage;
+    }));
+}
 
-    } else {
-        double* kernelValues = new double[9];
-        size_t kSize = 3;
+void MainWindow::schedulePreview() {
+    if (livePreviewCheckBox->isChecked()) {
+        previewTimer->start();
+    }
+}
+
+void MainWindow::renderPreview() {
+    if (originalImage.isNull() || loadCancel || !livePreviewCheckBox->isChecked()) {
+        return;
+    }
+    cancelPreview();
+
+    // Уменьшенная копия строится только при смене изображения или размера
+    // окна, поэтому предпросмотр не зависит от размера оригинала. Строит ее
+    // сама задача предпросмотра: сглаженное уменьшение 50 Мп в потоке
+    // интерфейса остановило бы окно. Готовая копия запоминается до смены
+    // изображения.
+    const QSize targetSize = processedView->size();
+    const bool haveSource = !previewSource.isNull() && previewTargetSize == targetSize;
+    const bool buildSource = !haveSource &&
+        (originalImage.width() > targetSize.width() || originalImage.height() > targetSize.height());
+    if (!haveSource && !buildSource) {
+        previewTargetSize = targetSize;
+        previewSource = originalImage;
+    }
+    const QImage source = buildSource ? originalImage : previewSource;
+    const QSize sourceSize = buildSource ? originalImage.size().scaled(targetSize, Qt::KeepAspectRatio)
+                                         : previewSource.size();
+    double scale = static_cast<double>(sourceSize.width()) / originalImage.width();
+
+    std::shared_ptr<CancelFlag> cancel = std::make_shared<CancelFlag>(false);
+    previewCancel = cancel;
+    ImageJob job = currentFilterJob(scale);
+    FilterOptions options = currentFilterOptions();
+    std::shared_ptr<QImage> builtSource = std::make_shared<QImage>();
+    const qint64 originalKey = originalImage.cacheKey();
 
-        if (filterIndex == 1) {
-            for(int i = 0; i < 9; ++i) kernelValues[i] = sharpenKernelInputs[i]->value();
-        } else if (filterIndex == 2) {
-            for(int i = 0; i < 9; ++i) kernelValues[i] = sobelKernelInputs[i]->value();
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this,
+            [this, watcher, cancel, builtSource, originalKey, targetSize](){
+        // Копия пригодится следующему предпросмотру, даже если этот отменен.
+        if (!builtSource->isNull() && originalImage.cacheKey() == originalKey) {
+            previewSource = *builtSource;
+            previewTargetSize = targetSize;
+        }
+        if (!*cancel) {
+            processedView->setImage(watcher->result(), originalImage.size());
+            statusBar()->showMessage("Предпросмотр. Нажмите «Применить фильтр» для полного разрешения.");
+        }
+        if (previewCancel == cancel) {
+            previewCancel.reset();
+        }
+        watcher->deleteLater();
+    });
+    // Прежний предпросмотр, если еще не начат, выбрасывается планировщиком.
+    watcher->setFuture(scheduleJob(JobInteractive, "preview", cancel, [=](){
+        QImage resultImage = source;
+        if (buildSource) {
+            TraceScope scope("preview source", static_cast<qint64>(source.width()) * source.height());
+            resultImage = source.scaled(sourceSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            *builtSource = resultImage;
         }
+        FilterOptions jobOptions = options;
+        jobOptions.cancel = cancel.get();
+        job(resultImage, jobOptions);
+        return resultImage;
+    }));
+}
+
+void MainWindow::cancelPreview() {
+    previewTimer->stop();
+    if (previewCancel) {
+        *previewCancel = true;
+        previewCancel.reset();
+    }
+}
 
-        QFuture<QImage> future = QtConcurrent::run([=](){
-            QImage resultImage = imageToProcess;
-            filter2D(resultImage, kernelValues, kSize, kSize);
-            delete[] kernelValues;
-            return resultImage;
-        });
-        watcher->setFuture(future);
+void MainWindow::onLivePreviewToggled(bool enabled) {
+    if (enabled) {
+        renderPreview();
+    } else {
+        cancelPreview();
+        updateDisplay();
     }
 }
 
+void MainWindow::onTracingToggled(bool enabled) {
+    setTracingEnabled(enabled);
+    if (enabled) {
+        clearTrace();
+    }
+    saveTraceBtn->setEnabled(enabled);
+}
+
+void MainWindow::saveTrace() {
+    QString fileName = QFileDialog::getSaveFileName(this, "Сохранить трассировку", "trace.json",
+                                                    "Chrome Trace (*.json)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    QString error;
+    if (writeChromeTrace(fileName, &error)) {
+        statusBar()->showMessage("Трассировка сохранена в " + fileName + " (откройте в about:tracing).", 5000);
+    } else {
+        QMessageBox::warning(this, "Ошибка сохранения", error);
+    }
+}
+
+void MainWindow::addToChain() {
+    int filterIndex = filterCombo->currentIndex();
+    if (filterIndex == EDGE_FILTER_INDEX || filterIndex == RANK_FILTER_INDEX) {
+        // Нелинейные фильтры не свертка и в проход цепочки не встраиваются.
+        statusBar()->showMessage(filterCombo->currentText() + ": нельзя добавить в цепочку.", 3000);
+        return;
+    }
+    if (filterIndex == 0) {
+        chain.addGaussian(gaussSizeSpinBox->value(), gaussSigmaSpinBox->value());
+    } else {
+        QDoubleSpinBox **inputs = filterIndex == 1 ? sharpenKernelInputs : sobelKernelInputs;
+        double kernelValues[9];
+        for(int i = 0; i < 9; ++i) kernelValues[i] = inputs[i]->value();
+        chain.addKernel(Kernel(kernelValues, 3, 3));
+    }
+    chainNames << currentFilterLabel();
+    chainSettings << currentFilterSettings();
+    chainLabel->setText(chainNames.join(" → "));
+    applyChainBtn->setEnabled(true);
+}
+
+void MainWindow::clearChain() {
+    chain.clear();
+    chainNames.clear();
+    chainSettings.clear();
+    chainLabel->setText("Цепочка пуста");
+    applyChainBtn->setEnabled(false);
+}
+
+void MainWindow::applyChain() {
+    if (originalImage.isNull() || chain.isEmpty() || renderCancel) {
+        return;
+    }
+
+    FilterChain chainToApply = chain;
+    HistoryStep step;
+    step.label = chainNames.join(" → ");
+    step.options = currentFilterOptions();
+    step.settings = "chain " + chainSettings.join("; ") + optionsSettings(step.options);
+    step.job = [chainToApply](QImage &image, const FilterOptions &options) {
+        chainToApply.apply(image, options);
+    };
+    showStep(step, true, QString("Цепочка из %1 фильтров применена.").arg(chainNames.size()));
+}
+
 void MainWindow::resetImage() {
     if (!originalImage.isNull()) {
-        processedImage = originalImage.copy();
-        updateDisplay();
+        // Сброс — тоже шаг истории: к результату можно вернуться.
+        if (history[historyIndex].job) {
+            HistoryStep original;
+            original.label = "Оригинал";
+            showStep(original, true, QString());
+        }
         resetFilterParameters();
         statusBar()->showMessage("Изменения и параметры сброшены.", 2000);
     }
@@ -114,15 +569,32 @@ void MainWindow::resetImage() {
 
 void MainWindow::onFilterChanged(int index) {
     parameterStack->setCurrentIndex(index);
+    schedulePreview();
+}
+
+void MainWindow::onThreadCountChanged(int count) {
+    setFilterThreadCount(count);
 }
 
+// Параметры фильтра остаются доступными и во время обработки, чтобы
+// предпросмотр продолжал работать; applyBtn тогда отменяет обработку.
 void MainWindow::setControlsEnabled(bool enabled) {
     loadBtn->setEnabled(enabled);
     saveBtn->setEnabled(enabled);
-    filterCombo->setEnabled(enabled);
-    parameterStack->setEnabled(enabled);
-    applyBtn->setEnabled(enabled);
+    threadCountSpinBox->setEnabled(enabled);
+    applyBtn->setText(enabled ? "Применить фильтр" : "Отменить");
     resetBtn->setEnabled(enabled);
+    addToChainBtn->setEnabled(enabled);
+    clearChainBtn->setEnabled(enabled);
+    applyChainBtn->setEnabled(enabled && !chain.isEmpty());
+    updateHistoryButtons(enabled);
+}
+
+FilterOptions MainWindow::currentFilterOptions() const {
+    FilterOptions options;
+    options.precision = fastModeCheckBox->isChecked() ? PrecisionFast : PrecisionExact;
+    options.border = Border(static_cast<BorderMode>(borderCombo->currentIndex()));
+    return options;
 }
 
 void MainWindow::resetFilterParameters() {
@@ -132,6 +604,9 @@ void MainWindow::resetFilterParameters() {
         sharpenKernelInputs[i]->setValue(SHARPEN_DEFAULTS[i]);
         sobelKernelInputs[i]->setValue(SOBEL_DEFAULTS[i]);
     }
+    edgeOutputCombo->setCurrentIndex(EdgeMagnitude);
+    rankOperationCombo->setCurrentIndex(RankMedian);
+    rankRadiusSpinBox->setValue(2);
 }
 
 QWidget* MainWindow::createKernelEditor(QDoubleSpinBox* inputs[9], const double defaultValues[9]) {
@@ -162,22 +637,25 @@ void MainWindow::setupUI() {
     QVBoxLayout* originalVLayout = new QVBoxLayout();
     QLabel *originalTitle = new QLabel("Оригинал:");
     originalTitle->setStyleSheet("font-weight: bold; font-size: 14px;");
-    originalLabel = new QLabel();
-    originalLabel->setMinimumSize(300, 300);
-    originalLabel->setAlignment(Qt::AlignCenter);
-    originalLabel->setStyleSheet("QLabel { background-color: #f0f0f0; border: 2px solid #ccc; }");
+    originalView = new ImageView();
+    originalView->setMinimumSize(300, 300);
     originalVLayout->addWidget(originalTitle);
-    originalVLayout->addWidget(originalLabel, 1);
+    originalVLayout->addWidget(originalView, 1);
 
     QVBoxLayout* processedVLayout = new QVBoxLayout();
     QLabel *processedTitle = new QLabel("После фильтрации:");
     processedTitle->setStyleSheet("font-weight: bold; font-size: 14px;");
-    processedLabel = new QLabel();
-    processedLabel->setMinimumSize(300, 300);
-    processedLabel->setAlignment(Qt::AlignCenter);
-    processedLabel->setStyleSheet("QLabel { background-color: #f0f0f0; border: 2px solid #ccc; }");
+    processedView = new ImageView();
+    processedView->setMinimumSize(300, 300);
     processedVLayout->addWidget(processedTitle);
-    processedVLayout->addWidget(processedLabel, 1);
+    processedVLayout->addWidget(processedView, 1);
+
+    connect(originalView, &ImageView::viewChanged, this, [this]() {
+        processedView->setView(originalView->zoom(), originalView->center(), originalView->fitsWindow());
+    });
+    connect(processedView, &ImageView::viewChanged, this, [this]() {
+        originalView->setView(processedView->zoom(), processedView->center(), processedView->fitsWindow());
+    });
 
     imageLayout->addLayout(originalVLayout);
     imageLayout->addLayout(processedVLayout);
@@ -197,6 +675,8 @@ void MainWindow::setupUI() {
     filterCombo->addItem("Размытие");
     filterCombo->addItem("Повышение резкости");
     filterCombo->addItem("Выделение краев");
+    filterCombo->addItem("Контуры (Собель)");
+    filterCombo->addItem("Медиана и морфология");
 
     parameterStack = new QStackedWidget();
 
@@ -215,10 +695,75 @@ void MainWindow::setupUI() {
     parameterStack->addWidget(createKernelEditor(sharpenKernelInputs, SHARPEN_DEFAULTS));
     parameterStack->addWidget(createKernelEditor(sobelKernelInputs, SOBEL_DEFAULTS));
 
+    // Страница контуров; пункты идут в порядке EdgeOutput.
+    QWidget *edgePage = new QWidget();
+    QFormLayout *edgeLayout = new QFormLayout(edgePage);
+    edgeOutputCombo = new QComboBox();
+    edgeOutputCombo->addItem("Модуль градиента");
+    edgeOutputCombo->addItem("Модуль и направление");
+    edgeOutputCombo->addItem("Тонкие края");
+    edgeLayout->addRow("Результат:", edgeOutputCombo);
+    parameterStack->addWidget(edgePage);
+
+    // Страница медианы и морфологии; пункты идут в порядке RankOperation.
+    QWidget *rankPage = new QWidget();
+    QFormLayout *rankLayout = new QFormLayout(rankPage);
+    rankOperationCombo = new QComboBox();
+    rankOperationCombo->addItem("Медиана");
+    rankOperationCombo->addItem("Эрозия (минимум)");
+    rankOperationCombo->addItem("Дилатация (максимум)");
+    rankRadiusSpinBox = new QSpinBox();
+    rankRadiusSpinBox->setRange(1, 50);
+    rankLayout->addRow("Операция:", rankOperationCombo);
+    rankLayout->addRow("Радиус окна:", rankRadiusSpinBox);
+    parameterStack->addWidget(rankPage);
+
     resetFilterParameters();
     connect(filterCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
             this, &MainWindow::onFilterChanged);
 
+    threadCountSpinBox = new QSpinBox();
+    // 0 — по числу ядер (см. setFilterThreadCount).
+    threadCountSpinBox->setRange(0, 256);
+    threadCountSpinBox->setSpecialValueText("Авто");
+    threadCountSpinBox->setValue(0);
+    connect(threadCountSpinBox, QOverload<int>::of(&QSpinBox::valueChanged),
+            this, &MainWindow::onThreadCountChanged);
+
+    fastModeCheckBox = new QCheckBox("Быстрый режим (целочисленная арифметика)");
+
+    borderCombo = new QComboBox();
+    borderCombo->addItem("Повтор крайнего пикселя");
+    borderCombo->addItem("Отражение");
+    borderCombo->addItem("Заворачивание");
+    borderCombo->addItem("Черный цвет");
+    connect(borderCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::schedulePreview);
+    connect(edgeOutputCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::schedulePreview);
+    connect(rankOperationCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::schedulePreview);
+    connect(rankRadiusSpinBox, QOverload<int>::of(&QSpinBox::valueChanged),
+            this, &MainWindow::schedulePreview);
+
+    livePreviewCheckBox = new QCheckBox("Живой предпросмотр");
+    previewTimer = new QTimer(this);
+    previewTimer->setSingleShot(true);
+    previewTimer->setInterval(PREVIEW_DELAY_MS);
+    connect(previewTimer, &QTimer::timeout, this, &MainWindow::renderPreview);
+    connect(livePreviewCheckBox, &QCheckBox::toggled, this, &MainWindow::onLivePreviewToggled);
+    connect(fastModeCheckBox, &QCheckBox::toggled, this, &MainWindow::schedulePreview);
+    connect(gaussSizeSpinBox, QOverload<int>::of(&QSpinBox::valueChanged),
+            this, &MainWindow::schedulePreview);
+    connect(gaussSigmaSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged),
+            this, &MainWindow::schedulePreview);
+    for (int i = 0; i < 9; ++i) {
+        connect(sharpenKernelInputs[i], QOverload<double>::of(&QDoubleSpinBox::valueChanged),
+                this, &MainWindow::schedulePreview);
+        connect(sobelKernelInputs[i], QOverload<double>::of(&QDoubleSpinBox::valueChanged),
+                this, &MainWindow::schedulePreview);
+    }
+
     applyBtn = new QPushButton("Применить фильтр");
     applyBtn->setStyleSheet("QPushButton { background-color: #4CAF50; color: white; font-weight: bold; padding: 8px; }");
     connect(applyBtn, &QPushButton::clicked, this, &MainWindow::applyFilter);
@@ -226,6 +771,31 @@ void MainWindow::setupUI() {
     resetBtn = new QPushButton("Сбросить");
     connect(resetBtn, &QPushButton::clicked, this, &MainWindow::resetImage);
 
+    // История: готовые результаты берутся из кэша без пересчета.
+    undoBtn = new QPushButton("Назад");
+    undoBtn->setShortcut(QKeySequence::Undo);
+    connect(undoBtn, &QPushButton::clicked, this, &MainWindow::undo);
+    redoBtn = new QPushButton("Вперед");
+    redoBtn->setShortcut(QKeySequence::Redo);
+    connect(redoBtn, &QPushButton::clicked, this, &MainWindow::redo);
+
+    // Цепочка: выбранные фильтры применяются по очереди за один проход.
+    addToChainBtn = new QPushButton("Добавить в цепочку");
+    connect(addToChainBtn, &QPushButton::clicked, this, &MainWindow::addToChain);
+    clearChainBtn = new QPushButton("Очистить цепочку");
+    connect(clearChainBtn, &QPushButton::clicked, this, &MainWindow::clearChain);
+    applyChainBtn = new QPushButton("Применить цепочку");
+    connect(applyChainBtn, &QPushButton::clicked, this, &MainWindow::applyChain);
+    chainLabel = new QLabel();
+    chainLabel->setWordWrap(true);
+    clearChain();
+
+    traceCheckBox = new QCheckBox("Трассировка стадий");
+    connect(traceCheckBox, &QCheckBox::toggled, this, &MainWindow::onTracingToggled);
+    saveTraceBtn = new QPushButton("Сохранить трассировку…");
+    saveTraceBtn->setEnabled(false);
+    connect(saveTraceBtn, &QPushButton::clicked, this, &MainWindow::saveTrace);
+
     infoWidget = new ImageInfoWidget();
     QScrollArea *scrollArea = new QScrollArea();
     scrollArea->setWidget(infoWidget);
@@ -237,9 +807,31 @@ void MainWindow::setupUI() {
     controlLayout->addWidget(new QLabel("Выберите фильтр:"));
     controlLayout->addWidget(filterCombo);
     controlLayout->addWidget(parameterStack);
+    QFormLayout *threadLayout = new QFormLayout();
+    threadLayout->addRow("Потоков:", threadCountSpinBox);
+    threadLayout->addRow("Край:", borderCombo);
+    controlLayout->addLayout(threadLayout);
+    controlLayout->addWidget(fastModeCheckBox);
+    controlLayout->addWidget(livePreviewCheckBox);
     controlLayout->addSpacing(15);
     controlLayout->addWidget(applyBtn);
     controlLayout->addWidget(resetBtn);
+    QHBoxLayout *historyLayout = new QHBoxLayout();
+    historyLayout->addWidget(undoBtn);
+    historyLayout->addWidget(redoBtn);
+    controlLayout->addLayout(historyLayout);
+    controlLayout->addSpacing(15);
+    controlLayout->addWidget(chainLabel);
+    QHBoxLayout *chainButtonsLayout = new QHBoxLayout();
+    chainButtonsLayout->addWidget(addToChainBtn);
+    chainButtonsLayout->addWidget(clearChainBtn);
+    controlLayout->addLayout(chainButtonsLayout);
+    controlLayout->addWidget(applyChainBtn);
+    controlLayout->addSpacing(15);
+    QHBoxLayout *traceLayout = new QHBoxLayout();
+    traceLayout->addWidget(traceCheckBox);
+    traceLayout->addWidget(saveTraceBtn);
+    controlLayout->addLayout(traceLayout);
     controlLayout->addSpacing(20);
     controlLayout->addWidget(scrollArea, 1);
 
@@ -269,14 +861,20 @@ void MainWindow::createTestImage() {
             }
         }
     }
-    processedImage = originalImage.copy();
+    processedImage = originalImage;
+    resetHistory();
     updateDisplay();
 }
 
-void MainWindow::updateDisplay() {
-    originalLabel->setPixmap(QPixmap::fromImage(originalImage).scaled(
-        originalLabel->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
-    processedLabel->setPixmap(QPixmap::fromImage(processedImage).scaled(
-        processedLabel->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
-    infoWidget->setImage(processedImage);
+// Просмотры сами строят в фоне нужный уровень пирамиды; оригинал, если
+// он не менялся, не перестраивается.
+void MainWindow::updateDisplay(const ImageStats *stats) {
+    TraceScope scope("updateDisplay");
+    originalView->setImage(originalImage);
+    processedView->setImage(processedImage);
+    if (stats != nullptr) {
+        infoWidget->setImage(processedImage, *stats);
+    } else {
+        infoWidget->setImage(processedImage);
+    }
 }
@@ -9,7 +9,14 @@
 #include <QDoubleSpinBox>
 #include <QStackedWidget>
 #include <QPushButton>
+#include <QCheckBox>
+#include <QTimer>
+#include <functional>
+#include <memory>
 #include "imageinfowidget.h"
+#include "imageview.h"
+#include "filterchain.h"
+#include "resultcache.h"
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -23,28 +30,126 @@ private slots:
     void applyFilter();
     void resetImage();
     void onFilterChanged(int index);
+    void onThreadCountChanged(int count);
+    void addToChain();
+    void clearChain();
+    void applyChain();
+    void schedulePreview();
+    void renderPreview();
+    void onLivePreviewToggled(bool enabled);
+    void onTracingToggled(bool enabled);
+    void saveTrace();
+    void undo();
+    void redo();
 
 private:
+    void startLoad(const QString &fileName);
     void setControlsEnabled(bool enabled);
     void resetFilterParameters();
     QWidget* createKernelEditor(QDoubleSpinBox* inputs[9], const double defaultValues[9]);
     void setupUI();
     void createTestImage();
-    void updateDisplay();
+    // stats, если задан, — уже собранная статистика processedImage.
+    void updateDisplay(const ImageStats *stats = nullptr);
+    FilterOptions currentFilterOptions() const;
+
+    // Фильтр с текущими параметрами интерфейса. scale < 1 — для уменьшенной
+    // копии: размер и сигма размытия уменьшаются в том же масштабе.
+    typedef std::function<void(QImage &, const FilterOptions &)> ImageJob;
+    ImageJob currentFilterJob(double scale = 1.0) const;
+    // Подпись текущего фильтра для пользователя и полное описание его
+    // параметров для ключа кэша.
+    QString currentFilterLabel() const;
+    QString currentFilterSettings() const;
+    static QString optionsSettings(const FilterOptions &options);
+
+    // Шаг истории: результат job с параметрами options, примененного к
+    // originalImage. settings описывает job и options и входит в ключ
+    // кэша результатов. Пустой job — само originalImage.
+    struct HistoryStep {
+        QString label;
+        QString settings;
+        ImageJob job;
+        FilterOptions options;
+    };
+
+    // Показывает результат шага: из кэша, распаковкой сжатого или
+    // обработкой. С addToHistory шаг после успеха добавляется в историю.
+    void showStep(const HistoryStep &step, bool addToHistory, const QString &doneMessage);
+    void pushHistory(const HistoryStep &step);
+    void resetHistory();
+    void updateHistoryButtons(bool enabled = true);
+
+    // Обработка originalImage в полном разрешении в фоне: job вместо
+    // step.job (например, распаковка сжатого результата). Пока она идет,
+    // applyBtn отменяет ее.
+    void startRender(const HistoryStep &step, const ImageJob &job, bool addToHistory, const QString &doneMessage);
+    void cancelPreview();
 
     static const double SHARPEN_DEFAULTS[9];
     static const double SOBEL_DEFAULTS[9];
+    // Пункт filterCombo детектора краев (sobelEdges).
+    static const int EDGE_FILTER_INDEX = 3;
+    // Пункт filterCombo медианы и морфологии (rankFilter).
+    static const int RANK_FILTER_INDEX = 4;
+    // Пауза после последнего изменения параметров перед предпросмотром.
+    static const int PREVIEW_DELAY_MS = 80;
+    static const int MAX_HISTORY = 100;
+    // Результаты в памяти и сжатые; сверх этого вытесняются самые давние.
+    static const qint64 RESULT_CACHE_BYTES = Q_INT64_C(1) << 30;
+    static const qint64 COMPRESSED_CACHE_BYTES = Q_INT64_C(512) << 20;
 
     QImage originalImage, processedImage;
-    QLabel *originalLabel, *processedLabel;
+    // Масштаб и сдвиг у просмотров общие.
+    ImageView *originalView, *processedView;
     ImageInfoWidget *infoWidget;
     QPushButton *loadBtn, *saveBtn, *applyBtn, *resetBtn;
     QComboBox *filterCombo;
     QStackedWidget *parameterStack;
     QSpinBox *gaussSizeSpinBox;
     QDoubleSpinBox *gaussSigmaSpinBox;
+    QSpinBox *threadCountSpinBox;
+    QCheckBox *fastModeCheckBox;
+    // Пункты идут в порядке BorderMode.
+    QComboBox *borderCombo;
     QDoubleSpinBox *sharpenKernelInputs[9];
     QDoubleSpinBox *sobelKernelInputs[9];
+    // Пункты идут в порядке EdgeOutput.
+    QComboBox *edgeOutputCombo;
+    // Пункты идут в порядке RankOperation.
+    QComboBox *rankOperationCombo;
+    QSpinBox *rankRadiusSpinBox;
+
+    // Цепочка фильтров, собранная пользователем, подписи ее ступеней и
+    // их параметры для ключа кэша.
+    FilterChain chain;
+    QStringList chainNames;
+    QStringList chainSettings;
+    QLabel *chainLabel;
+    QPushButton *addToChainBtn, *clearChainBtn, *applyChainBtn;
+
+    // Живой предпросмотр: после паузы в изменении параметров фильтр
+    // применяется к копии originalImage размером с processedView.
+    QCheckBox *livePreviewCheckBox;
+    QTimer *previewTimer;
+    QImage previewSource;
+    QSize previewTargetSize;
+    std::shared_ptr<CancelFlag> previewCancel, renderCancel;
+    // Идет чтение файла; сбрасывается, когда оно закончено или отменено.
+    std::shared_ptr<CancelFlag> loadCancel;
+
+    // История показанных результатов; historyIndex — текущий шаг. Шаги
+    // хранят не изображения, а способ их получить, а сами результаты
+    // лежат в resultCache, так что память ограничена его бюджетом.
+    ResultCache resultCache;
+    QVector<HistoryStep> history;
+    int historyIndex;
+    QPushButton *undoBtn, *redoBtn;
+
+    // Трассировка стадий: пока флажок включен, события копятся, и их
+    // можно сохранить для about:tracing.
+    QCheckBox *traceCheckBox;
+    QPushButton *saveTraceBtn;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,245 @@
+#include "parallel.h"
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QWaitCondition>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace {
+
+std::atomic<int> requestedThreadCount(0);
+
+// Средний приоритет: так идут полосы потоков вне планировщика.
+thread_local int bandPriority = 1;
+
+const size_t SCRATCH_ALIGNMENT = 64;
+const size_t MIN_SCRATCH_BLOCK = size_t(1) << 20;
+
+// Запас рабочей памяти потока — стек поверх блоков: кадры берут память
+// подряд от вершины (block, used) и при закрытии возвращают вершину
+// назад. Блоки не перемещаются, так что выданные указатели остаются
+// верными, пока жив кадр. Когда закрыт внешний кадр, несколько блоков
+// сливаются в один, и в следующий раз хватает одного.
+struct ScratchArena {
+    ScratchArena() : block(0), used(0), depth(0) {}
+
+    ~ScratchArena() {
+        for (void *memory : blocks) {
+            freeBlock(memory);
+        }
+    }
+
+    static void freeBlock(void *memory) {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+
+    void compact() {
+        if (blocks.size() <= 1) {
+            return;
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            freeBlock(blocks[i]);
+            total += sizes[i];
+        }
+        blocks.clear();
+        sizes.clear();
+        addBlock(total);
+    }
+
+    void addBlock(size_t bytes) {
+        bytes = std::max(MIN_SCRATCH_BLOCK, (bytes + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT);
+        void *memory = nullptr;
+#ifdef _WIN32
+        memory = _aligned_malloc(bytes, SCRATCH_ALIGNMENT);
+#else
+        if (posix_memalign(&memory, SCRATCH_ALIGNMENT, bytes) != 0) {
+            memory = nullptr;
+        }
+#endif
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(memory);
+        sizes.push_back(bytes);
+    }
+
+    std::vector<void *> blocks;
+    std::vector<size_t> sizes;
+    size_t block;
+    size_t used;
+    int depth;
+};
+
+thread_local ScratchArena scratchArena;
+
+QThreadPool *filterPool() {
+    static QThreadPool pool;
+    return &pool;
+}
+
+struct BandJob {
+    std::function<void(int, int)> body;
+    int priority;
+    int height;
+    int bandRows;
+    int bandCount;
+    std::atomic<int> nextBand;
+    std::atomic<int> finishedBands;
+    QMutex mutex;
+    QWaitCondition allDone;
+};
+
+// Полосы раздаются динамически: каждый поток берет следующую свободную,
+// поэтому медленные участки изображения не тормозят остальные потоки.
+void runBands(BandJob &job) {
+    for (;;) {
+        int band = job.nextBand.fetch_add(1);
+        if (band >= job.bandCount) {
+            return;
+        }
+        int y0 = band * job.bandRows;
+        int y1 = std::min(job.height, y0 + job.bandRows);
+        job.body(y0, y1);
+
+        if (job.finishedBands.fetch_add(1) + 1 == job.bandCount) {
+            QMutexLocker locker(&job.mutex);
+            job.allDone.wakeAll();
+        }
+    }
+}
+
+class BandRunnable : public QRunnable {
+public:
+    explicit BandRunnable(const std::shared_ptr<BandJob> &job) : job(job) {}
+    void run() override {
+        setThreadBandPriority(job->priority);
+        runBands(*job);
+    }
+
+private:
+    std::shared_ptr<BandJob> job;
+};
+
+}
+
+void setThreadBandPriority(int priority) {
+    bandPriority = priority;
+}
+
+int threadBandPriority() {
+    return bandPriority;
+}
+
+ScratchFrame::ScratchFrame() {
+    ScratchArena &arena = scratchArena;
+    markBlock = arena.block;
+    markUsed = arena.used;
+    ++arena.depth;
+}
+
+ScratchFrame::~ScratchFrame() {
+    ScratchArena &arena = scratchArena;
+    arena.block = markBlock;
+    arena.used = markUsed;
+    if (--arena.depth == 0) {
+        arena.compact();
+    }
+}
+
+void *ScratchFrame::allocateBytes(size_t bytes) {
+    ScratchArena &arena = scratchArena;
+    bytes = std::max<size_t>(1, (bytes + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT) * SCRATCH_ALIGNMENT;
+    while (arena.block < arena.blocks.size() && arena.sizes[arena.block] - arena.used < bytes) {
+        ++arena.block;
+        arena.used = 0;
+    }
+    if (arena.block == arena.blocks.size()) {
+        arena.addBlock(bytes);
+    }
+    void *memory = static_cast<char *>(arena.blocks[arena.block]) + arena.used;
+    arena.used += bytes;
+    return memory;
+}
+
+void setFilterThreadCount(int count) {
+    requestedThreadCount = std::max(0, count);
+}
+
+int filterThreadCount() {
+    int count = requestedThreadCount;
+    return count > 0 ? count : std::max(1, QThread::idealThreadCount());
+}
+
+int rowBandHeight(int height, int minBandRows) {
+    int threads = filterThreadCount();
+    minBandRows = std::max(1, minBandRows);
+
+    // Несколько полос на поток сглаживают неравномерную нагрузку.
+    int bandCount = std::min(threads * 4, (height + minBandRows - 1) / minBandRows);
+    if (threads == 1 || bandCount <= 1) {
+        return std::max(1, height);
+    }
+    return (height + bandCount - 1) / bandCount;
+}
+
+void parallelForRows(int height, int minBandRows, const std::function<void(int, int)> &body) {
+    if (height <= 0) {
+        return;
+    }
+    parallelForBands(height, rowBandHeight(height, minBandRows), body);
+}
+
+void parallelForBands(int height, int bandRows, const std::function<void(int, int)> &body) {
+    if (height <= 0) {
+        return;
+    }
+
+    int threads = filterThreadCount();
+    bandRows = std::max(1, bandRows);
+    int bandCount = (height + bandRows - 1) / bandRows;
+    if (threads == 1 || bandCount <= 1) {
+        for (int y0 = 0; y0 < height; y0 += bandRows) {
+            body(y0, std::min(height, y0 + bandRows));
+        }
+        return;
+    }
+
+    std::shared_ptr<BandJob> job = std::make_shared<BandJob>();
+    job->body = body;
+    job->priority = bandPriority;
+    job->height = height;
+    job->bandRows = bandRows;
+    job->bandCount = bandCount;
+    job->nextBand = 0;
+    job->finishedBands = 0;
+
+    QThreadPool *pool = filterPool();
+    pool->setMaxThreadCount(std::max(1, threads - 1));
+    int helpers = std::min(threads - 1, job->bandCount - 1);
+    for (int i = 0; i < helpers; ++i) {
+        pool->start(new BandRunnable(job), job->priority);
+    }
+
+    // Вызывающий поток тоже берет полосы, так что вложенные вызовы
+    // из рабочих потоков не могут зависнуть в ожидании пула.
+    runBands(*job);
+
+    QMutexLocker locker(&job->mutex);
+    while (job->finishedBands.load() < job->bandCount) {
+        job->allDone.wait(&job->mutex);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+// Количество потоков, на которых выполняются фильтры (0 — по числу ядер).
+void setFilterThreadCount(int count);
+int filterThreadCount();
+
+// Делит строки [0, height) на полосы не короче minBandRows и обрабатывает
+// их на пуле потоков. body(y0, y1) вызывается для каждой полосы.
+void parallelForRows(int height, int minBandRows, const std::function<void(int, int)> &body);
+
+// Высота полос, на которые parallelForRows делит height строк
+// (последняя полоса может быть короче).
+int rowBandHeight(int height, int minBandRows);
+
+// То же, что parallelForRows, но полосы ровно по bandRows строк: нужно,
+// когда границы полос известны заранее, например для свертки на месте.
+void parallelForBands(int height, int bandRows, const std::function<void(int, int)> &body);
+
+// Приоритет полос, которые поток отдает пулу (см. QThreadPool::start):
+// когда обрабатываются несколько изображений сразу, свободные потоки
+// берут сначала полосы более срочной задачи. Планировщик задач выставляет
+// его своим потокам по приоритету задачи; вспомогательные потоки полос
+// наследуют приоритет задачи.
+void setThreadBandPriority(int priority);
+int threadBandPriority();
+
+// Рабочая память полосы из запаса потока. Буферы, которые полосы берут
+// на каждую полосу заново (кольца строк, блоки отсчетов), выделяются из
+// него без обращения к распределителю памяти и переиспользуются между
+// полосами и задачами. Память освобождается вместе с кадром; кадры
+// вложенных вызовов берут память дальше, не задевая внешних. Память не
+// инициализирована и выровнена на 64 байта.
+class ScratchFrame {
+public:
+    ScratchFrame();
+    ~ScratchFrame();
+
+    template <typename T>
+    T *allocate(size_t count) {
+        return static_cast<T *>(allocateBytes(count * sizeof(T)));
+    }
+
+private:
+    ScratchFrame(const ScratchFrame &);
+    ScratchFrame &operator=(const ScratchFrame &);
+
+    void *allocateBytes(size_t bytes);
+
+    // Вершина запаса при открытии кадра, к ней он возвращается.
+    size_t markBlock;
+    size_t markUsed;
+};
+
+// Флаг отмены долгой обработки. Фильтры проверяют его между строками
+// или блоками и, если он выставлен, выходят, не доделав работу:
+// содержимое изображения тогда не определено.
+typedef std::atomic<bool> CancelFlag;
+
+inline bool isCancelled(const CancelFlag *cancel) {
+    return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+#endif
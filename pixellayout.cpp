@@ -0,0 +1,160 @@
+#include "pixellayout.h"
+#include "trace.h"
+#include <QSysInfo>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Байт альфы в пикселе QRgb (0xAARRGGBB) в памяти.
+const int ARGB_ALPHA_BYTE = QSysInfo::ByteOrder == QSysInfo::LittleEndian ? 3 : 0;
+
+template <typename Channel>
+void finishPixels(const PixelLayout &layout, Channel *row, int width, Channel maxValue) {
+    const int channels = layout.channels;
+    const int alpha = layout.alphaChannel;
+    if (layout.alpha == AlphaOpaque) {
+        for (int x = 0; x < width; ++x) {
+            row[x * channels + alpha] = maxValue;
+        }
+        return;
+    }
+    for (int x = 0; x < width; ++x) {
+        Channel *pixel = row + x * channels;
+        for (int c = 0; c < channels; ++c) {
+            pixel[c] = std::min(pixel[c], pixel[alpha]);
+        }
+    }
+}
+
+}
+
+PixelLayout::PixelLayout(QImage::Format format)
+    : format(format), channels(0), channelBytes(1), alpha(AlphaAbsent), alphaChannel(-1) {
+    switch (format) {
+    case QImage::Format_RGB32:
+        channels = 4;
+        alpha = AlphaOpaque;
+        alphaChannel = ARGB_ALPHA_BYTE;
+        break;
+    case QImage::Format_ARGB32_Premultiplied:
+        channels = 4;
+        alpha = AlphaPremultiplied;
+        alphaChannel = ARGB_ALPHA_BYTE;
+        break;
+    case QImage::Format_RGBX8888:
+        channels = 4;
+        alpha = AlphaOpaque;
+        alphaChannel = 3;
+        break;
+    case QImage::Format_RGBA8888_Premultiplied:
+        channels = 4;
+        alpha = AlphaPremultiplied;
+        alphaChannel = 3;
+        break;
+    case QImage::Format_RGB888:
+        channels = 3;
+        break;
+    case QImage::Format_Grayscale8:
+        channels = 1;
+        break;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    case QImage::Format_RGBX64:
+        channels = 4;
+        channelBytes = 2;
+        alpha = AlphaOpaque;
+        alphaChannel = 3;
+        break;
+    case QImage::Format_RGBA64_Premultiplied:
+        channels = 4;
+        channelBytes = 2;
+        alpha = AlphaPremultiplied;
+        alphaChannel = 3;
+        break;
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    case QImage::Format_Grayscale16:
+        channels = 1;
+        channelBytes = 2;
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+QImage::Format toFilterFormat(QImage &image) {
+    const QImage::Format format = image.format();
+    if (PixelLayout(format).isValid()) {
+        return QImage::Format_Invalid;
+    }
+
+    QImage::Format working = QImage::Format_RGB32;
+    QImage::Format restore = QImage::Format_Invalid;
+    if (format == QImage::Format_RGBA8888) {
+        working = QImage::Format_RGBA8888_Premultiplied;
+        restore = format;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    } else if (format == QImage::Format_RGBA64) {
+        working = QImage::Format_RGBA64_Premultiplied;
+        restore = format;
+#endif
+    } else if (image.hasAlphaChannel()) {
+        working = QImage::Format_ARGB32_Premultiplied;
+        restore = QImage::Format_ARGB32;
+    }
+
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    TraceScope scope("convertToFormat", pixels, image.sizeInBytes());
+    // Неразделенные данные переводятся на месте, без второго буфера.
+    image = std::move(image).convertToFormat(working);
+    return restore;
+}
+
+void restoreFilterFormat(QImage &image, QImage::Format format) {
+    if (format == QImage::Format_Invalid || image.isNull()) {
+        return;
+    }
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    TraceScope scope("convertToFormat", pixels, image.sizeInBytes());
+    image = std::move(image).convertToFormat(format);
+}
+
+std::vector<uchar> constantRow(const PixelLayout &layout, const Border &border, int width) {
+    std::vector<uchar> row;
+    if (border.mode != BorderConstant || !layout.isValid()) {
+        return row;
+    }
+    // Цвет переводится в формат самим Qt: так серый и премультиплицированный
+    // цвет получаются теми же, что при преобразовании изображения.
+    QImage pixel(1, 1, QImage::Format_ARGB32);
+    pixel.setPixel(0, 0, border.color);
+    pixel = pixel.convertToFormat(layout.format);
+    const int bytes = layout.pixelBytes();
+    row.resize(static_cast<size_t>(width) * bytes);
+    for (int x = 0; x < width; ++x) {
+        std::memcpy(row.data() + static_cast<size_t>(x) * bytes, pixel.constScanLine(0), bytes);
+    }
+    return row;
+}
+
+void finishRow(const PixelLayout &layout, uchar *row, int width) {
+    if (layout.alpha == AlphaAbsent) {
+        return;
+    }
+    if (layout.alpha == AlphaOpaque && layout.pixelBytes() == 4) {
+        // Альфа-заполнитель выставляется одним OR на пиксель, как qRgb().
+        uchar maskBytes[4] = {0, 0, 0, 0};
+        maskBytes[layout.alphaChannel] = 0xff;
+        quint32 mask;
+        std::memcpy(&mask, maskBytes, 4);
+        quint32 *pixels = reinterpret_cast<quint32 *>(row);
+        for (int x = 0; x < width; ++x) {
+            pixels[x] |= mask;
+        }
+    } else if (layout.channelBytes == 2) {
+        finishPixels<quint16>(layout, reinterpret_cast<quint16 *>(row), width, 0xffff);
+    } else {
+        finishPixels<uchar>(layout, row, width, 0xff);
+    }
+}
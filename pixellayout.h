@@ -0,0 +1,57 @@
+#ifndef PIXELLAYOUT_H
+#define PIXELLAYOUT_H
+
+#include "border.h"
+#include <QImage>
+#include <vector>
+
+// Что делает свертка с альфой формата.
+enum AlphaHandling {
+    // Альфы нет: Grayscale8, RGB888, Grayscale16.
+    AlphaAbsent,
+    // Канал альфы — заполнитель, в результате он максимальный (RGB32, RGBX64).
+    AlphaOpaque,
+    // Альфа сворачивается вместе с цветом, затем цвет ограничивается
+    // альфой, чтобы пиксель остался допустимым (ядра с отрицательными
+    // весами могли бы поднять цвет выше нее).
+    AlphaPremultiplied
+};
+
+// Раскладка пикселя формата, который фильтры обрабатывают без
+// преобразования: channels каналов по channelBytes байт подряд, и каждый
+// сворачивается отдельно. Для формата, который так не обрабатывается,
+// channels == 0.
+struct PixelLayout {
+    explicit PixelLayout(QImage::Format format);
+
+    bool isValid() const { return channels > 0; }
+    int pixelBytes() const { return channels * channelBytes; }
+
+    QImage::Format format;
+    int channels;
+    int channelBytes;
+    AlphaHandling alpha;
+    // Номер канала альфы в пикселе (в порядке в памяти) или -1.
+    int alphaChannel;
+};
+
+// Переводит image в формат, который фильтры обрабатывают без
+// преобразования (см. PixelLayout), и возвращает формат, в который нужно
+// вернуть результат через restoreFilterFormat, или Format_Invalid, если
+// возвращать не нужно. Форматы с отдельной альфой (ARGB32, RGBA8888,
+// RGBA64) сворачиваются в премультиплицированном виде, иначе цвет
+// прозрачных пикселей протекал бы в соседние; это полный проход туда и
+// обратно, поэтому прямая свертка filter2D обходит его для ARGB32.
+// Прочие форматы, как и раньше, становятся RGB32, а с альфой — ARGB32.
+QImage::Format toFilterFormat(QImage &image);
+void restoreFilterFormat(QImage &image, QImage::Format format);
+
+// Строка из width пикселей цвета border.color в раскладке layout для
+// BorderConstant; пустая при других режимах.
+std::vector<uchar> constantRow(const PixelLayout &layout, const Border &border, int width);
+
+// Доводит строку результата свертки: заполняет альфу-заполнитель или
+// ограничивает цвет альфой (см. AlphaHandling).
+void finishRow(const PixelLayout &layout, uchar *row, int width);
+
+#endif
@@ -0,0 +1,403 @@
+#include "rankfilter.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include "trace.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+const int FINE_BINS = 256;
+const int COARSE_BINS = 16;
+const int FINE_PER_COARSE = FINE_BINS / COARSE_BINS;
+
+// Строки изображения с продолжением за краем по вертикали.
+struct RowSource {
+    const uchar *bits;
+    int stride;
+    int height;
+    BorderMode mode;
+
+    // nullptr — строка за краем при BorderConstant.
+    const uchar *row(int y) const {
+        int sourceY = borderIndex(y, height, mode);
+        return sourceY < 0 ? nullptr : bits + static_cast<size_t>(sourceY) * stride;
+    }
+};
+
+// Медиана по полосе строк. Столбцы гистограмм идут с radius столбцами
+// продолжения слева и справа: окно пикселя x — столбцы [x, x + 2 * radius].
+// Каналы обрабатываются по очереди, так что гистограммы нужны только для
+// одного канала.
+class MedianBand {
+public:
+    MedianBand(const RowSource &source, int width, int channels, int radius, BorderMode mode,
+               const uchar *constantPixel, ScratchFrame &frame);
+
+    void run(uchar *targetBits, int targetStride, int y0, int y1, const CancelFlag *cancel, StatsCollector *stats);
+
+private:
+    int value(const uchar *row, int column, int channel) const {
+        int x = sourceX[column];
+        return row != nullptr && x >= 0 ? row[x * channels + channel] : constantPixel[channel];
+    }
+
+    void addRow(const uchar *row, int channel, int delta);
+    // Доводит точные корзины грубой корзины segment до окна пикселя x.
+    void syncFine(int segment, int x);
+    void medianRow(uchar *dst, int channel);
+
+    const RowSource &source;
+    const int width;
+    const int channels;
+    const int window;
+    const int columns;
+    // Номер отсчета медианы среди window * window отсортированных.
+    const int rank;
+    const uchar *constantPixel;
+    int *sourceX;
+    quint16 *columnFine;
+    quint16 *columnCoarse;
+    int kernelCoarse[COARSE_BINS];
+    int kernelFine[FINE_BINS];
+    // Пиксель, для окна которого посчитаны точные корзины, или -1.
+    int synced[COARSE_BINS];
+};
+
+MedianBand::MedianBand(const RowSource &source, int width, int channels, int radius, BorderMode mode,
+                       const uchar *constantPixel, ScratchFrame &frame)
+    : source(source), width(width), channels(channels), window(2 * radius + 1), columns(width + 2 * radius),
+      rank(window * window / 2), constantPixel(constantPixel) {
+    sourceX = frame.allocate<int>(columns);
+    columnFine = frame.allocate<quint16>(static_cast<size_t>(columns) * FINE_BINS);
+    columnCoarse = frame.allocate<quint16>(static_cast<size_t>(columns) * COARSE_BINS);
+    for (int column = 0; column < columns; ++column) {
+        sourceX[column] = borderIndex(column - radius, width, mode);
+    }
+}
+
+void MedianBand::addRow(const uchar *row, int channel, int delta) {
+    for (int column = 0; column < columns; ++column) {
+        int v = value(row, column, channel);
+        columnFine[column * FINE_BINS + v] += delta;
+        columnCoarse[column * COARSE_BINS + (v >> 4)] += delta;
+    }
+}
+
+void MedianBand::syncFine(int segment, int x) {
+    int *fine = kernelFine + segment * FINE_PER_COARSE;
+    auto addColumn = [&](int column, int sign) {
+        const quint16 *bins = columnFine + column * FINE_BINS + segment * FINE_PER_COARSE;
+        for (int b = 0; b < FINE_PER_COARSE; ++b) {
+            fine[b] += sign * bins[b];
+        }
+    };
+
+    const int last = synced[segment];
+    if (last < 0 || 2 * (x - last) >= window) {
+        // Заново по окну дешевле, чем сдвигать на столько столбцов.
+        std::fill(fine, fine + FINE_PER_COARSE, 0);
+        for (int column = x; column < x + window; ++column) {
+            addColumn(column, 1);
+        }
+    } else {
+        for (int column = last; column < x; ++column) {
+            addColumn(column, -1);
+            addColumn(column + window, 1);
+        }
+    }
+    synced[segment] = x;
+}
+
+void MedianBand::medianRow(uchar *dst, int channel) {
+    std::fill(kernelCoarse, kernelCoarse + COARSE_BINS, 0);
+    for (int column = 0; column < window; ++column) {
+        const quint16 *coarse = columnCoarse + column * COARSE_BINS;
+        for (int k = 0; k < COARSE_BINS; ++k) {
+            kernelCoarse[k] += coarse[k];
+        }
+    }
+    std::fill(synced, synced + COARSE_BINS, -1);
+
+    for (int x = 0; x < width; ++x) {
+        if (x > 0) {
+            const quint16 *added = columnCoarse + (x + window - 1) * COARSE_BINS;
+            const quint16 *removed = columnCoarse + (x - 1) * COARSE_BINS;
+            for (int k = 0; k < COARSE_BINS; ++k) {
+                kernelCoarse[k] += added[k] - removed[k];
+            }
+        }
+        int count = 0;
+        int segment = 0;
+        while (count + kernelCoarse[segment] <= rank) {
+            count += kernelCoarse[segment];
+            ++segment;
+        }
+        syncFine(segment, x);
+        int bin = segment * FINE_PER_COARSE;
+        for (;; ++bin) {
+            count += kernelFine[bin];
+            if (count > rank) {
+                break;
+            }
+        }
+        dst[x * channels + channel] = static_cast<uchar>(bin);
+    }
+}
+
+void MedianBand::run(uchar *targetBits, int targetStride, int y0, int y1, const CancelFlag *cancel,
+                     StatsCollector *stats) {
+    StatsCollector::Band band(stats);
+    const int radius = window / 2;
+    for (int channel = 0; channel < channels; ++channel) {
+        std::fill(columnFine, columnFine + static_cast<size_t>(columns) * FINE_BINS, 0);
+        std::fill(columnCoarse, columnCoarse + static_cast<size_t>(columns) * COARSE_BINS, 0);
+        for (int y = y0 - radius; y <= y0 + radius; ++y) {
+            addRow(source.row(y), channel, 1);
+        }
+        for (int y = y0; y < y1; ++y) {
+            if (isCancelled(cancel)) {
+                return;
+            }
+            if (y > y0) {
+                addRow(source.row(y - radius - 1), channel, -1);
+                addRow(source.row(y + radius), channel, 1);
+            }
+            uchar *dst = targetBits + static_cast<size_t>(y) * targetStride;
+            medianRow(dst, channel);
+            if (channel == channels - 1) {
+                band.addRow(reinterpret_cast<const QRgb *>(dst), width);
+            }
+        }
+    }
+}
+
+struct MinOf {
+    template <typename T>
+    static T apply(T a, T b) { return std::min(a, b); }
+};
+
+struct MaxOf {
+    template <typename T>
+    static T apply(T a, T b) { return std::max(a, b); }
+};
+
+template <typename Select, typename Channel>
+inline void selectSpan(Channel *dst, const Channel *a, const Channel *b, int count) {
+    for (int i = 0; i < count; ++i) {
+        dst[i] = Select::apply(a[i], b[i]);
+    }
+}
+
+// Проход по строке: ext — строка с radius пикселями продолжения с каждой
+// стороны, prefix и suffix — рабочие буферы той же длины.
+template <typename Select, typename Channel>
+void selectRowRuns(const Channel *src, const Channel *constantPixel, Channel *dst, int width, int channels,
+                   int radius, BorderMode mode, Channel *ext, Channel *prefix, Channel *suffix) {
+    const int window = 2 * radius + 1;
+    const int length = width + 2 * radius;
+    std::copy(src, src + width * channels, ext + radius * channels);
+    for (int e = 0; e < radius; ++e) {
+        int left = borderIndex(e - radius, width, mode);
+        int right = borderIndex(width + e, width, mode);
+        const Channel *leftPixel = left < 0 ? constantPixel : src + left * channels;
+        const Channel *rightPixel = right < 0 ? constantPixel : src + right * channels;
+        std::copy(leftPixel, leftPixel + channels, ext + e * channels);
+        std::copy(rightPixel, rightPixel + channels, ext + (width + radius + e) * channels);
+    }
+
+    for (int start = 0; start < length; start += window) {
+        const int begin = start * channels;
+        const int end = std::min(length, start + window) * channels;
+        std::copy(ext + begin, ext + begin + channels, prefix + begin);
+        for (int i = begin + channels; i < end; ++i) {
+            prefix[i] = Select::apply(prefix[i - channels], ext[i]);
+        }
+        std::copy(ext + end - channels, ext + end, suffix + end - channels);
+        for (int i = end - channels - 1; i >= begin; --i) {
+            suffix[i] = Select::apply(suffix[i + channels], ext[i]);
+        }
+    }
+    // Окно пикселя x — ext[x, x + window - 1]: хвост блока, где начинается
+    // окно, и начало следующего.
+    selectSpan<Select>(dst, suffix, prefix + (window - 1) * channels, width * channels);
+}
+
+template <typename Select, typename Channel>
+void morphology(QImage &image, int radius, const PixelLayout &layout, const FilterOptions &options,
+                StatsCollector *stats) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = layout.channels;
+    const int rowLength = width * channels;
+    const int window = 2 * radius + 1;
+    const BorderMode mode = options.border.mode;
+    const std::vector<uchar> constant = constantRow(layout, options.border, width);
+    const Channel *constantPixels = constant.empty() ? nullptr : reinterpret_cast<const Channel *>(constant.data());
+
+    // Сначала по строкам во временное изображение, затем по столбцам.
+    QImage horizontal(image.size(), image.format());
+    const uchar *srcBits = image.constBits();
+    const int srcStride = image.bytesPerLine();
+    uchar *rowBits = horizontal.bits();
+    const int rowStride = horizontal.bytesPerLine();
+    parallelForRows(height, 8, [&](int y0, int y1) {
+        TraceScope bandScope("rankFilter rows", static_cast<qint64>(y1 - y0) * width,
+                             static_cast<qint64>(y1 - y0) * rowStride);
+        const size_t length = static_cast<size_t>(width + 2 * radius) * channels;
+        ScratchFrame frame;
+        Channel *ext = frame.allocate<Channel>(length);
+        Channel *prefix = frame.allocate<Channel>(length);
+        Channel *suffix = frame.allocate<Channel>(length);
+        for (int y = y0; y < y1 && !isCancelled(options.cancel); ++y) {
+            selectRowRuns<Select>(reinterpret_cast<const Channel *>(srcBits + static_cast<size_t>(y) * srcStride),
+                                  constantPixels,
+                                  reinterpret_cast<Channel *>(rowBits + static_cast<size_t>(y) * rowStride),
+                                  width, channels, radius, mode, ext, prefix, suffix);
+        }
+    });
+    if (isCancelled(options.cancel)) {
+        return;
+    }
+
+    // Исходные пиксели больше не нужны: если их никто не держит, второй
+    // проход пишет прямо в них.
+    if (!image.isDetached()) {
+        takeSourceImage(image);
+    }
+    const RowSource rows = {horizontal.constBits(), rowStride, height, mode};
+    uchar *targetBits = image.bits();
+    const int targetStride = image.bytesPerLine();
+    parallelForRows(height, std::max(8, window), [&](int y0, int y1) {
+        TraceScope bandScope("rankFilter columns", static_cast<qint64>(y1 - y0) * width,
+                             static_cast<qint64>(y1 - y0) * targetStride);
+        ScratchFrame frame;
+        // Строки блока ван Херка вниз: suffix[j] — от строки j блока до его
+        // конца, prefix[j] — от начала следующего блока до строки j в нем.
+        Channel *suffix = frame.allocate<Channel>(static_cast<size_t>(window) * rowLength);
+        Channel *prefix = frame.allocate<Channel>(static_cast<size_t>(std::max(1, window - 1)) * rowLength);
+        StatsCollector::Band band(stats);
+        auto row = [&](int y) {
+            const uchar *bits = rows.row(y);
+            return bits != nullptr ? reinterpret_cast<const Channel *>(bits) : constantPixels;
+        };
+
+        // Блоки выровнены так, что окна строк c0 .. c0 + window - 1
+        // начинаются в одном блоке.
+        for (int c0 = y0; c0 < y1 && !isCancelled(options.cancel); c0 += window) {
+            const int count = std::min(window, y1 - c0);
+            const Channel *last = row(c0 - radius + window - 1);
+            std::copy(last, last + rowLength, suffix + static_cast<size_t>(window - 1) * rowLength);
+            for (int j = window - 2; j >= 0; --j) {
+                selectSpan<Select>(suffix + static_cast<size_t>(j) * rowLength,
+                                   suffix + static_cast<size_t>(j + 1) * rowLength, row(c0 - radius + j), rowLength);
+            }
+            for (int j = 0; j + 1 < count; ++j) {
+                const Channel *src = row(c0 + radius + 1 + j);
+                Channel *dst = prefix + static_cast<size_t>(j) * rowLength;
+                if (j == 0) {
+                    std::copy(src, src + rowLength, dst);
+                } else {
+                    selectSpan<Select>(dst, dst - rowLength, src, rowLength);
+                }
+            }
+            for (int j = 0; j < count; ++j) {
+                Channel *dst = reinterpret_cast<Channel *>(targetBits + static_cast<size_t>(c0 + j) * targetStride);
+                if (j == 0) {
+                    std::copy(suffix, suffix + rowLength, dst);
+                } else {
+                    selectSpan<Select>(dst, suffix + static_cast<size_t>(j) * rowLength,
+                                       prefix + static_cast<size_t>(j - 1) * rowLength, rowLength);
+                }
+                band.addRow(reinterpret_cast<const QRgb *>(dst), width);
+            }
+        }
+    });
+}
+
+void median(QImage &image, int radius, const PixelLayout &layout, const FilterOptions &options,
+            StatsCollector *stats) {
+    QImage source = takeSourceImage(image);
+    const std::vector<uchar> constant = constantRow(layout, options.border, 1);
+    const RowSource rows = {source.constBits(), source.bytesPerLine(), source.height(), options.border.mode};
+    const int width = image.width();
+    uchar *targetBits = image.bits();
+    const int targetStride = image.bytesPerLine();
+    // Полоса заново набирает гистограммы столбцов по 2 * radius + 1
+    // строкам, поэтому полосы не короче двух окон.
+    parallelForRows(image.height(), std::max(16, 2 * (2 * radius + 1)), [&](int y0, int y1) {
+        TraceScope bandScope("rankFilter median band", static_cast<qint64>(y1 - y0) * width,
+                             static_cast<qint64>(y1 - y0) * targetStride);
+        ScratchFrame frame;
+        MedianBand band(rows, width, layout.channels, radius, options.border.mode,
+                        constant.empty() ? nullptr : constant.data(), frame);
+        band.run(targetBits, targetStride, y0, y1, options.cancel, stats);
+    });
+}
+
+// 8-битный формат, по которому считается медиана 16-битного.
+QImage::Format narrowFormat(QImage::Format format) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    if (format == QImage::Format_Grayscale16) {
+        return QImage::Format_Grayscale8;
+    }
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    if (format == QImage::Format_RGBA64_Premultiplied) {
+        return QImage::Format_ARGB32_Premultiplied;
+    }
+#endif
+    return QImage::Format_RGB32;
+}
+
+}
+
+void rankFilter(QImage &image, RankOperation operation, int radius, const FilterOptions &options) {
+    if (image.isNull() || radius <= 0) {
+        return;
+    }
+    const qint64 pixels = static_cast<qint64>(image.width()) * image.height();
+    const QImage::Format restore = toFilterFormat(image);
+    QImage::Format wide = QImage::Format_Invalid;
+    if (operation == RankMedian && PixelLayout(image.format()).channelBytes == 2) {
+        wide = image.format();
+        TraceScope convertScope("convertToFormat", pixels, image.sizeInBytes());
+        image = std::move(image).convertToFormat(narrowFormat(wide));
+    }
+    const PixelLayout layout(image.format());
+    TraceScope scope("rankFilter", pixels, pixels * layout.pixelBytes());
+
+    // Строки собираются при записи, только если результат остается RGB32.
+    bool collect = options.stats != nullptr && image.format() == QImage::Format_RGB32 &&
+                   restore == QImage::Format_Invalid && wide == QImage::Format_Invalid;
+    std::unique_ptr<StatsCollector> stats(collect ? new StatsCollector : nullptr);
+    if (operation == RankMedian) {
+        median(image, radius, layout, options, stats.get());
+    } else if (layout.channelBytes == 2) {
+        if (operation == RankErode) {
+            morphology<MinOf, quint16>(image, radius, layout, options, stats.get());
+        } else {
+            morphology<MaxOf, quint16>(image, radius, layout, options, stats.get());
+        }
+    } else if (operation == RankErode) {
+        morphology<MinOf, uchar>(image, radius, layout, options, stats.get());
+    } else {
+        morphology<MaxOf, uchar>(image, radius, layout, options, stats.get());
+    }
+    restoreFilterFormat(image, wide);
+    restoreFilterFormat(image, restore);
+
+    if (options.stats == nullptr || isCancelled(options.cancel)) {
+        return;
+    }
+    if (stats) {
+        stats->finish(*options.stats);
+        return;
+    }
+    ImageStats result;
+    if (computeImageStats(image, result, options.cancel)) {
+        *options.stats = result;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef RANKFILTER_H
+#define RANKFILTER_H
+
+#include "filter2d.h"
+#include <QImage>
+
+// Нелинейные фильтры по квадратному окну (2 * radius + 1) x (2 * radius + 1).
+enum RankOperation {
+    // Медиана окна: убирает импульсный шум, сохраняя края.
+    RankMedian,
+    // Минимум окна (эрозия): темные детали растут, светлые сжимаются.
+    RankErode,
+    // Максимум окна (дилатация).
+    RankDilate
+};
+
+// Каждый канал фильтруется отдельно, время на пиксель не зависит от radius.
+//
+// Медиана — скользящие гистограммы (Perreault, Hébert): у каждого столбца
+// гистограмма 2 * radius + 1 строк окна, которая при переходе на строку
+// вниз меняется на два отсчета, а гистограмма окна при шаге вправо
+// получает столбец справа и теряет столбец слева. Гистограммы двухуровневые:
+// 16 грубых корзин обновляются на каждом шаге, а 256 точных — только в той
+// грубой корзине, где нашлась медиана, и только на столбцы, пропущенные с
+// ее прошлого обновления.
+//
+// Эрозия и дилатация — раздельно по строкам и столбцам алгоритмом
+// ван Херка — Гиля — Вермана: ряд делится на блоки ширины окна, в каждом
+// считаются минимумы от начала блока и до его конца, и минимум окна —
+// меньший из двух, то есть три сравнения на отсчет при любом радиусе.
+//
+// Форматы — как у filter2D (см. toFilterFormat); у премультиплицированных
+// минимум, максимум и медиана по каналам не поднимают цвет выше альфы.
+// 16-битные форматы медиана считает по 8-битной копии. Продолжение за
+// краем — options.border. Полосы строк обрабатываются параллельно.
+void rankFilter(QImage &image, RankOperation operation, int radius, const FilterOptions &options = FilterOptions());
+
+#endif
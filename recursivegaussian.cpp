@@ -0,0 +1,254 @@
+#include "recursivegaussian.h"
+#include "filter2d.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Фильтр ведется сразу по BLOCK_PIXELS пикселям (строкам или столбцам),
+// так что каждый отсчет — LANES независимых значений подряд в памяти (у
+// форматов уже 4 байт часть значений не используется). Постоянная длина
+// внутреннего цикла позволяет компилятору его векторизовать.
+const int BLOCK_PIXELS = 16;
+const int LANES = BLOCK_PIXELS * 4;
+
+// Один шаг рекурсии для LANES значений. Все указатели различны, а __restrict
+// и постоянная длина цикла дают компилятору векторизовать его без проверок.
+inline void recursiveStep(const float *c, const float *d, float *__restrict out,
+                          const float *__restrict x0, const float *__restrict x1,
+                          const float *__restrict x2, const float *__restrict x3,
+                          const float *__restrict y1, const float *__restrict y2,
+                          const float *__restrict y3, const float *__restrict y4) {
+    const float c0 = c[0], c1 = c[1], c2 = c[2], c3 = c[3];
+    const float d0 = d[0], d1 = d[1], d2 = d[2], d3 = d[3];
+    for (int l = 0; l < LANES; ++l) {
+        out[l] = c0 * x0[l] + c1 * x1[l] + c2 * x2[l] + c3 * x3[l]
+               - d0 * y1[l] - d1 * y2[l] - d2 * y3[l] - d3 * y4[l];
+    }
+}
+
+inline void addTo(float *__restrict out, const float *__restrict v) {
+    for (int l = 0; l < LANES; ++l) {
+        out[l] += v[l];
+    }
+}
+
+// Фильтр вдоль последовательности из count отсчетов по LANES значений.
+// Результат прямого прохода пишется в y, обратный проход добавляется к нему.
+void recursiveLine(const RecursiveGaussian &g, const float *x, float *y,
+                   int count, std::vector<float> &scratch) {
+    // Продолжение за краем и кольцо из пяти последних отсчетов обратного прохода.
+    scratch.resize(static_cast<size_t>(LANES) * 6);
+    float *steady = scratch.data();
+    float *history = scratch.data() + LANES;
+
+    for (int l = 0; l < LANES; ++l) {
+        steady[l] = x[l] * g.causalGain;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const float *xs[4];
+        const float *ys[4];
+        for (int k = 0; k < 4; ++k) {
+            xs[k] = x + static_cast<size_t>(std::max(i - k, 0)) * LANES;
+            ys[k] = i > k ? y + static_cast<size_t>(i - k - 1) * LANES : steady;
+        }
+        recursiveStep(g.causal, g.feedback, y + static_cast<size_t>(i) * LANES,
+                      xs[0], xs[1], xs[2], xs[3], ys[0], ys[1], ys[2], ys[3]);
+    }
+
+    const float *last = x + static_cast<size_t>(count - 1) * LANES;
+    for (int l = 0; l < LANES; ++l) {
+        steady[l] = last[l] * g.anticausalGain;
+    }
+
+    for (int i = count - 1; i >= 0; --i) {
+        const float *xs[4];
+        const float *ys[4];
+        for (int k = 0; k < 4; ++k) {
+            int j = i + k + 1;
+            xs[k] = x + static_cast<size_t>(std::min(j, count - 1)) * LANES;
+            ys[k] = j < count ? history + static_cast<size_t>(j % 5) * LANES : steady;
+        }
+        float *slot = history + static_cast<size_t>(i % 5) * LANES;
+        recursiveStep(g.anticausal, g.feedback, slot,
+                      xs[0], xs[1], xs[2], xs[3], ys[0], ys[1], ys[2], ys[3]);
+        addTo(y + static_cast<size_t>(i) * LANES, slot);
+    }
+}
+
+inline uchar toByte(float v) {
+    return static_cast<uchar>(std::max(0, std::min(255, static_cast<int>(v + 0.5f))));
+}
+
+}
+
+RecursiveGaussian::RecursiveGaussian(double sigma) {
+    // Коэффициенты приближения гауссианы суммой двух затухающих гармоник.
+    const double a0 = 1.680, a1 = 3.735, b0 = 1.783, w0 = 0.6318;
+    const double c0 = -0.6803, c1 = -0.2598, b1 = 1.723, w1 = 1.997;
+
+    double cos0 = std::cos(w0 / sigma), sin0 = std::sin(w0 / sigma), e0 = std::exp(-b0 / sigma);
+    double cos1 = std::cos(w1 / sigma), sin1 = std::sin(w1 / sigma), e1 = std::exp(-b1 / sigma);
+
+    double n[4], d[4], m[4];
+    n[0] = a0 + c0;
+    n[1] = e1 * (c1 * sin1 - (c0 + 2.0 * a0) * cos1) + e0 * (a1 * sin0 - (2.0 * c0 + a0) * cos0);
+    n[2] = 2.0 * e0 * e1 * ((a0 + c0) * cos1 * cos0 - a1 * cos1 * sin0 - c1 * cos0 * sin1)
+         + c0 * e0 * e0 + a0 * e1 * e1;
+    n[3] = e1 * e0 * e0 * (c1 * sin1 - c0 * cos1) + e0 * e1 * e1 * (a1 * sin0 - a0 * cos0);
+
+    d[0] = -2.0 * e1 * cos1 - 2.0 * e0 * cos0;
+    d[1] = 4.0 * cos1 * cos0 * e0 * e1 + e1 * e1 + e0 * e0;
+    d[2] = -2.0 * cos0 * e0 * e1 * e1 - 2.0 * cos1 * e1 * e0 * e0;
+    d[3] = e0 * e0 * e1 * e1;
+
+    // Ядро симметрично, поэтому обратный проход получается из прямого.
+    m[0] = n[1] - d[0] * n[0];
+    m[1] = n[2] - d[1] * n[0];
+    m[2] = n[3] - d[2] * n[0];
+    m[3] = -d[3] * n[0];
+
+    double sumN = n[0] + n[1] + n[2] + n[3];
+    double sumM = m[0] + m[1] + m[2] + m[3];
+    double sumD = 1.0 + d[0] + d[1] + d[2] + d[3];
+    double gain = (sumN + sumM) / sumD;
+
+    for (int k = 0; k < 4; ++k) {
+        causal[k] = static_cast<float>(n[k] / gain);
+        anticausal[k] = static_cast<float>(m[k] / gain);
+        feedback[k] = static_cast<float>(d[k]);
+    }
+    causalGain = static_cast<float>(sumN / gain / sumD);
+    anticausalGain = static_cast<float>(sumM / gain / sumD);
+}
+
+void recursiveGaussianBlur(QImage &image, double sigma, const CancelFlag *cancel,
+                           StatsCollector *stats) {
+    if (image.isNull() || sigma <= 0.0) {
+        return;
+    }
+    PixelLayout layout(image.format());
+    if (!layout.isValid() || layout.channelBytes != 1) {
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                              : QImage::Format_RGB32);
+        layout = PixelLayout(image.format());
+    }
+    const int pixelBytes = layout.pixelBytes();
+
+    const RecursiveGaussian g(sigma);
+    const int width = image.width();
+    const int height = image.height();
+
+    // Оба прохода читают блок строк или столбцов целиком во float до
+    // записи результата, поэтому пишут прямо в изображение. Разделенные
+    // данные только читаются первым проходом, результат идет в новый буфер.
+    QImage source = image.isDetached() ? QImage() : takeSourceImage(image);
+
+    uchar *imageBits = image.bits();
+    const uchar *sourceBits = source.isNull() ? imageBits : source.constBits();
+    const int imageStride = image.bytesPerLine();
+    const int sourceStride = source.isNull() ? imageStride : source.bytesPerLine();
+
+    // Горизонтальный проход: отсчет — пиксели с одинаковым x из блока строк.
+    int rowBlocks = (height + BLOCK_PIXELS - 1) / BLOCK_PIXELS;
+    parallelForRows(rowBlocks, 1, [&](int b0, int b1) {
+        // Блоки отсчетов берутся из запаса потока: они велики, а полос много.
+        ScratchFrame frame;
+        const size_t samples = static_cast<size_t>(width) * LANES;
+        float *x = frame.allocate<float>(samples);
+        float *y = frame.allocate<float>(samples);
+        std::fill(x, x + samples, 0.0f);
+        std::vector<float> scratch;
+
+        for (int block = b0; block < b1 && !isCancelled(cancel); ++block) {
+            int row0 = block * BLOCK_PIXELS;
+            int rows = std::min(BLOCK_PIXELS, height - row0);
+
+            for (int r = 0; r < rows; ++r) {
+                const uchar *src = sourceBits + static_cast<size_t>(row0 + r) * sourceStride;
+                for (int i = 0; i < width; ++i) {
+                    float *sample = x + static_cast<size_t>(i) * LANES + r * pixelBytes;
+                    for (int c = 0; c < pixelBytes; ++c) {
+                        sample[c] = src[i * pixelBytes + c];
+                    }
+                }
+            }
+            recursiveLine(g, x, y, width, scratch);
+            for (int r = 0; r < rows; ++r) {
+                uchar *dst = imageBits + static_cast<size_t>(row0 + r) * imageStride;
+                for (int i = 0; i < width; ++i) {
+                    const float *sample = y + static_cast<size_t>(i) * LANES + r * pixelBytes;
+                    for (int c = 0; c < pixelBytes; ++c) {
+                        dst[i * pixelBytes + c] = toByte(sample[c]);
+                    }
+                }
+            }
+        }
+    });
+
+    // Вертикальный проход: отсчет — участок строки из BLOCK_PIXELS пикселей.
+    int columnBlocks = (width + BLOCK_PIXELS - 1) / BLOCK_PIXELS;
+    parallelForRows(columnBlocks, 1, [&](int b0, int b1) {
+        ScratchFrame frame;
+        const size_t samples = static_cast<size_t>(height) * LANES;
+        float *x = frame.allocate<float>(samples);
+        float *y = frame.allocate<float>(samples);
+        std::fill(x, x + samples, 0.0f);
+        std::vector<float> scratch;
+        StatsCollector::Band band(stats);
+
+        for (int block = b0; block < b1 && !isCancelled(cancel); ++block) {
+            int x0 = block * BLOCK_PIXELS;
+            int pixels = std::min(BLOCK_PIXELS, width - x0);
+            int lanes = pixels * pixelBytes;
+
+            for (int row = 0; row < height; ++row) {
+                const uchar *src = imageBits + static_cast<size_t>(row) * imageStride + x0 * pixelBytes;
+                float *sample = x + static_cast<size_t>(row) * LANES;
+                for (int l = 0; l < lanes; ++l) {
+                    sample[l] = src[l];
+                }
+            }
+            recursiveLine(g, x, y, height, scratch);
+            for (int row = 0; row < height; ++row) {
+                uchar *dst = imageBits + static_cast<size_t>(row) * imageStride + x0 * pixelBytes;
+                const float *sample = y + static_cast<size_t>(row) * LANES;
+                for (int l = 0; l < lanes; ++l) {
+                    dst[l] = toByte(sample[l]);
+                }
+                finishRow(layout, dst, pixels);
+                band.addRow(reinterpret_cast<const QRgb *>(dst), pixels);
+            }
+        }
+    });
+}
+
+double recursiveGaussianError(size_t size, double sigma) {
+    if (size % 2 == 0) {
+        size++;
+    }
+
+    // Импульсная характеристика на отрезке, заметно шире ядра.
+    int count = static_cast<int>(size) * 4 + 1;
+    int center = count / 2;
+    std::vector<float> x(static_cast<size_t>(count) * LANES, 0.0f), y(x.size()), scratch;
+    x[static_cast<size_t>(center) * LANES] = 1.0f;
+    recursiveLine(RecursiveGaussian(sigma), x.data(), y.data(), count, scratch);
+
+    Kernel gaussian = Kernel::gaussian1D(size, sigma);
+    const double *kernel = gaussian.data();
+    int kCenter = static_cast<int>(size) / 2;
+    double error = 0.0;
+    for (int i = 0; i < count; ++i) {
+        int k = i - center + kCenter;
+        double direct = (k >= 0 && k < static_cast<int>(size)) ? kernel[k] : 0.0;
+        error += std::fabs(y[static_cast<size_t>(i) * LANES] - direct);
+    }
+
+    return error;
+}
@@ -0,0 +1,36 @@
+#ifndef RECURSIVEGAUSSIAN_H
+#define RECURSIVEGAUSSIAN_H
+
+#include "parallel.h"
+#include <QImage>
+#include <cstddef>
+
+class StatsCollector;
+
+// Рекурсивное приближение гауссова ядра четвертого порядка (Deriche, 1993).
+// Свертка сводится к прямому и обратному проходу с 4 + 4 отводами,
+// поэтому стоимость на пиксель не зависит от sigma.
+struct RecursiveGaussian {
+    explicit RecursiveGaussian(double sigma);
+
+    // y+[i] = sum(causal[k] * x[i - k]) - sum(feedback[k] * y+[i - k - 1])
+    // y-[i] = sum(anticausal[k] * x[i + k + 1]) - sum(feedback[k] * y-[i + k + 1])
+    float causal[4];
+    float anticausal[4];
+    float feedback[4];
+    // Отклик на постоянный сигнал, нужен для продолжения края изображения.
+    float causalGain;
+    float anticausalGain;
+};
+
+// Размытие изображения 8-битного формата PixelLayout (прочие переводятся в
+// RGB32/ARGB32_Premultiplied) с продолжением края, как у gaussianBlur. Ядро не обрезается, в отличие от прямой свертки.
+void recursiveGaussianBlur(QImage &image, double sigma, const CancelFlag *cancel = nullptr,
+                           StatsCollector *stats = nullptr);
+
+// Сумма модулей разности импульсной характеристики рекурсивного фильтра
+// и ядра Kernel::gaussian1D(size, sigma). Умноженная на 255, она
+// ограничивает отклонение результата одного прохода в уровнях яркости.
+double recursiveGaussianError(size_t size, double sigma);
+
+#endif
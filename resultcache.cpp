@@ -0,0 +1,269 @@
+#include "resultcache.h"
+#include "jobscheduler.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QMutex>
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+namespace {
+
+// Полоса — несколько сотен килобайт у широких изображений: zlib хватает
+// контекста, а полос достаточно, чтобы занять все потоки.
+const int COMPRESS_BAND_ROWS = 64;
+
+int rowBytes(const QImage &image) {
+    return (image.width() * image.depth() + 7) / 8;
+}
+
+int pixelBytes(int depth) {
+    return std::max(1, depth / 8);
+}
+
+}
+
+qint64 CompressedImage::byteCount() const {
+    qint64 bytes = 0;
+    for (const QByteArray &band : bands) {
+        bytes += band.size();
+    }
+    return bytes;
+}
+
+void compressImage(const QImage &image, CompressedImage &compressed) {
+    TraceScope scope("compressImage", static_cast<qint64>(image.width()) * image.height(), image.sizeInBytes());
+    compressed.width = image.width();
+    compressed.height = image.height();
+    compressed.format = image.format();
+    compressed.colorTable = image.colorTable();
+    compressed.bands.assign((image.height() + COMPRESS_BAND_ROWS - 1) / COMPRESS_BAND_ROWS, QByteArray());
+
+    const int bytes = rowBytes(image);
+    const int step = pixelBytes(image.depth());
+    parallelForBands(image.height(), COMPRESS_BAND_ROWS, [&](int y0, int y1) {
+        QByteArray raw(bytes * (y1 - y0), Qt::Uninitialized);
+        for (int y = y0; y < y1; ++y) {
+            uchar *row = reinterpret_cast<uchar *>(raw.data()) + static_cast<size_t>(y - y0) * bytes;
+            std::memcpy(row, image.constScanLine(y), bytes);
+            for (int i = bytes - 1; i >= step; --i) {
+                row[i] = static_cast<uchar>(row[i] - row[i - step]);
+            }
+        }
+        compressed.bands[y0 / COMPRESS_BAND_ROWS] = qCompress(raw, 1);
+    });
+}
+
+QImage decompressImage(const CompressedImage &compressed) {
+    TraceScope scope("decompressImage", static_cast<qint64>(compressed.width) * compressed.height);
+    QImage image(compressed.width, compressed.height, compressed.format);
+    if (image.isNull()) {
+        return image;
+    }
+    image.setColorTable(compressed.colorTable);
+
+    const int bytes = rowBytes(image);
+    const int step = pixelBytes(image.depth());
+    uchar *bits = image.bits();
+    const int stride = image.bytesPerLine();
+    parallelForBands(image.height(), COMPRESS_BAND_ROWS, [&](int y0, int y1) {
+        const QByteArray raw = qUncompress(compressed.bands[y0 / COMPRESS_BAND_ROWS]);
+        for (int y = y0; y < y1; ++y) {
+            uchar *row = bits + static_cast<size_t>(y) * stride;
+            std::memcpy(row, raw.constData() + static_cast<size_t>(y - y0) * bytes, bytes);
+            for (int i = step; i < bytes; ++i) {
+                row[i] = static_cast<uchar>(row[i] + row[i - step]);
+            }
+        }
+    });
+    return image;
+}
+
+struct ResultCache::Data {
+    struct Entry {
+        Entry() : hasStats(false), compressing(false), lastUse(0) {}
+
+        QImage image;
+        std::shared_ptr<const CompressedImage> compressed;
+        ImageStats stats;
+        bool hasStats;
+        // Сжатие запущено; до его конца image остается в памяти.
+        bool compressing;
+        quint64 lastUse;
+    };
+
+    Data(qint64 memoryBudget, qint64 compressedBudget)
+        : memoryBudget(memoryBudget), compressedBudget(compressedBudget), clock(0) {}
+
+    // Вызывается под mutex.
+    void trim(const std::shared_ptr<Data> &self);
+    qint64 memoryUsedLocked() const;
+    qint64 compressedUsedLocked() const;
+
+    const qint64 memoryBudget;
+    const qint64 compressedBudget;
+    mutable QMutex mutex;
+    std::map<QString, Entry> entries;
+    mutable quint64 clock;
+};
+
+qint64 ResultCache::Data::memoryUsedLocked() const {
+    qint64 bytes = 0;
+    for (const auto &item : entries) {
+        if (!item.second.image.isNull()) {
+            bytes += item.second.image.sizeInBytes();
+        }
+    }
+    return bytes;
+}
+
+qint64 ResultCache::Data::compressedUsedLocked() const {
+    qint64 bytes = 0;
+    for (const auto &item : entries) {
+        if (item.second.compressed) {
+            bytes += item.second.compressed->byteCount();
+        }
+    }
+    return bytes;
+}
+
+// Сжимаемые уже не считаются: их память освободится сама. Самый свежий
+// результат не сжимается никогда.
+void ResultCache::Data::trim(const std::shared_ptr<Data> &self) {
+    for (;;) {
+        qint64 used = 0;
+        int rawCount = 0;
+        auto oldest = entries.end();
+        auto newest = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            const Entry &entry = it->second;
+            if (entry.image.isNull() || entry.compressing) {
+                continue;
+            }
+            used += entry.image.sizeInBytes();
+            ++rawCount;
+            if (oldest == entries.end() || entry.lastUse < oldest->second.lastUse) {
+                oldest = it;
+            }
+            if (newest == entries.end() || entry.lastUse > newest->second.lastUse) {
+                newest = it;
+            }
+        }
+        if (used <= memoryBudget || rawCount <= 1 || oldest == newest) {
+            break;
+        }
+
+        // Распакованный из кэша результат уже имеет сжатую копию.
+        if (oldest->second.compressed) {
+            oldest->second.image = QImage();
+            continue;
+        }
+        oldest->second.compressing = true;
+        const QString key = oldest->first;
+        const QImage image = oldest->second.image;
+        std::weak_ptr<Data> weak = self;
+        submitJob(JobBackground, QString(), std::shared_ptr<CancelFlag>(), [weak, key, image](bool) {
+            std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+            compressImage(image, *compressed);
+            std::shared_ptr<Data> data = weak.lock();
+            if (!data) {
+                return;
+            }
+            QMutexLocker locker(&data->mutex);
+            auto found = data->entries.find(key);
+            // Пока шло сжатие, запись могли удалить или заменить.
+            if (found == data->entries.end() || !found->second.compressing
+                || found->second.image.cacheKey() != image.cacheKey()) {
+                return;
+            }
+            found->second.image = QImage();
+            found->second.compressed = compressed;
+            found->second.compressing = false;
+            data->trim(data);
+        });
+    }
+
+    qint64 compressedUsed = compressedUsedLocked();
+    while (compressedUsed > compressedBudget) {
+        auto oldest = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->second.compressed
+                && (oldest == entries.end() || it->second.lastUse < oldest->second.lastUse)) {
+                oldest = it;
+            }
+        }
+        if (oldest == entries.end()) {
+            break;
+        }
+        compressedUsed -= oldest->second.compressed->byteCount();
+        if (oldest->second.image.isNull()) {
+            entries.erase(oldest);
+        } else {
+            oldest->second.compressed.reset();
+        }
+    }
+}
+
+ResultCache::ResultCache(qint64 memoryBudget, qint64 compressedBudget)
+    : d(std::make_shared<Data>(memoryBudget, compressedBudget)) {}
+
+QString ResultCache::makeKey(const QImage &source, const QString &settings) {
+    return QString::number(source.cacheKey()) + '|' + settings;
+}
+
+void ResultCache::insert(const QString &key, const QImage &image, const ImageStats *stats) {
+    if (image.isNull()) {
+        return;
+    }
+    QMutexLocker locker(&d->mutex);
+    Data::Entry &entry = d->entries[key];
+    // Сжатая копия, если есть, остается: ключ тот же, значит, и пиксели.
+    entry.image = image;
+    entry.compressing = false;
+    entry.hasStats = stats != nullptr;
+    if (stats != nullptr) {
+        entry.stats = *stats;
+    }
+    entry.lastUse = ++d->clock;
+    d->trim(d);
+}
+
+bool ResultCache::find(const QString &key, QImage &image, ImageStats &stats, bool &hasStats) const {
+    QMutexLocker locker(&d->mutex);
+    auto found = d->entries.find(key);
+    if (found == d->entries.end() || found->second.image.isNull()) {
+        return false;
+    }
+    found->second.lastUse = ++d->clock;
+    image = found->second.image;
+    hasStats = found->second.hasStats;
+    if (hasStats) {
+        stats = found->second.stats;
+    }
+    return true;
+}
+
+std::shared_ptr<const CompressedImage> ResultCache::findCompressed(const QString &key) const {
+    QMutexLocker locker(&d->mutex);
+    auto found = d->entries.find(key);
+    if (found == d->entries.end()) {
+        return std::shared_ptr<const CompressedImage>();
+    }
+    found->second.lastUse = ++d->clock;
+    return found->second.compressed;
+}
+
+qint64 ResultCache::memoryUsed() const {
+    QMutexLocker locker(&d->mutex);
+    return d->memoryUsedLocked();
+}
+
+qint64 ResultCache::compressedUsed() const {
+    QMutexLocker locker(&d->mutex);
+    return d->compressedUsedLocked();
+}
+
+void ResultCache::clear() {
+    QMutexLocker locker(&d->mutex);
+    d->entries.clear();
+}
@@ -0,0 +1,64 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include "imagestats.h"
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <QVector>
+#include <memory>
+#include <vector>
+
+// Копия изображения, сжатая без потерь: строки кодируются разностью с
+// соседним пикселем слева (как фильтр Sub в PNG) и сжимаются zlib
+// полосами по несколько десятков строк параллельно.
+struct CompressedImage {
+    CompressedImage() : width(0), height(0), format(QImage::Format_Invalid) {}
+
+    qint64 byteCount() const;
+
+    int width;
+    int height;
+    QImage::Format format;
+    QVector<QRgb> colorTable;
+    std::vector<QByteArray> bands;
+};
+
+void compressImage(const QImage &image, CompressedImage &compressed);
+QImage decompressImage(const CompressedImage &compressed);
+
+// Кэш результатов фильтров по ключу (исходное изображение, фильтр,
+// параметры). Результаты держатся в памяти в пределах memoryBudget байт;
+// давно не использованные сверх него сжимаются в фоне и хранятся сжатыми
+// в пределах compressedBudget, а уже оттуда вытесняются совсем. Последний
+// добавленный результат остается в памяти, даже если он один больше
+// бюджета. Копии делят данные; обращаться можно из нескольких потоков.
+class ResultCache {
+public:
+    ResultCache(qint64 memoryBudget, qint64 compressedBudget);
+
+    // Ключ для результата фильтра с описанием settings, примененного к
+    // source. Источник опознается по QImage::cacheKey: в пределах процесса
+    // он однозначно определяет содержимое, а хэш всех пикселей большого
+    // изображения считался бы дольше иного фильтра.
+    static QString makeKey(const QImage &source, const QString &settings);
+
+    // stats, если задан, — статистика image; она отдается вместе с ним.
+    void insert(const QString &key, const QImage &image, const ImageStats *stats = nullptr);
+
+    // Результат в памяти. hasStats — сохранена ли для него статистика.
+    bool find(const QString &key, QImage &image, ImageStats &stats, bool &hasStats) const;
+    // Сжатый результат или nullptr. Распаковывать его лучше не в потоке
+    // интерфейса; распакованный стоит вернуть в кэш через insert.
+    std::shared_ptr<const CompressedImage> findCompressed(const QString &key) const;
+
+    qint64 memoryUsed() const;
+    qint64 compressedUsed() const;
+    void clear();
+
+private:
+    struct Data;
+    std::shared_ptr<Data> d;
+};
+
+#endif
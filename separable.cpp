@@ -0,0 +1,239 @@
+#include "separable.h"
+#include "filter2d.h"
+#include "imagestats.h"
+#include "parallel.h"
+#include "pixellayout.h"
+#include "spankernels.h"
+#include <QRgb>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Ранг 1: каждая строка ядра пропорциональна строке с наибольшим элементом.
+// Множители берутся прямо из ядра, поэтому для целых ядер вроде Собеля
+// ([-2 -4 -2]^T * [1 0 -1]) разложение точное.
+bool decomposeRankOne(const double *kernel, int kWidth, int kHeight, double tolerance,
+                      SeparableTerm &term) {
+    int pivot = 0;
+    for (int i = 1; i < kWidth * kHeight; ++i) {
+        if (std::fabs(kernel[i]) > std::fabs(kernel[pivot])) {
+            pivot = i;
+        }
+    }
+    double pivotValue = kernel[pivot];
+    if (pivotValue == 0.0) {
+        return false;
+    }
+    int pivotRow = pivot / kWidth;
+    int pivotColumn = pivot % kWidth;
+
+    term.column.resize(kHeight);
+    term.row.resize(kWidth);
+    for (int ky = 0; ky < kHeight; ++ky) {
+        term.column[ky] = kernel[ky * kWidth + pivotColumn];
+    }
+    for (int kx = 0; kx < kWidth; ++kx) {
+        term.row[kx] = kernel[pivotRow * kWidth + kx] / pivotValue;
+    }
+
+    double limit = tolerance * std::fabs(pivotValue);
+    for (int ky = 0; ky < kHeight; ++ky) {
+        for (int kx = 0; kx < kWidth; ++kx) {
+            if (std::fabs(term.column[ky] * term.row[kx] - kernel[ky * kWidth + kx]) > limit) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Одностороннее SVD Якоби: вращения ортогонализуют столбцы A = K * V,
+// после чего K = sum(A[:, j] * V[:, j]^T).
+void decomposeJacobi(const double *kernel, int kWidth, int kHeight, double tolerance,
+                     std::vector<SeparableTerm> &terms) {
+    std::vector<double> a(kernel, kernel + kWidth * kHeight);
+    std::vector<double> v(kWidth * kWidth, 0.0);
+    for (int j = 0; j < kWidth; ++j) {
+        v[j * kWidth + j] = 1.0;
+    }
+
+    for (int sweep = 0; sweep < 60; ++sweep) {
+        bool rotated = false;
+        for (int p = 0; p < kWidth - 1; ++p) {
+            for (int q = p + 1; q < kWidth; ++q) {
+                double alpha = 0.0, beta = 0.0, gamma = 0.0;
+                for (int i = 0; i < kHeight; ++i) {
+                    double ap = a[i * kWidth + p], aq = a[i * kWidth + q];
+                    alpha += ap * ap;
+                    beta += aq * aq;
+                    gamma += ap * aq;
+                }
+                if (std::fabs(gamma) <= 1e-15 * std::sqrt(alpha * beta) || gamma == 0.0) {
+                    continue;
+                }
+                rotated = true;
+
+                double zeta = (beta - alpha) / (2.0 * gamma);
+                double t = (zeta >= 0.0 ? 1.0 : -1.0) / (std::fabs(zeta) + std::sqrt(1.0 + zeta * zeta));
+                double c = 1.0 / std::sqrt(1.0 + t * t);
+                double s = c * t;
+                for (int i = 0; i < kHeight; ++i) {
+                    double ap = a[i * kWidth + p], aq = a[i * kWidth + q];
+                    a[i * kWidth + p] = c * ap - s * aq;
+                    a[i * kWidth + q] = s * ap + c * aq;
+                }
+                for (int i = 0; i < kWidth; ++i) {
+                    double vp = v[i * kWidth + p], vq = v[i * kWidth + q];
+                    v[i * kWidth + p] = c * vp - s * vq;
+                    v[i * kWidth + q] = s * vp + c * vq;
+                }
+            }
+        }
+        if (!rotated) {
+            break;
+        }
+    }
+
+    std::vector<std::pair<double, int> > singular(kWidth);
+    for (int j = 0; j < kWidth; ++j) {
+        double norm = 0.0;
+        for (int i = 0; i < kHeight; ++i) {
+            norm += a[i * kWidth + j] * a[i * kWidth + j];
+        }
+        singular[j] = std::make_pair(std::sqrt(norm), j);
+    }
+    std::sort(singular.rbegin(), singular.rend());
+
+    terms.clear();
+    for (int n = 0; n < kWidth; ++n) {
+        if (singular[n].first <= tolerance * singular[0].first || singular[n].first == 0.0) {
+            break;
+        }
+        int j = singular[n].second;
+        SeparableTerm term;
+        term.column.resize(kHeight);
+        term.row.resize(kWidth);
+        for (int i = 0; i < kHeight; ++i) {
+            term.column[i] = a[i * kWidth + j];
+        }
+        for (int i = 0; i < kWidth; ++i) {
+            term.row[i] = v[i * kWidth + j];
+        }
+        terms.push_back(term);
+    }
+}
+
+}
+
+int decomposeKernel(const double *kernel, int kWidth, int kHeight,
+                    std::vector<SeparableTerm> &terms, double tolerance) {
+    terms.clear();
+    if (kernel == nullptr || kWidth <= 0 || kHeight <= 0) {
+        return 0;
+    }
+
+    SeparableTerm term;
+    if (decomposeRankOne(kernel, kWidth, kHeight, tolerance, term)) {
+        terms.push_back(term);
+        return 1;
+    }
+
+    decomposeJacobi(kernel, kWidth, kHeight, tolerance, terms);
+    return static_cast<int>(terms.size());
+}
+
+bool preferSeparable(int rank, int kWidth, int kHeight) {
+    // Отвод во float с промежуточной строкой обходится примерно втрое
+    // дороже отвода прямой свертки по байтам (замерено на AVX2).
+    return rank > 0 && 3 * rank * (kWidth + kHeight) < kWidth * kHeight;
+}
+
+void separableFilter(QImage &image, const std::vector<SeparableTerm> &terms,
+                     int kWidth, int kHeight, const Border &border,
+                     const CancelFlag *cancel, StatsCollector *stats) {
+    if (image.isNull() || terms.empty() || kWidth <= 0 || kHeight <= 0) {
+        return;
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    const int kCenterX = kWidth / 2;
+    const int kCenterY = kHeight / 2;
+    const int termCount = static_cast<int>(terms.size());
+    const PixelLayout layout(image.format());
+    const int pixelBytes = layout.pixelBytes();
+    const int rowFloats = width * pixelBytes;
+    const std::vector<uchar> constant = constantRow(layout, border, width);
+
+    std::vector<float> rowWeights, columnWeights;
+    for (int t = 0; t < termCount; ++t) {
+        rowWeights.insert(rowWeights.end(), terms[t].row.begin(), terms[t].row.end());
+        columnWeights.insert(columnWeights.end(), terms[t].column.begin(), terms[t].column.end());
+    }
+
+    QImage original = takeSourceImage(image);
+    const uchar *srcBits = original.constBits();
+    uchar *dstBits = image.bits();
+    const int srcStride = original.bytesPerLine();
+    const int dstStride = image.bytesPerLine();
+
+    parallelForRows(height, std::max(8, 2 * kHeight), [&](int y0, int y1) {
+        StatsCollector::Band band(stats);
+        std::vector<uchar> padded(static_cast<size_t>(width + kWidth - 1) * pixelBytes);
+        // Для каждого слагаемого — кольцо из kHeight строк после горизонтального прохода.
+        std::vector<float> ring(static_cast<size_t>(termCount) * kHeight * rowFloats);
+        std::vector<const uchar *> rowTaps(kWidth);
+        std::vector<const float *> columnTaps(termCount * kHeight);
+
+        auto ringRow = [&](int term, int sourceY) {
+            int slot = ((sourceY % kHeight) + kHeight) % kHeight;
+            return ring.data() + (static_cast<size_t>(term) * kHeight + slot) * rowFloats;
+        };
+
+        // Горизонтальный проход строки sourceY (координата может выходить
+        // за изображение) по строке, дополненной по краям по правилу border.
+        auto filterRow = [&](int sourceY) {
+            int pixelY = borderIndex(sourceY, height, border.mode);
+            const uchar *src = pixelY < 0 ? constant.data() : srcBits + static_cast<size_t>(pixelY) * srcStride;
+            auto padPixel = [&](int i) {
+                int pixelX = borderIndex(i - kCenterX, width, border.mode);
+                std::memcpy(padded.data() + i * pixelBytes,
+                            pixelX < 0 ? constant.data() : src + pixelX * pixelBytes, pixelBytes);
+            };
+            for (int i = 0; i < kCenterX; ++i) {
+                padPixel(i);
+            }
+            std::memcpy(padded.data() + kCenterX * pixelBytes, src, rowFloats);
+            for (int i = kCenterX + width; i < width + kWidth - 1; ++i) {
+                padPixel(i);
+            }
+            for (int kx = 0; kx < kWidth; ++kx) {
+                rowTaps[kx] = padded.data() + kx * pixelBytes;
+            }
+            for (int t = 0; t < termCount; ++t) {
+                convolveSpanToFloat(rowTaps.data(), rowWeights.data() + t * kWidth, kWidth,
+                                    ringRow(t, sourceY), rowFloats);
+            }
+        };
+
+        for (int sourceY = y0 - kCenterY; sourceY < y0 - kCenterY + kHeight - 1; ++sourceY) {
+            filterRow(sourceY);
+        }
+
+        for (int y = y0; y < y1 && !isCancelled(cancel); ++y) {
+            filterRow(y - kCenterY + kHeight - 1);
+            for (int t = 0; t < termCount; ++t) {
+                for (int ky = 0; ky < kHeight; ++ky) {
+                    columnTaps[t * kHeight + ky] = ringRow(t, y - kCenterY + ky);
+                }
+            }
+
+            uchar *dst = dstBits + static_cast<size_t>(y) * dstStride;
+            convolveFloatSpan(columnTaps.data(), columnWeights.data(), termCount * kHeight, dst, rowFloats);
+            finishRow(layout, dst, width);
+            band.addRow(reinterpret_cast<const QRgb *>(dst), width);
+        }
+    });
+}
@@ -0,0 +1,35 @@
+#ifndef SEPARABLE_H
+#define SEPARABLE_H
+
+#include "border.h"
+#include "parallel.h"
+#include <QImage>
+#include <vector>
+
+class StatsCollector;
+
+// Одно слагаемое ядра: K[ky][kx] = sum(column[ky] * row[kx]) по слагаемым.
+struct SeparableTerm {
+    std::vector<double> column;
+    std::vector<double> row;
+};
+
+// Раскладывает ядро kHeight x kWidth в сумму слагаемых ранга 1.
+// Ранг 1 распознается точно (по опорному элементу), в остальных случаях
+// используется SVD методом Якоби. Слагаемые с сингулярным числом меньше
+// tolerance от наибольшего отбрасываются. Возвращает число слагаемых.
+int decomposeKernel(const double *kernel, int kWidth, int kHeight,
+                    std::vector<SeparableTerm> &terms, double tolerance = 1e-9);
+
+// Выгодна ли раздельная свертка ранга rank по сравнению с прямой.
+bool preferSeparable(int rank, int kWidth, int kHeight);
+
+// Свертка одномерными проходами изображения в формате с раскладкой
+// PixelLayout по байту на канал; за краем изображение продолжается по border. Промежуточный результат хранится во float,
+// поэтому ядра с отрицательными весами (Собель) дают тот же результат,
+// что и прямая свертка.
+void separableFilter(QImage &image, const std::vector<SeparableTerm> &terms,
+                     int kWidth, int kHeight, const Border &border = Border(),
+                     const CancelFlag *cancel = nullptr, StatsCollector *stats = nullptr);
+
+#endif
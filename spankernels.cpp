@@ -0,0 +1,501 @@
+#include "spankernels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPANKERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+std::atomic<int> activeLevel(-1);
+
+// Эталонная реализация: те же double и std::round, что и в исходном фильтре.
+void convolveSpanScalar(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes) {
+    const double *w = weights.exact.data();
+    for (int i = 0; i < bytes; ++i) {
+        double sum = 0.0;
+        for (int t = 0; t < weights.count; ++t) {
+            sum += taps[t][i] * w[t];
+        }
+        dst[i] = static_cast<uchar>(std::max(0, std::min(255, static_cast<int>(std::round(sum)))));
+    }
+}
+
+// Целочисленный путь: сумма в int32, округление прибавлением половины
+// младшего разряда перед сдвигом.
+void convolveSpanFixedScalar(const uchar *const *taps, const SpanWeights &weights,
+                             uchar *dst, int from, int bytes) {
+    const qint32 *w = weights.fixed.data();
+    const qint32 round = weights.fixedShift > 0 ? 1 << (weights.fixedShift - 1) : 0;
+    for (int i = from; i < bytes; ++i) {
+        qint32 sum = round;
+        for (int t = 0; t < weights.count; ++t) {
+            sum += taps[t][i] * w[t];
+        }
+        dst[i] = static_cast<uchar>(std::max(0, std::min(255, sum >> weights.fixedShift)));
+    }
+}
+
+// Длина участка, который накапливается в локальном массиве: он
+// остается в регистрах или L1, а цикл по нему векторизуется.
+const int FLOAT_CHUNK = 64;
+
+// Циклы с постоянной длиной компилятор векторизует сам. Функции встраиваются
+// в обертки с атрибутом target, и там получают регистры нужной ширины.
+template <int N>
+SPAN_INLINE void accumulateBytes(float *__restrict acc, const uchar *__restrict src, float w) {
+    for (int j = 0; j < N; ++j) {
+        acc[j] += w * src[j];
+    }
+}
+
+template <int N>
+SPAN_INLINE void accumulateFloats(float *__restrict acc, const float *__restrict src, float w) {
+    for (int j = 0; j < N; ++j) {
+        acc[j] += w * src[j];
+    }
+}
+
+SPAN_INLINE void spanToFloat(const uchar *const *taps, const float *weights, int tapCount,
+                                                     float *dst, int count) {
+    int i = 0;
+    for (; i + FLOAT_CHUNK <= count; i += FLOAT_CHUNK) {
+        float acc[FLOAT_CHUNK] = {};
+        for (int t = 0; t < tapCount; ++t) {
+            accumulateBytes<FLOAT_CHUNK>(acc, taps[t] + i, weights[t]);
+        }
+        std::copy(acc, acc + FLOAT_CHUNK, dst + i);
+    }
+    for (; i < count; ++i) {
+        float sum = 0.0f;
+        for (int t = 0; t < tapCount; ++t) {
+            sum += weights[t] * taps[t][i];
+        }
+        dst[i] = sum;
+    }
+}
+
+// Каналы по 16 бит копятся в double: во float сумма отводов порядка
+// 65535 теряла бы младший разряд результата.
+const int WORD_CHUNK = 32;
+
+template <int N>
+SPAN_INLINE void accumulateWords(double *__restrict acc, const quint16 *__restrict src,
+                                                           double w) {
+    for (int j = 0; j < N; ++j) {
+        acc[j] += w * src[j];
+    }
+}
+
+inline quint16 doubleToWord(double v) {
+    return static_cast<quint16>(std::max(0.0, std::min(65535.0, v + 0.5)));
+}
+
+SPAN_INLINE void wordSpan(const uchar *const *taps, const double *weights, int tapCount,
+                                                  quint16 *dst, int count) {
+    int i = 0;
+    for (; i + WORD_CHUNK <= count; i += WORD_CHUNK) {
+        double acc[WORD_CHUNK] = {};
+        for (int t = 0; t < tapCount; ++t) {
+            accumulateWords<WORD_CHUNK>(acc, reinterpret_cast<const quint16 *>(taps[t]) + i, weights[t]);
+        }
+        for (int j = 0; j < WORD_CHUNK; ++j) {
+            dst[i + j] = doubleToWord(acc[j]);
+        }
+    }
+    for (; i < count; ++i) {
+        double sum = 0.0;
+        for (int t = 0; t < tapCount; ++t) {
+            sum += weights[t] * reinterpret_cast<const quint16 *>(taps[t])[i];
+        }
+        dst[i] = doubleToWord(sum);
+    }
+}
+
+inline uchar floatToByte(float v) {
+    return static_cast<uchar>(std::max(0.0f, std::min(255.0f, v + 0.5f)));
+}
+
+SPAN_INLINE void floatSpan(const float *const *taps, const float *weights, int tapCount,
+                                                   uchar *dst, int count) {
+    int i = 0;
+    for (; i + FLOAT_CHUNK <= count; i += FLOAT_CHUNK) {
+        float acc[FLOAT_CHUNK] = {};
+        for (int t = 0; t < tapCount; ++t) {
+            accumulateFloats<FLOAT_CHUNK>(acc, taps[t] + i, weights[t]);
+        }
+        for (int j = 0; j < FLOAT_CHUNK; ++j) {
+            dst[i + j] = floatToByte(acc[j]);
+        }
+    }
+    for (; i < count; ++i) {
+        float sum = 0.0f;
+        for (int t = 0; t < tapCount; ++t) {
+            sum += weights[t] * taps[t][i];
+        }
+        dst[i] = floatToByte(sum);
+    }
+}
+
+#ifdef SPANKERNELS_X86
+
+// Хвост короче вектора считается во float, как и векторная часть.
+// Прибавление 0.5 и отбрасывание дробной части дает округление от нуля
+// для неотрицательных сумм, а отрицательные все равно обнуляются.
+inline void convolveTailFloat(const uchar *const *taps, const float *w, int tapCount,
+                              uchar *dst, int from, int bytes) {
+    for (int i = from; i < bytes; ++i) {
+        float sum = 0.0f;
+        for (int t = 0; t < tapCount; ++t) {
+            sum += taps[t][i] * w[t];
+        }
+        int v = static_cast<int>(sum + 0.5f);
+        dst[i] = static_cast<uchar>(std::max(0, std::min(255, v)));
+    }
+}
+
+__attribute__((target("sse4.1")))
+void convolveSpanSse41(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes) {
+    const float *w = weights.packed.data();
+    const int tapCount = weights.count;
+    const __m128 half = _mm_set1_ps(0.5f);
+    int i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+        for (int t = 0; t < tapCount; ++t) {
+            __m128 wt = _mm_set1_ps(w[t]);
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(taps[t] + i));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(wt, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(v))));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(wt, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4)))));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(wt, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 8)))));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(wt, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 12)))));
+        }
+        __m128i i0 = _mm_cvttps_epi32(_mm_add_ps(acc0, half));
+        __m128i i1 = _mm_cvttps_epi32(_mm_add_ps(acc1, half));
+        __m128i i2 = _mm_cvttps_epi32(_mm_add_ps(acc2, half));
+        __m128i i3 = _mm_cvttps_epi32(_mm_add_ps(acc3, half));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+
+    convolveTailFloat(taps, w, tapCount, dst, i, bytes);
+}
+
+__attribute__((target("avx2,fma")))
+void convolveSpanAvx2(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes) {
+    const float *w = weights.packed.data();
+    const int tapCount = weights.count;
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+
+    for (; i + 32 <= bytes; i += 32) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        for (int t = 0; t < tapCount; ++t) {
+            __m256 wt = _mm256_set1_ps(w[t]);
+            const uchar *p = taps[t] + i;
+            acc0 = _mm256_fmadd_ps(wt, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)))), acc0);
+            acc1 = _mm256_fmadd_ps(wt, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + 8)))), acc1);
+            acc2 = _mm256_fmadd_ps(wt, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + 16)))), acc2);
+            acc3 = _mm256_fmadd_ps(wt, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + 24)))), acc3);
+        }
+        __m256i i0 = _mm256_cvttps_epi32(_mm256_add_ps(acc0, half));
+        __m256i i1 = _mm256_cvttps_epi32(_mm256_add_ps(acc1, half));
+        __m256i i2 = _mm256_cvttps_epi32(_mm256_add_ps(acc2, half));
+        __m256i i3 = _mm256_cvttps_epi32(_mm256_add_ps(acc3, half));
+        // Упаковка идет внутри 128-битных половин, перестановка
+        // возвращает четверки байтов в исходный порядок.
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(i0, i1), _mm256_packs_epi32(i2, i3));
+        packed = _mm256_permutevar8x32_epi32(packed, order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+    }
+
+    convolveTailFloat(taps, w, tapCount, dst, i, bytes);
+}
+
+// Отводы берутся парами: байты двух строк перемежаются, расширяются до
+// int16 и умножаются pmaddwd на пару весов, что сразу дает сумму в int32.
+__attribute__((target("sse4.1")))
+void convolveSpanFixedSse41(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes) {
+    const int tapCount = weights.count;
+    const __m128i round = _mm_set1_epi32(weights.fixedShift > 0 ? 1 << (weights.fixedShift - 1) : 0);
+    const __m128i shift = _mm_cvtsi32_si128(weights.fixedShift);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+        for (int t = 0; t < tapCount; t += 2) {
+            __m128i wp = _mm_set1_epi32(weights.fixedPairs[t / 2]);
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(taps[t] + i));
+            __m128i b = t + 1 < tapCount
+                    ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(taps[t + 1] + i)) : zero;
+            __m128i lo = _mm_unpacklo_epi8(a, b);
+            __m128i hi = _mm_unpackhi_epi8(a, b);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_cvtepu8_epi16(lo), wp));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(lo, 8)), wp));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_cvtepu8_epi16(hi), wp));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(hi, 8)), wp));
+        }
+        acc0 = _mm_sra_epi32(acc0, shift);
+        acc1 = _mm_sra_epi32(acc1, shift);
+        acc2 = _mm_sra_epi32(acc2, shift);
+        acc3 = _mm_sra_epi32(acc3, shift);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(acc0, acc1), _mm_packs_epi32(acc2, acc3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+
+    convolveSpanFixedScalar(taps, weights, dst, i, bytes);
+}
+
+// Используется и на процессорах с AVX-512: 16-битные умножения AVX-512BW
+// здесь не дают выигрыша, узким местом остается загрузка строк.
+__attribute__((target("avx2")))
+void convolveSpanFixedAvx2(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes) {
+    const int tapCount = weights.count;
+    const __m256i round = _mm256_set1_epi32(weights.fixedShift > 0 ? 1 << (weights.fixedShift - 1) : 0);
+    const __m128i shift = _mm_cvtsi32_si128(weights.fixedShift);
+    const __m128i zero = _mm_setzero_si128();
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+        for (int t = 0; t < tapCount; t += 2) {
+            __m256i wp = _mm256_set1_epi32(weights.fixedPairs[t / 2]);
+            const uchar *pa = taps[t] + i;
+            const uchar *pb = t + 1 < tapCount ? taps[t + 1] + i : nullptr;
+            __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pa));
+            __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pa + 16));
+            __m128i b0 = pb ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(pb)) : zero;
+            __m128i b1 = pb ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(pb + 16)) : zero;
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(a0, b0)), wp));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(a0, b0)), wp));
+            acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(a1, b1)), wp));
+            acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(a1, b1)), wp));
+        }
+        acc0 = _mm256_sra_epi32(acc0, shift);
+        acc1 = _mm256_sra_epi32(acc1, shift);
+        acc2 = _mm256_sra_epi32(acc2, shift);
+        acc3 = _mm256_sra_epi32(acc3, shift);
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(acc0, acc1), _mm256_packs_epi32(acc2, acc3));
+        packed = _mm256_permutevar8x32_epi32(packed, order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+    }
+
+    convolveSpanFixedScalar(taps, weights, dst, i, bytes);
+}
+
+__attribute__((target("avx2,fma")))
+void convolveSpanToFloatAvx2(const uchar *const *taps, const float *weights, int tapCount,
+                             float *dst, int count) {
+    spanToFloat(taps, weights, tapCount, dst, count);
+}
+
+__attribute__((target("avx2,fma")))
+void convolveSpan16Avx2(const uchar *const *taps, const double *weights, int tapCount, quint16 *dst, int count) {
+    wordSpan(taps, weights, tapCount, dst, count);
+}
+
+__attribute__((target("avx2,fma")))
+void convolveFloatSpanAvx2(const float *const *taps, const float *weights, int tapCount,
+                           uchar *dst, int count) {
+    floatSpan(taps, weights, tapCount, dst, count);
+}
+
+// GCC 12 ложно предупреждает о неинициализированных значениях внутри
+// встроенных функций avx512fintrin.h.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+void convolveSpanAvx512(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes) {
+    const float *w = weights.packed.data();
+    const int tapCount = weights.count;
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512i zero = _mm512_setzero_si512();
+    int i = 0;
+
+    for (; i + 64 <= bytes; i += 64) {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        for (int t = 0; t < tapCount; ++t) {
+            __m512 wt = _mm512_set1_ps(w[t]);
+            const uchar *p = taps[t] + i;
+            acc0 = _mm512_fmadd_ps(wt, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)))), acc0);
+            acc1 = _mm512_fmadd_ps(wt, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16)))), acc1);
+            acc2 = _mm512_fmadd_ps(wt, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32)))), acc2);
+            acc3 = _mm512_fmadd_ps(wt, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 48)))), acc3);
+        }
+        // Отрицательные суммы обнуляются до беззнакового насыщения.
+        __m512i i0 = _mm512_max_epi32(_mm512_cvttps_epi32(_mm512_add_ps(acc0, half)), zero);
+        __m512i i1 = _mm512_max_epi32(_mm512_cvttps_epi32(_mm512_add_ps(acc1, half)), zero);
+        __m512i i2 = _mm512_max_epi32(_mm512_cvttps_epi32(_mm512_add_ps(acc2, half)), zero);
+        __m512i i3 = _mm512_max_epi32(_mm512_cvttps_epi32(_mm512_add_ps(acc3, half)), zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm512_cvtusepi32_epi8(i0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 16), _mm512_cvtusepi32_epi8(i1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 32), _mm512_cvtusepi32_epi8(i2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 48), _mm512_cvtusepi32_epi8(i3));
+    }
+
+    convolveTailFloat(taps, w, tapCount, dst, i, bytes);
+}
+#pragma GCC diagnostic pop
+
+#endif
+
+}
+
+SimdLevel detectSimdLevel() {
+#ifdef SPANKERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdAvx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdSse41;
+    }
+#endif
+    return SimdNone;
+}
+
+void setSimdLevel(SimdLevel level) {
+    activeLevel = std::min(level, detectSimdLevel());
+}
+
+SimdLevel simdLevel() {
+    int level = activeLevel;
+    if (level < 0) {
+        level = detectSimdLevel();
+        activeLevel = level;
+    }
+    return static_cast<SimdLevel>(level);
+}
+
+const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdSse41: return "SSE4.1";
+    case SimdAvx2: return "AVX2";
+    case SimdAvx512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+SpanWeights::SpanWeights(const double *values, int count)
+    : count(count), exact(values, values + count), packed(values, values + count),
+      hasFixed(false), fixedShift(0) {
+    double maxWeight = 0.0, absSum = 0.0, sum = 0.0;
+    for (int t = 0; t < count; ++t) {
+        maxWeight = std::max(maxWeight, std::fabs(values[t]));
+        absSum += std::fabs(values[t]);
+        sum += values[t];
+    }
+
+    // Вес должен помещаться в int16, а сумма по 255 — в int32.
+    int shift = 14;
+    while (shift > 0 && (maxWeight * (1 << shift) > 32767.0 ||
+                         absSum * 255.0 * (1 << shift) > 2147483647.0 / 2)) {
+        --shift;
+    }
+    if (maxWeight > 32767.0 || absSum * 255.0 > 2147483647.0 / 2) {
+        return;
+    }
+
+    hasFixed = true;
+    fixedShift = shift;
+    fixed.resize(count);
+    int largest = 0;
+    qint32 quantizedSum = 0;
+    for (int t = 0; t < count; ++t) {
+        fixed[t] = static_cast<qint32>(std::lround(values[t] * (1 << shift)));
+        quantizedSum += fixed[t];
+        if (std::fabs(values[t]) > std::fabs(values[largest])) {
+            largest = t;
+        }
+    }
+
+    // Ошибку округления весов переносим на наибольший вес, чтобы сумма
+    // весов (и яркость однородных областей) сохранялась точно.
+    qint32 correction = static_cast<qint32>(std::lround(sum * (1 << shift))) - quantizedSum;
+    if (count > 0 && std::abs(fixed[largest] + correction) <= 32767) {
+        fixed[largest] += correction;
+    }
+
+    fixedPairs.assign((count + 1) / 2, 0);
+    for (int t = 0; t < count; ++t) {
+        quint32 half = static_cast<quint16>(static_cast<qint16>(fixed[t]));
+        fixedPairs[t / 2] |= static_cast<qint32>(t % 2 == 0 ? half : half << 16);
+    }
+}
+
+void convolveSpan(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes,
+                  FilterPrecision precision) {
+    if (precision == PrecisionFast && weights.hasFixed) {
+        switch (simdLevel()) {
+#ifdef SPANKERNELS_X86
+        case SimdAvx512:
+        case SimdAvx2: convolveSpanFixedAvx2(taps, weights, dst, bytes); break;
+        case SimdSse41: convolveSpanFixedSse41(taps, weights, dst, bytes); break;
+#endif
+        default: convolveSpanFixedScalar(taps, weights, dst, 0, bytes); break;
+        }
+        return;
+    }
+
+    switch (simdLevel()) {
+#ifdef SPANKERNELS_X86
+    case SimdAvx512: convolveSpanAvx512(taps, weights, dst, bytes); break;
+    case SimdAvx2: convolveSpanAvx2(taps, weights, dst, bytes); break;
+    case SimdSse41: convolveSpanSse41(taps, weights, dst, bytes); break;
+#endif
+    default: convolveSpanScalar(taps, weights, dst, bytes); break;
+    }
+}
+
+void convolveSpanToFloat(const uchar *const *taps, const float *weights, int tapCount,
+                         float *dst, int count) {
+#ifdef SPANKERNELS_X86
+    if (simdLevel() >= SimdAvx2) {
+        convolveSpanToFloatAvx2(taps, weights, tapCount, dst, count);
+        return;
+    }
+#endif
+    spanToFloat(taps, weights, tapCount, dst, count);
+}
+
+void convolveFloatSpan(const float *const *taps, const float *weights, int tapCount,
+                       uchar *dst, int count) {
+#ifdef SPANKERNELS_X86
+    if (simdLevel() >= SimdAvx2) {
+        convolveFloatSpanAvx2(taps, weights, tapCount, dst, count);
+        return;
+    }
+#endif
+    floatSpan(taps, weights, tapCount, dst, count);
+}
+
+void convolveSpan16(const uchar *const *taps, const SpanWeights &weights, quint16 *dst, int count) {
+#ifdef SPANKERNELS_X86
+    if (simdLevel() >= SimdAvx2) {
+        convolveSpan16Avx2(taps, weights.exact.data(), weights.count, dst, count);
+        return;
+    }
+#endif
+    wordSpan(taps, weights.exact.data(), weights.count, dst, count);
+}
@@ -0,0 +1,77 @@
+#ifndef SPANKERNELS_H
+#define SPANKERNELS_H
+
+#include <QtGlobal>
+#include <vector>
+
+// Внутренние циклы ядер, которые должны встраиваться в каждую версию под
+// свой набор инструкций. Без GCC/Clang — обычный inline.
+#if defined(__GNUC__)
+#define SPAN_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define SPAN_INLINE __forceinline
+#else
+#define SPAN_INLINE inline
+#endif
+
+// Уровни набора инструкций для ядер свертки.
+enum SimdLevel {
+    SimdNone,
+    SimdSse41,
+    SimdAvx2,
+    SimdAvx512
+};
+
+// Лучший уровень, который поддерживает процессор (по CPUID).
+SimdLevel detectSimdLevel();
+
+// Ограничивает используемый уровень, например SimdNone для эталонного
+// скалярного пути. По умолчанию используется detectSimdLevel().
+void setSimdLevel(SimdLevel level);
+SimdLevel simdLevel();
+const char *simdLevelName(SimdLevel level);
+
+// Exact считает в плавающей точке, Fast — в int32 с весами в фиксированной
+// точке (16 бит). Результаты Fast отличаются от Exact не больше чем на 1.
+enum FilterPrecision {
+    PrecisionExact,
+    PrecisionFast
+};
+
+// Веса ядра в виде, готовом для всех реализаций.
+struct SpanWeights {
+    SpanWeights(const double *values, int count);
+
+    int count;
+    std::vector<double> exact;
+    std::vector<float> packed;
+
+    // Веса, умноженные на 2^fixedShift и округленные. Сдвиг выбирается
+    // максимальным (не больше 14), при котором веса помещаются в int16.
+    // hasFixed == false, если ядро не представимо в 16 битах.
+    bool hasFixed;
+    int fixedShift;
+    std::vector<qint32> fixed;
+    // Пары соседних весов (младшие 16 бит — четный отвод) для pmaddwd.
+    std::vector<qint32> fixedPairs;
+};
+
+// dst[i] = clamp(round(sum(weights[t] * taps[t][i]))) для i из [0, bytes).
+// Байты обрабатываются независимо, поэтому функция не зависит от числа
+// каналов: смещение отвода задается указателями taps.
+void convolveSpan(const uchar *const *taps, const SpanWeights &weights, uchar *dst, int bytes,
+                  FilterPrecision precision = PrecisionExact);
+
+// То же для каналов по 16 бит: отводы указывают на quint16, count — число
+// значений. Считается в double при любой точности.
+void convolveSpan16(const uchar *const *taps, const SpanWeights &weights, quint16 *dst, int count);
+
+// Проходы раздельной свертки с промежуточным результатом во float:
+// первый не округляет и не обрезает сумму, второй собирает строки
+// промежуточного результата и переводит их обратно в байты.
+void convolveSpanToFloat(const uchar *const *taps, const float *weights, int tapCount,
+                         float *dst, int count);
+void convolveFloatSpan(const float *const *taps, const float *weights, int tapCount,
+                       uchar *dst, int count);
+
+#endif
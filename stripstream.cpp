@@ -0,0 +1,198 @@
+#include "stripstream.h"
+#include <QFileInfo>
+#include <QRgb>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+void setError(QString *error, const QString &message) {
+    if (error != nullptr) {
+        *error = message;
+    }
+}
+
+bool isPpmFile(const QString &fileName) {
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "ppm" || suffix == "pnm";
+}
+
+}
+
+bool PpmReader::readHeaderValue(int &value) {
+    char c = 0;
+    // Пробелы и комментарии до конца строки между полями заголовка.
+    for (;;) {
+        if (!file.getChar(&c)) {
+            return false;
+        }
+        if (c == '#') {
+            while (c != '\n') {
+                if (!file.getChar(&c)) {
+                    return false;
+                }
+            }
+        } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            break;
+        }
+    }
+
+    value = 0;
+    while (c >= '0' && c <= '9') {
+        if (value > (1 << 24)) {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+        if (!file.getChar(&c)) {
+            return false;
+        }
+    }
+    // После последнего поля ровно один пробельный символ, дальше данные.
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool PpmReader::open(const QString &fileName, QString *error) {
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, "Не удалось открыть " + fileName);
+        return false;
+    }
+
+    int maxValue = 0;
+    if (file.read(2) != "P6" || !readHeaderValue(width_) || !readHeaderValue(height_) ||
+        !readHeaderValue(maxValue)) {
+        setError(error, "Файл " + fileName + " не является двоичным PPM (P6).");
+        return false;
+    }
+    if (width_ <= 0 || height_ <= 0 || maxValue != 255) {
+        setError(error, "Поддерживается только PPM с 8 битами на канал: " + fileName);
+        return false;
+    }
+
+    rowsRead = 0;
+    rowBuffer.resize(width_ * 3);
+    return true;
+}
+
+bool PpmReader::readRow(QRgb *dst) {
+    if (rowsRead >= height_ || file.read(rowBuffer.data(), rowBuffer.size()) != rowBuffer.size()) {
+        return false;
+    }
+    ++rowsRead;
+
+    const uchar *src = reinterpret_cast<const uchar *>(rowBuffer.constData());
+    for (int x = 0; x < width_; ++x) {
+        dst[x] = qRgb(src[x * 3], src[x * 3 + 1], src[x * 3 + 2]);
+    }
+    return true;
+}
+
+bool PpmWriter::open(const QString &fileName, int width, int height, QString *error) {
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        setError(error, "Не удалось создать " + fileName);
+        return false;
+    }
+    this->width = width;
+    rowBuffer.resize(width * 3);
+    QByteArray header = QString("P6\n%1 %2\n255\n").arg(width).arg(height).toLatin1();
+    return file.write(header) == header.size();
+}
+
+bool PpmWriter::writeRow(const QRgb *src) {
+    uchar *dst = reinterpret_cast<uchar *>(rowBuffer.data());
+    for (int x = 0; x < width; ++x) {
+        dst[x * 3] = static_cast<uchar>(qRed(src[x]));
+        dst[x * 3 + 1] = static_cast<uchar>(qGreen(src[x]));
+        dst[x * 3 + 2] = static_cast<uchar>(qBlue(src[x]));
+    }
+    return file.write(rowBuffer) == rowBuffer.size();
+}
+
+bool PpmWriter::close() {
+    bool ok = file.flush();
+    file.close();
+    return ok;
+}
+
+StripFilter chainStripFilter(const FilterChain &chain, const FilterOptions &options) {
+    StripFilter filter;
+    filter.halo = chain.halo();
+    filter.streamable = options.border.mode != BorderWrap;
+    filter.apply = [chain, options](QImage &strip) {
+        chain.apply(strip, options);
+    };
+    return filter;
+}
+
+bool streamFilterPpm(const QString &source, const QString &target, const StripFilter &filter,
+                     int stripRows, QString *error, QSize *size) {
+    PpmReader reader;
+    if (!reader.open(source, error)) {
+        return false;
+    }
+    if (size != nullptr) {
+        *size = QSize(reader.width(), reader.height());
+    }
+    PpmWriter writer;
+    if (!writer.open(target, reader.width(), reader.height(), error)) {
+        return false;
+    }
+
+    const int width = reader.width();
+    const int height = reader.height();
+    const int halo = std::max(0, filter.halo);
+    stripRows = std::max(1, stripRows);
+    const int capacity = stripRows + 2 * halo;
+
+    // Окно строк источника [first, last) = [y0 - halo, y0 + stripRows + halo),
+    // обрезанное границами изображения: у краев фильтр сам повторяет крайние
+    // строки, как при обработке целиком, в том числе для промежуточных
+    // ступеней цепочки. Соседние окна перекрываются, общие строки переносятся,
+    // а не читаются заново, так что файл читается ровно один раз.
+    QImage window(width, capacity, QImage::Format_RGB32);
+    const size_t rowBytes = static_cast<size_t>(width) * 4;
+    int windowFirst = 0;
+    int windowRows = 0;
+
+    for (int y0 = 0; y0 < height; y0 += stripRows) {
+        const int first = std::max(0, y0 - halo);
+        const int last = std::min(height, y0 + stripRows + halo);
+        int kept = std::max(0, windowFirst + windowRows - first);
+        // При stripRows <= halo окно может начинаться с той же строки, и
+        // переносить тогда нечего.
+        for (int i = 0; i < kept && first != windowFirst; ++i) {
+            std::memcpy(window.scanLine(i), window.constScanLine(first - windowFirst + i), rowBytes);
+        }
+        for (int i = kept; i < last - first; ++i) {
+            if (!reader.readRow(reinterpret_cast<QRgb *>(window.scanLine(i)))) {
+                setError(error, "Файл " + source + " обрезан.");
+                return false;
+            }
+        }
+        windowFirst = first;
+        windowRows = last - first;
+
+        QImage strip = windowRows == capacity ? window : window.copy(0, 0, width, windowRows);
+        filter.apply(strip);
+
+        int rows = std::min(stripRows, height - y0);
+        for (int i = 0; i < rows; ++i) {
+            if (!writer.writeRow(reinterpret_cast<const QRgb *>(strip.constScanLine(y0 - first + i)))) {
+                setError(error, "Не удалось записать " + target);
+                return false;
+            }
+        }
+    }
+
+    if (!writer.close()) {
+        setError(error, "Не удалось записать " + target);
+        return false;
+    }
+    return true;
+}
+
+bool isStreamablePair(const QString &source, const QString &target) {
+    return isPpmFile(source) && isPpmFile(target);
+}
@@ -0,0 +1,76 @@
+#ifndef STRIPSTREAM_H
+#define STRIPSTREAM_H
+
+#include "filterchain.h"
+#include <QFile>
+#include <QImage>
+#include <QString>
+#include <functional>
+
+// Построчное чтение двоичного PPM (P6, 8 бит на канал).
+class PpmReader {
+public:
+    PpmReader() : width_(0), height_(0), rowsRead(0) {}
+
+    bool open(const QString &fileName, QString *error = nullptr);
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Читает следующую строку в dst (width() пикселей Format_RGB32).
+    bool readRow(QRgb *dst);
+
+private:
+    bool readHeaderValue(int &value);
+
+    QFile file;
+    int width_;
+    int height_;
+    int rowsRead;
+    QByteArray rowBuffer;
+};
+
+// Построчная запись двоичного PPM.
+class PpmWriter {
+public:
+    PpmWriter() : width(0) {}
+
+    bool open(const QString &fileName, int width, int height, QString *error = nullptr);
+    bool writeRow(const QRgb *src);
+    bool close();
+
+private:
+    QFile file;
+    int width;
+    QByteArray rowBuffer;
+};
+
+// Фильтр, применимый к полосе изображения: строки результата зависят от
+// строк источника не дальше halo по вертикали. streamable == false, если
+// краевым строкам нужны строки с другого края (BorderWrap), и обрабатывать
+// изображение полосами нельзя.
+struct StripFilter {
+    StripFilter() : halo(0), streamable(true) {}
+
+    int halo;
+    bool streamable;
+    std::function<void(QImage &)> apply;
+};
+
+// Цепочка как фильтр полосы, ореол — FilterChain::halo(). Рекурсивное
+// размытие не имеет конечного носителя, для него ореол берется по радиусу
+// ядра, и отклонение на стыках полос не больше kernelError из selectBlurEngine.
+StripFilter chainStripFilter(const FilterChain &chain, const FilterOptions &options = FilterOptions());
+
+// Фильтрует PPM-файл полосами по stripRows строк с ореолом сверху и снизу
+// и пишет результат в target. У краев изображения полоса обрезается, и
+// фильтр обрабатывает край сам, поэтому результат совпадает с обработкой
+// целиком.
+// Памяти нужно O(ширина * (stripRows + 2 * halo)), а не на все изображение.
+// В size, если задан, записывается размер изображения.
+bool streamFilterPpm(const QString &source, const QString &target, const StripFilter &filter,
+                     int stripRows, QString *error = nullptr, QSize *size = nullptr);
+
+// Можно ли обработать пару файлов полосами (оба — PPM).
+bool isStreamablePair(const QString &source, const QString &target);
+
+#endif
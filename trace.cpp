@@ -0,0 +1,144 @@
+#include "trace.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QStringList>
+#include <QTextStream>
+#include <algorithm>
+#include <vector>
+
+std::atomic<bool> tracingFlag(false);
+
+namespace {
+
+// Ограничение на число событий, чтобы забытая включенной запись не съела
+// память: около 50 МБ. Более поздние события отбрасываются.
+const size_t MAX_EVENTS = 1 << 20;
+
+QMutex eventsMutex;
+std::vector<TraceEvent> events;
+std::atomic<int> threadCount(0);
+
+struct StartedTimer {
+    StartedTimer() { timer.start(); }
+    QElapsedTimer timer;
+};
+
+int currentTraceThread() {
+    thread_local int thread = ++threadCount;
+    return thread;
+}
+
+}
+
+void setTracingEnabled(bool enabled) {
+    tracingFlag = enabled;
+}
+
+qint64 traceClock() {
+    static const StartedTimer clock;
+    return clock.timer.nsecsElapsed();
+}
+
+void recordTraceEvent(const char *name, qint64 start, qint64 pixels, qint64 bytes) {
+    TraceEvent event;
+    event.name = name;
+    event.thread = currentTraceThread();
+    event.start = start;
+    event.duration = traceClock() - start;
+    event.pixels = pixels;
+    event.bytes = bytes;
+
+    QMutexLocker locker(&eventsMutex);
+    if (events.size() < MAX_EVENTS) {
+        events.push_back(event);
+    }
+}
+
+QVector<TraceStage> traceSummary(qint64 since) {
+    QVector<TraceStage> stages;
+    QMutexLocker locker(&eventsMutex);
+    for (const TraceEvent &event : events) {
+        if (event.start < since) {
+            continue;
+        }
+        int index = 0;
+        while (index < stages.size() && stages[index].name != QLatin1String(event.name)) {
+            ++index;
+        }
+        if (index == stages.size()) {
+            stages.append(TraceStage());
+            stages.last().name = QString::fromLatin1(event.name);
+        }
+        TraceStage &stage = stages[index];
+        stage.nanoseconds += event.duration;
+        stage.pixels += event.pixels;
+        stage.bytes += event.bytes;
+        ++stage.calls;
+    }
+    return stages;
+}
+
+QString traceSummaryText(qint64 since, int maxStages) {
+    QVector<TraceStage> stages = traceSummary(since);
+    std::stable_sort(stages.begin(), stages.end(), [](const TraceStage &a, const TraceStage &b) {
+        return a.nanoseconds > b.nanoseconds;
+    });
+    QStringList parts;
+    for (int i = 0; i < std::min(maxStages, stages.size()); ++i) {
+        parts << QString("%1 %2 мс").arg(stages[i].name).arg(stages[i].nanoseconds / 1e6, 0, 'f', 1);
+    }
+    return parts.join(", ");
+}
+
+void clearTrace() {
+    QMutexLocker locker(&eventsMutex);
+    events.clear();
+}
+
+bool writeChromeTrace(const QString &fileName, QString *error) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        if (error != nullptr) {
+            *error = "Не удалось записать " + fileName + ": " + file.errorString();
+        }
+        return false;
+    }
+
+    // Полные события ("ph": "X"), время в микросекундах. Имена стадий —
+    // литералы из кода, экранировать их не нужно.
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    QMutexLocker locker(&eventsMutex);
+    int maxThread = 0;
+    bool first = true;
+    for (const TraceEvent &event : events) {
+        maxThread = std::max(maxThread, event.thread);
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+            << ",\"ts\":" << QString::number(event.start / 1e3, 'f', 3)
+            << ",\"dur\":" << QString::number(event.duration / 1e3, 'f', 3)
+            << ",\"args\":{\"pixels\":" << event.pixels << ",\"bytes\":" << event.bytes;
+        if (event.pixels > 0 && event.duration > 0) {
+            out << ",\"MPix/s\":" << QString::number(event.pixels * 1e3 / event.duration, 'f', 1);
+        }
+        out << "}}";
+    }
+    for (int thread = 1; thread <= maxThread; ++thread) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+            << ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+    }
+    out << "\n]}\n";
+    out.flush();
+
+    if (file.error() != QFileDevice::NoError) {
+        if (error != nullptr) {
+            *error = "Не удалось записать " + fileName + ": " + file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
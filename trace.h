@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+#include <atomic>
+
+// Запись времени стадий обработки. Пока запись выключена (по умолчанию),
+// TraceScope только читает флаг, так что отметки можно оставлять в
+// горячем коде, например на каждую полосу свертки.
+void setTracingEnabled(bool enabled);
+
+extern std::atomic<bool> tracingFlag;
+
+inline bool tracingEnabled() {
+    return tracingFlag.load(std::memory_order_relaxed);
+}
+
+// Наносекунды от первого обращения к часам трассировки.
+qint64 traceClock();
+
+// Событие: стадия name на потоке thread (номера с 1 в порядке первой
+// записи) длилась duration нс от start и обработала pixels пикселей и
+// bytes байт.
+struct TraceEvent {
+    const char *name;
+    int thread;
+    qint64 start;
+    qint64 duration;
+    qint64 pixels;
+    qint64 bytes;
+};
+
+void recordTraceEvent(const char *name, qint64 start, qint64 pixels, qint64 bytes);
+
+// Отмечает время от создания до уничтожения. name должно жить до конца
+// программы (строковый литерал). Объем работы можно уточнить до конца
+// области через setWork.
+class TraceScope {
+public:
+    explicit TraceScope(const char *name, qint64 pixels = 0, qint64 bytes = 0)
+        : name(name), start(tracingEnabled() ? traceClock() : -1), pixels(pixels), bytes(bytes) {}
+
+    ~TraceScope() {
+        if (start >= 0) {
+            recordTraceEvent(name, start, pixels, bytes);
+        }
+    }
+
+    void setWork(qint64 workPixels, qint64 workBytes) {
+        pixels = workPixels;
+        bytes = workBytes;
+    }
+
+private:
+    TraceScope(const TraceScope &);
+    TraceScope &operator=(const TraceScope &);
+
+    const char *name;
+    qint64 start;
+    qint64 pixels;
+    qint64 bytes;
+};
+
+// Сумма по стадии. Для стадий на нескольких потоках nanoseconds — сумма
+// времени всех потоков, а не время от начала до конца.
+struct TraceStage {
+    TraceStage() : nanoseconds(0), pixels(0), bytes(0), calls(0) {}
+
+    QString name;
+    qint64 nanoseconds;
+    qint64 pixels;
+    qint64 bytes;
+    int calls;
+};
+
+// Стадии событий, начавшихся не раньше since (по traceClock), в порядке
+// первого появления.
+QVector<TraceStage> traceSummary(qint64 since = 0);
+
+// Сводка одной строкой: "стадия мс, ..." для самых долгих стадий.
+QString traceSummaryText(qint64 since = 0, int maxStages = 4);
+
+void clearTrace();
+
+// Пишет события в формате Chrome Trace Event (about:tracing, Perfetto).
+bool writeChromeTrace(const QString &fileName, QString *error = nullptr);
+
+#endif